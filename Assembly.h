@@ -0,0 +1,94 @@
+#ifndef ASSEMBLY_H
+#define ASSEMBLY_H
+
+/*
+* Assembly baking.
+* A rigid assembly (a car body, a wheel) is built as a SceneGraph of parts like any other, then BakeAssembly
+* pre-transforms the vertices of every part's draws into the assembly root's space and merges them into one
+* AssemblyMesh per material, layer, category and primitive kind. Strips and fans become plain triangle lists, triangle for
+* triangle the same the strip or fan would have produced, so parts drawn with different modes merge; lines stay
+* lines. Normals go through the part's normal matrix exactly as the light vertex shader would have applied it,
+* and the uv coordinates are untouched: the material's uvScale still applies, which is why materials never merge.
+* The baked mesh is drawn from the assembly root's node, whose world matrix is then the only transform left.
+*/
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "MeshGen.h"
+#include "NormalMatrix.h"
+#include "SceneGraph.h"
+
+//Merged draws of one material, layer, category and primitive kind, in the assembly root's space
+struct AssemblyMesh {
+	MaterialId material;
+	uint32_t layer;	//RenderLayer
+	uint32_t category;	//RenderCategory
+	uint32_t mode;	//GL_TRIANGLES, or GL_LINES for line draws
+	MeshVertices vertices;
+};
+
+//Appends vertex, transformed to the assembly's space, to out
+inline void AssemblyAppendVertex(std::vector<float>& out, const float* vertex, const glm::mat4& model, const glm::mat3& normal)
+{
+	const glm::vec3 position = glm::vec3(model * glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f));
+	const glm::vec3 direction = normal * glm::vec3(vertex[3], vertex[4], vertex[5]);
+	const float baked[FLOATS_PER_VERTEX] = { position.x, position.y, position.z, direction.x, direction.y, direction.z, vertex[6], vertex[7] };
+	out.insert(out.end(), baked, baked + FLOATS_PER_VERTEX);
+}
+
+//Bakes every draw of parts, whose world matrices must be up to date, into meshes appended to or merged into out.
+//vertices holds the vertices the parts' MeshRef::firstVertex and ranges index.
+//False when a draw uses a primitive mode other than triangles, triangle strips, triangle fans or lines.
+inline bool BakeAssembly(const SceneGraph& parts, const float* vertices, std::vector<AssemblyMesh>& out)
+{
+	for (const SceneDraw& draw : parts.draws) {
+		const glm::mat4& model = parts.world(draw.node);
+		const glm::mat3 normal = draw.uniformScale ? NormalMatrixUniformScale(model) : NormalMatrix(model);
+		for (int r = 0; r < draw.rangeCount; r++) {
+			const DrawRange& range = draw.ranges[r];
+			if (range.mode != GL_TRIANGLES && range.mode != GL_TRIANGLE_STRIP && range.mode != GL_TRIANGLE_FAN && range.mode != GL_LINES) {
+				std::cout << "ERROR::ASSEMBLY::MODE 0x" << std::hex << range.mode << std::dec << " cannot be baked" << std::endl;
+				return false;
+			}
+			const uint32_t mode = range.mode == GL_LINES ? GL_LINES : GL_TRIANGLES;
+			AssemblyMesh* mesh = nullptr;
+			for (AssemblyMesh& other : out)
+				if (other.material == draw.material && other.layer == draw.layer && other.category == draw.category && other.mode == mode)
+					mesh = &other;
+			if (!mesh) {
+				out.push_back({ draw.material, draw.layer, draw.category, mode, MeshVertices() });
+				mesh = &out.back();
+			}
+
+			std::vector<float>& data = mesh->vertices.data;
+			const float* first = vertices + (size_t)(draw.mesh.firstVertex + range.first) * FLOATS_PER_VERTEX;
+			auto append = [&](uint32_t index) { AssemblyAppendVertex(data, first + (size_t)index * FLOATS_PER_VERTEX, model, normal); };
+			if (range.mode == GL_TRIANGLE_STRIP) {
+				//Every other triangle of a strip is wound the other way, swap its first two vertices back
+				for (uint32_t i = 0; i + 2 < range.count; i++) {
+					append(i % 2 ? i + 1 : i);
+					append(i % 2 ? i : i + 1);
+					append(i + 2);
+				}
+			}
+			else if (range.mode == GL_TRIANGLE_FAN) {
+				for (uint32_t i = 1; i + 1 < range.count; i++) {
+					append(0);
+					append(i);
+					append(i + 1);
+				}
+			}
+			else {
+				for (uint32_t i = 0; i < range.count; i++)
+					append(i);
+			}
+		}
+	}
+	return true;
+}
+
+#endif
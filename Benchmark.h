@@ -0,0 +1,361 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+/*
+* Deterministic benchmark support: scripted camera paths, per-frame samples,
+* JSON result files and a comparison of two result files with confidence intervals.
+*
+* Camera path file format, one entry per line, '#' starts a comment:
+*   key   <time s> <x> <y> <z> <yaw deg> <pitch deg>   Catmull-Rom spline keyframe
+*   input <frame> <W|A|S|D|Q|E> <delta time s>         recorded key press, replayed on that frame
+*/
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//Fixed time step used to advance scripted runs, independent of how long frames actually take
+const float BENCH_TIME_STEP = 1.0f / 60.0f;
+
+struct CameraKey {
+	float time;
+	glm::vec3 position;
+	float yaw;
+	float pitch;
+};
+
+struct InputEvent {
+	int frame;
+	char key;			//W, A, S, D, Q or E, as in key_callback
+	float deltaTime;	//Frame time the key press was recorded with
+};
+
+struct CameraPath {
+	std::vector<CameraKey> keys;	//Sorted by time
+	std::vector<InputEvent> inputs;	//Sorted by frame
+	float duration() const { return keys.empty() ? 0.0f : keys.back().time; }
+	//Frames needed to play the whole path at BENCH_TIME_STEP
+	int frameCount() const
+	{
+		int frames = (int)std::ceil(duration() / BENCH_TIME_STEP) + 1;
+		if (!inputs.empty())
+			frames = std::max(frames, inputs.back().frame + 1);
+		return frames;
+	}
+};
+
+inline bool LoadCameraPath(const char* filename, CameraPath& path)
+{
+	std::ifstream file(filename);
+	if (!file.good()) {
+		std::cout << "ERROR::BENCHMARK::CAMERA_PATH_NOT_FOUND " << filename << std::endl;
+		return false;
+	}
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line)) {
+		lineNumber++;
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+		std::istringstream in(line);
+		std::string kind;
+		if (!(in >> kind))
+			continue;
+		if (kind == "key") {
+			CameraKey key;
+			if (in >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch) {
+				path.keys.push_back(key);
+				continue;
+			}
+		}
+		else if (kind == "input") {
+			InputEvent event;
+			if (in >> event.frame >> event.key >> event.deltaTime) {
+				event.key = (char)toupper(event.key);
+				path.inputs.push_back(event);
+				continue;
+			}
+		}
+		std::cout << "ERROR::BENCHMARK::BAD_CAMERA_PATH_LINE " << filename << ":" << lineNumber << std::endl;
+		return false;
+	}
+	std::stable_sort(path.keys.begin(), path.keys.end(), [](const CameraKey& a, const CameraKey& b) { return a.time < b.time; });
+	std::stable_sort(path.inputs.begin(), path.inputs.end(), [](const InputEvent& a, const InputEvent& b) { return a.frame < b.frame; });
+	if (path.keys.empty() && path.inputs.empty()) {
+		std::cout << "ERROR::BENCHMARK::EMPTY_CAMERA_PATH " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//Uniform Catmull-Rom interpolation between p1 and p2
+template <typename T>
+inline T CatmullRom(const T& p0, const T& p1, const T& p2, const T& p3, float t)
+{
+	float t2 = t * t;
+	float t3 = t2 * t;
+	return 0.5f * ((2.0f * p1) + (-p0 + p2) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (-p0 + 3.0f * p1 - 3.0f * p2 + p3) * t3);
+}
+
+//Camera pose at a given time, clamped to the first / last key
+inline CameraKey SampleCameraPath(const CameraPath& path, float time)
+{
+	const std::vector<CameraKey>& keys = path.keys;
+	if (keys.size() == 1 || time <= keys.front().time)
+		return keys.front();
+	if (time >= keys.back().time)
+		return keys.back();
+
+	size_t i = 1;
+	while (keys[i].time < time)
+		i++;
+	const CameraKey& k0 = keys[i > 1 ? i - 2 : 0];
+	const CameraKey& k1 = keys[i - 1];
+	const CameraKey& k2 = keys[i];
+	const CameraKey& k3 = keys[std::min(i + 1, keys.size() - 1)];
+	float t = (time - k1.time) / (k2.time - k1.time);
+
+	CameraKey pose;
+	pose.time = time;
+	pose.position = CatmullRom(k0.position, k1.position, k2.position, k3.position, t);
+	pose.yaw = CatmullRom(k0.yaw, k1.yaw, k2.yaw, k3.yaw, t);
+	pose.pitch = CatmullRom(k0.pitch, k1.pitch, k2.pitch, k3.pitch, t);
+	return pose;
+}
+
+//Everything measured for one frame of a benchmark run
+struct FrameSample {
+	float frameMs;		//Whole frame including the wait for the GPU
+	float cpuMs;		//URender submission only
+	unsigned drawCalls;
+	unsigned stateChanges;
+};
+
+//Linear interpolated percentile of sorted values, p in [0, 100]
+inline double Percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0.0;
+	double rank = p / 100.0 * (sorted.size() - 1);
+	size_t lo = (size_t)rank;
+	size_t hi = std::min(lo + 1, sorted.size() - 1);
+	return sorted[lo] + (sorted[hi] - sorted[lo]) * (rank - lo);
+}
+
+inline void WriteJsonStats(std::ostream& out, const char* name, std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	double total = 0.0;
+	for (double v : values)
+		total += v;
+	double mean = values.empty() ? 0.0 : total / values.size();
+	out << "  \"" << name << "\": {\"mean\": " << mean
+		<< ", \"p50\": " << Percentile(values, 50.0)
+		<< ", \"p95\": " << Percentile(values, 95.0)
+		<< ", \"p99\": " << Percentile(values, 99.0)
+		<< ", \"min\": " << (values.empty() ? 0.0 : values.front())
+		<< ", \"max\": " << (values.empty() ? 0.0 : values.back()) << "},\n";
+}
+
+//value as the inside of a JSON string: backslashes and quotes escaped, control characters as \u00XX
+inline std::string JsonEscape(const std::string& value)
+{
+	std::string escaped;
+	escaped.reserve(value.size());
+	for (char c : value) {
+		if (c == '\\' || c == '"') {
+			escaped += '\\';
+			escaped += c;
+		}
+		else if ((unsigned char)c < 0x20) {
+			char code[7];
+			snprintf(code, sizeof(code), "\\u%04x", (unsigned)(unsigned char)c);
+			escaped += code;
+		}
+		else
+			escaped += c;
+	}
+	return escaped;
+}
+
+inline void WriteJsonArray(std::ostream& out, const char* name, const std::vector<double>& values, bool last)
+{
+	out << "    \"" << name << "\": [";
+	for (size_t i = 0; i < values.size(); i++)
+		out << (i ? ", " : "") << values[i];
+	out << "]" << (last ? "\n" : ",\n");
+}
+
+//Writes the benchmark result file, summary statistics first and raw per-frame samples after
+inline bool WriteBenchmarkJson(const char* filename, const std::vector<FrameSample>& samples, const std::string& pathName,
+	const std::string& renderer, int width, int height)
+{
+	std::ofstream out(filename);
+	if (!out.good()) {
+		std::cout << "ERROR::BENCHMARK::CANNOT_WRITE " << filename << std::endl;
+		return false;
+	}
+	std::vector<double> frameMs, cpuMs, drawCalls, stateChanges;
+	for (const FrameSample& s : samples) {
+		frameMs.push_back(s.frameMs);
+		cpuMs.push_back(s.cpuMs);
+		drawCalls.push_back(s.drawCalls);
+		stateChanges.push_back(s.stateChanges);
+	}
+	out.precision(6);
+	out << "{\n";
+	out << "  \"camera_path\": \"" << JsonEscape(pathName) << "\",\n";
+	out << "  \"renderer\": \"" << JsonEscape(renderer) << "\",\n";
+	out << "  \"width\": " << width << ",\n";
+	out << "  \"height\": " << height << ",\n";
+	out << "  \"frames\": " << samples.size() << ",\n";
+	WriteJsonStats(out, "frame_ms", frameMs);
+	WriteJsonStats(out, "cpu_ms", cpuMs);
+	//Without the GL stats layer nothing counted the calls, leave them out rather than report zeros
+#ifndef THECAR_NO_GL_STATS
+	WriteJsonStats(out, "draw_calls", drawCalls);
+	WriteJsonStats(out, "state_changes", stateChanges);
+#endif
+	out << "  \"samples\": {\n";
+	WriteJsonArray(out, "frame_ms", frameMs, false);
+#ifndef THECAR_NO_GL_STATS
+	WriteJsonArray(out, "cpu_ms", cpuMs, false);
+	WriteJsonArray(out, "draw_calls", drawCalls, false);
+	WriteJsonArray(out, "state_changes", stateChanges, true);
+#else
+	WriteJsonArray(out, "cpu_ms", cpuMs, true);
+#endif
+	out << "  }\n}\n";
+	return true;
+}
+
+//Reads one raw sample array ("samples": {"<name>": [...]}) back from a result file.
+//An optional array the file does not have leaves values empty.
+inline bool ReadJsonSamples(const char* filename, const char* name, std::vector<double>& values, bool optional = false)
+{
+	std::ifstream file(filename);
+	if (!file.good()) {
+		std::cout << "ERROR::BENCHMARK::RESULT_NOT_FOUND " << filename << std::endl;
+		return false;
+	}
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	std::string text = buffer.str();
+
+	size_t pos = text.find("\"samples\"");
+	if (pos != std::string::npos)
+		pos = text.find(std::string("\"") + name + "\"", pos);
+	if (pos != std::string::npos)
+		pos = text.find('[', pos);
+	if (pos == std::string::npos && optional)
+		return true;
+	if (pos == std::string::npos) {
+		std::cout << "ERROR::BENCHMARK::NO_SAMPLES " << name << " in " << filename << std::endl;
+		return false;
+	}
+	const char* p = text.c_str() + pos + 1;
+	for (;;) {
+		while (*p == ' ' || *p == ',' || *p == '\n' || *p == '\r' || *p == '\t')
+			p++;
+		if (*p == ']' || *p == '\0')
+			break;
+		char* end;
+		double v = strtod(p, &end);
+		if (end == p)
+			return false;
+		values.push_back(v);
+		p = end;
+	}
+	return true;
+}
+
+//Two-sided 97.5% quantile of Student's t distribution, for 95% confidence intervals
+inline double StudentT975(double dof)
+{
+	static const double table[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+	if (dof < 1.0)
+		return table[0];
+	if (dof <= 30.0)
+		return table[(int)dof - 1];
+	//Cornish-Fisher expansion around the normal quantile, good to 3 decimals above 30 dof
+	const double z = 1.959964;
+	return z + (z * z * z + z) / (4.0 * dof) + (5.0 * pow(z, 5) + 16.0 * z * z * z + 3.0 * z) / (96.0 * dof * dof);
+}
+
+/*
+* Compares metric `name` of two result files.
+* Welch's t interval on the difference of means (B - A), 95% confidence.
+* Returns -1 if B is significantly faster, 1 if significantly slower, 0 otherwise.
+*/
+inline int CompareSamples(const std::vector<double>& a, const std::vector<double>& b, const char* name)
+{
+	auto meanVar = [](const std::vector<double>& v, double& mean, double& var) {
+		mean = 0.0;
+		for (double x : v)
+			mean += x;
+		mean /= v.size();
+		var = 0.0;
+		for (double x : v)
+			var += (x - mean) * (x - mean);
+		var /= (v.size() > 1 ? v.size() - 1 : 1);
+	};
+	double meanA, varA, meanB, varB;
+	meanVar(a, meanA, varA);
+	meanVar(b, meanB, varB);
+	double seA = varA / a.size();
+	double seB = varB / b.size();
+	double se = sqrt(seA + seB);
+	double dof = (seA + seB) * (seA + seB) /
+		((seA * seA) / std::max<double>(a.size() - 1.0, 1.0) + (seB * seB) / std::max<double>(b.size() - 1.0, 1.0) + 1e-300);
+	double diff = meanB - meanA;
+	double half = StudentT975(dof) * se;
+
+	std::vector<double> sortedA(a), sortedB(b);
+	std::sort(sortedA.begin(), sortedA.end());
+	std::sort(sortedB.begin(), sortedB.end());
+
+	int verdict = 0;
+	if (diff + half < 0.0)
+		verdict = -1;
+	else if (diff - half > 0.0)
+		verdict = 1;
+
+	printf("%-14s A mean %9.4f  B mean %9.4f | diff %+9.4f (%+6.2f%%)  95%% CI [%+9.4f, %+9.4f] | p50 %8.4f -> %8.4f  p99 %8.4f -> %8.4f | %s\n",
+		name, meanA, meanB, diff, meanA != 0.0 ? 100.0 * diff / meanA : 0.0, diff - half, diff + half,
+		Percentile(sortedA, 50.0), Percentile(sortedB, 50.0), Percentile(sortedA, 99.0), Percentile(sortedB, 99.0),
+		verdict < 0 ? "B lower" : (verdict > 0 ? "B higher" : "no significant change"));
+	return verdict;
+}
+
+//--compare A.json B.json: prints every metric, false when a file could not be read
+inline bool CompareBenchmarkFiles(const char* fileA, const char* fileB)
+{
+	//The call counts are missing from runs built with THECAR_NO_GL_STATS
+	const char* metrics[] = { "frame_ms", "cpu_ms", "draw_calls", "state_changes" };
+	const bool optional[] = { false, false, true, true };
+	std::cout << "A: " << fileA << "\nB: " << fileB << std::endl;
+	for (int m = 0; m < 4; m++) {
+		const char* metric = metrics[m];
+		std::vector<double> a, b;
+		if (!ReadJsonSamples(fileA, metric, a, optional[m]) || !ReadJsonSamples(fileB, metric, b, optional[m]))
+			return false;
+		if (a.empty() || b.empty()) {
+			std::cout << metric << ": no samples" << (optional[m] ? " (not recorded without GL stats)" : "") << std::endl;
+			continue;
+		}
+		CompareSamples(a, b, metric);
+	}
+	return true;
+}
+
+#endif
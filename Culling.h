@@ -0,0 +1,335 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+/*
+* Frustum culling of bounding spheres.
+* World-space spheres are kept as structure-of-arrays (CullingSpheres: x, y, z and radius each in its own array,
+* padded to a multiple of 8) so a SIMD register holds one coordinate of several objects at once. The kernel
+* tests 8 spheres per iteration against the 6 planes of ExtractFrustumPlanes: a sphere is outside when its
+* center lies farther than its radius behind any plane. With AVX one iteration is a single 8 wide register per
+* coordinate, with SSE it is two 4 wide ones, and the scalar loop is the reference the others must match.
+* The AVX kernel does not need an AVX build: on x86 it is compiled for AVX on its own (a target attribute with
+* GCC and Clang, MSVC takes the intrinsics anywhere) and CullSpheres picks it at the first call when the CPU and
+* OS support AVX, the SSE kernel otherwise. Built with AVX (-mavx, /arch:AVX) it is used unconditionally.
+* The result is one bit per sphere, a byte per group of 8. Spheres are conservative, nothing visible is culled.
+* CullSpheresThreaded splits large counts into chunks of at least CULL_MIN_SPHERES_PER_THREAD across the threads
+* of a CullWorkers pool; below that handing a chunk over costs more than testing it. The pool's threads are
+* started the first time a cull needs them and then wait for the next one, so a frame only pays a wake-up each.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define THECAR_CULL_SSE
+#include <emmintrin.h>
+#endif
+//THECAR_CULL_AVX: the AVX kernel is compiled. THECAR_CULL_AVX_DISPATCH: it only runs on CPUs with AVX.
+#if defined(__AVX__)
+#define THECAR_CULL_AVX
+#define THECAR_CULL_AVX_FUNCTION
+#include <immintrin.h>
+#elif defined(THECAR_CULL_SSE) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define THECAR_CULL_AVX
+#define THECAR_CULL_AVX_DISPATCH
+#define THECAR_CULL_AVX_FUNCTION __attribute__((target("avx")))
+#include <immintrin.h>
+#elif defined(THECAR_CULL_SSE) && defined(_MSC_VER)
+#define THECAR_CULL_AVX
+#define THECAR_CULL_AVX_DISPATCH
+#define THECAR_CULL_AVX_FUNCTION
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+const size_t CULL_MIN_SPHERES_PER_THREAD = 65536;
+
+//Planes with normalized (a, b, c), a point p is inside when dot(abc, p) + d >= 0 for all of them
+struct FrustumPlanes {
+	glm::vec4 planes[6];	//Left, right, bottom, top, near, far
+};
+
+//Planes of the clip volume of viewProjection, in the space its input is in (Gribb / Hartmann)
+inline FrustumPlanes ExtractFrustumPlanes(const glm::mat4& viewProjection)
+{
+	const glm::mat4& m = viewProjection;
+	const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+	FrustumPlanes frustum;
+	frustum.planes[0] = row3 + row0;
+	frustum.planes[1] = row3 - row0;
+	frustum.planes[2] = row3 + row1;
+	frustum.planes[3] = row3 - row1;
+	frustum.planes[4] = row3 + row2;
+	frustum.planes[5] = row3 - row2;
+	for (glm::vec4& plane : frustum.planes)
+		plane /= glm::length(glm::vec3(plane));
+	return frustum;
+}
+
+//Sphere centers and radii as structure-of-arrays, padded with empty spheres to a multiple of 8
+struct CullingSpheres {
+	std::vector<float> x, y, z, radius;
+	size_t count = 0;
+
+	void resize(size_t spheres)
+	{
+		count = spheres;
+		const size_t padded = (spheres + 7) & ~(size_t)7;
+		x.assign(padded, 0.0f);
+		y.assign(padded, 0.0f);
+		z.assign(padded, 0.0f);
+		radius.assign(padded, 0.0f);
+	}
+
+	void set(size_t i, const glm::vec3& center, float r)
+	{
+		x[i] = center.x;
+		y[i] = center.y;
+		z[i] = center.z;
+		radius[i] = r;
+	}
+
+	size_t groups() const
+	{
+		return x.size() / 8;
+	}
+};
+
+//Bounding sphere transformed by model, the radius scaled by the model's longest axis
+inline void TransformSphere(const glm::mat4& model, const glm::vec3& center, float radius, glm::vec3& worldCenter, float& worldRadius)
+{
+	worldCenter = glm::vec3(model * glm::vec4(center, 1.0f));
+	const float scale = std::max(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+		std::max(glm::dot(glm::vec3(model[1]), glm::vec3(model[1])), glm::dot(glm::vec3(model[2]), glm::vec3(model[2]))));
+	worldRadius = radius * std::sqrt(scale);
+}
+
+//Reference kernel, summing in the order the SIMD kernels do: bit i % 8 of visible[i / 8] is set when sphere i
+//intersects the frustum, for the groups of 8 from firstGroup to endGroup
+inline void CullSpheresScalar(const FrustumPlanes& frustum, const CullingSpheres& spheres, size_t firstGroup, size_t endGroup, uint8_t* visible)
+{
+	for (size_t group = firstGroup; group < endGroup; group++) {
+		uint8_t bits = 0;
+		for (int lane = 0; lane < 8; lane++) {
+			const size_t i = group * 8 + lane;
+			bool inside = true;
+			for (const glm::vec4& plane : frustum.planes)
+				inside = inside && (plane.x * spheres.x[i] + plane.y * spheres.y[i]) + (plane.z * spheres.z[i] + plane.w) > -spheres.radius[i];
+			bits |= (uint8_t)(inside ? 1u << lane : 0u);
+		}
+		visible[group] = bits;
+	}
+}
+
+#ifdef THECAR_CULL_SSE
+//Two 4 wide halves per group of 8
+inline void CullSpheresSse(const FrustumPlanes& frustum, const CullingSpheres& spheres, size_t firstGroup, size_t endGroup, uint8_t* visible)
+{
+	__m128 planes[6][4];
+	for (int p = 0; p < 6; p++)
+		for (int c = 0; c < 4; c++)
+			planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+	for (size_t group = firstGroup; group < endGroup; group++) {
+		int bits = 0;
+		for (int half = 0; half < 2; half++) {
+			const size_t i = group * 8 + half * 4;
+			const __m128 x = _mm_loadu_ps(&spheres.x[i]);
+			const __m128 y = _mm_loadu_ps(&spheres.y[i]);
+			const __m128 z = _mm_loadu_ps(&spheres.z[i]);
+			const __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.radius[i]));
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++) {
+				const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y)),
+					_mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]));
+				inside = _mm_and_ps(inside, _mm_cmpgt_ps(distance, negRadius));
+			}
+			bits |= _mm_movemask_ps(inside) << (half * 4);
+		}
+		visible[group] = (uint8_t)bits;
+	}
+}
+#endif
+
+#ifdef THECAR_CULL_AVX
+//One 8 wide register per coordinate and group. Without an AVX build, only call it when CullCpuHasAvx().
+THECAR_CULL_AVX_FUNCTION inline void CullSpheresAvx(const FrustumPlanes& frustum, const CullingSpheres& spheres, size_t firstGroup, size_t endGroup, uint8_t* visible)
+{
+	__m256 planes[6][4];
+	for (int p = 0; p < 6; p++)
+		for (int c = 0; c < 4; c++)
+			planes[p][c] = _mm256_set1_ps(frustum.planes[p][c]);
+	for (size_t group = firstGroup; group < endGroup; group++) {
+		const size_t i = group * 8;
+		const __m256 x = _mm256_loadu_ps(&spheres.x[i]);
+		const __m256 y = _mm256_loadu_ps(&spheres.y[i]);
+		const __m256 z = _mm256_loadu_ps(&spheres.z[i]);
+		const __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&spheres.radius[i]));
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; p++) {
+			const __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planes[p][0], x), _mm256_mul_ps(planes[p][1], y)),
+				_mm256_add_ps(_mm256_mul_ps(planes[p][2], z), planes[p][3]));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GT_OQ));
+		}
+		visible[group] = (uint8_t)_mm256_movemask_ps(inside);
+	}
+}
+#endif
+
+#ifdef THECAR_CULL_AVX_DISPATCH
+//The CPU runs AVX instructions and the OS saves the AVX registers
+inline bool CullCpuHasAvx()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx") != 0;
+#endif
+}
+#endif
+
+//Whether CullSpheres runs the AVX kernel, decided once
+inline bool CullUsesAvx()
+{
+#if defined(THECAR_CULL_AVX_DISPATCH)
+	static const bool avx = CullCpuHasAvx();
+	return avx;
+#elif defined(THECAR_CULL_AVX)
+	return true;
+#else
+	return false;
+#endif
+}
+
+//Name of the kernel CullSpheres runs
+inline const char* CullKernelName()
+{
+#if defined(THECAR_CULL_SSE)
+	return CullUsesAvx() ? "AVX" : "SSE";
+#else
+	return CullUsesAvx() ? "AVX" : "scalar";
+#endif
+}
+
+//The widest kernel the build and the CPU allow
+inline void CullSpheres(const FrustumPlanes& frustum, const CullingSpheres& spheres, size_t firstGroup, size_t endGroup, uint8_t* visible)
+{
+#if defined(THECAR_CULL_AVX)
+	if (CullUsesAvx()) {
+		CullSpheresAvx(frustum, spheres, firstGroup, endGroup, visible);
+		return;
+	}
+#endif
+#if defined(THECAR_CULL_SSE)
+	CullSpheresSse(frustum, spheres, firstGroup, endGroup, visible);
+#else
+	CullSpheresScalar(frustum, spheres, firstGroup, endGroup, visible);
+#endif
+}
+
+//Threads kept across culls, each culling one chunk of every cull that has enough spheres for it
+class CullWorkers
+{
+public:
+	CullWorkers() = default;
+	CullWorkers(const CullWorkers&) = delete;
+	CullWorkers& operator=(const CullWorkers&) = delete;
+
+	~CullWorkers()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		start.notify_all();
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+
+	//Culls chunks chunks of chunkGroups groups, the first on the calling thread, the others on the workers
+	void run(const FrustumPlanes& frustum, const CullingSpheres& spheres, uint8_t* visible, size_t chunks, size_t chunkGroups)
+	{
+		while (threads.size() < chunks - 1)
+			threads.emplace_back(&CullWorkers::work, this, threads.size() + 1, generation);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = { &frustum, &spheres, visible, chunks, chunkGroups };
+			pending = chunks - 1;
+			generation++;
+		}
+		start.notify_all();
+		CullSpheres(frustum, spheres, 0, std::min(spheres.groups(), chunkGroups), visible);
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this]() { return pending == 0; });
+	}
+
+private:
+	struct Job {
+		const FrustumPlanes* frustum = nullptr;
+		const CullingSpheres* spheres = nullptr;
+		uint8_t* visible = nullptr;
+		size_t chunks = 0;
+		size_t chunkGroups = 0;
+	};
+
+	std::vector<std::thread> threads;	//Thread i - 1 culls chunk i
+	std::mutex mutex;
+	std::condition_variable start;	//A cull was posted, or the pool stops
+	std::condition_variable done;	//The last worker of a cull finished
+	Job job;	//The cull in progress
+	size_t pending = 0;	//Workers of the cull in progress still culling
+	uint64_t generation = 0;	//Culls posted so far
+	bool stopping = false;
+
+	void work(size_t chunk, uint64_t seen)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;) {
+			start.wait(lock, [&]() { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+			if (chunk >= job.chunks)
+				continue;	//Fewer chunks than workers this time
+			const Job current = job;
+			lock.unlock();
+			const size_t groups = current.spheres->groups();
+			const size_t first = chunk * current.chunkGroups;
+			CullSpheres(*current.frustum, *current.spheres, std::min(groups, first), std::min(groups, first + current.chunkGroups), current.visible);
+			lock.lock();
+			if (--pending == 0)
+				done.notify_one();
+		}
+	}
+};
+
+//Culls every sphere, on up to threads threads of workers when there are enough spheres to give each a full chunk.
+//visible holds spheres.groups() bytes.
+inline void CullSpheresThreaded(const FrustumPlanes& frustum, const CullingSpheres& spheres, uint8_t* visible, unsigned threads, CullWorkers& workers)
+{
+	const size_t groups = spheres.groups();
+	const size_t minGroups = CULL_MIN_SPHERES_PER_THREAD / 8;
+	const size_t chunks = std::max<size_t>(1, std::min<size_t>(threads, groups / minGroups));
+	if (chunks == 1) {
+		CullSpheres(frustum, spheres, 0, groups, visible);
+		return;
+	}
+	workers.run(frustum, spheres, visible, chunks, (groups + chunks - 1) / chunks);
+}
+
+#endif
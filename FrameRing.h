@@ -0,0 +1,165 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+/*
+* Persistently mapped ring buffer for the data a frame streams to the GPU: the camera block, the instance
+* transforms, the draw records and the indirect commands.
+* One buffer made with glBufferStorage(GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT) stays mapped for its whole
+* life and is split into FRAME_RING_FRAMES regions. Frame N writes region N % 3 straight through the mapping and
+* binds ranges of it, then fences; before region N % 3 is written again the fence of frame N - 3 is waited on,
+* which has long signaled unless the GPU is more than two frames behind. Nothing is copied by the driver and no
+* glBufferData / glBufferSubData call can stall on a buffer the GPU still reads.
+* Every allocation starts on the largest uniform / storage buffer offset alignment, so any of them can be
+* bound with glBindBufferRange. When a frame needs more than a region holds, beginFrame waits for the GPU
+* to finish every region and recreates the buffer with larger ones. A ring whose buffer could not be mapped
+* stays unusable: every later BeginFrameRing fails, and FrameRingAlloc returns null on a full region.
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+const int FRAME_RING_FRAMES = 3;
+const size_t FRAME_RING_MIN_REGION = 64 * 1024;
+
+struct FrameRing {
+	GLuint buffer = 0;
+	unsigned char* mapped = nullptr;	//Start of the buffer, writable for its whole life
+	size_t regionSize = 0;	//Bytes of each frame's region
+	size_t alignment = 256;	//Offset alignment of every allocation
+	int region = 0;	//Region of the frame being written
+	size_t used = 0;	//Bytes allocated in it so far
+	GLsync fences[FRAME_RING_FRAMES] = {};
+	unsigned frames = 0;	//Frames begun
+	unsigned stalls = 0;	//Frames whose region the GPU was still reading
+	unsigned grows = 0;	//Times the regions were enlarged
+};
+
+inline size_t FrameRingAlign(size_t bytes, size_t alignment)
+{
+	return (bytes + alignment - 1) / alignment * alignment;
+}
+
+//Blocks until fence has signaled, true when it had not already
+inline bool FrameRingWait(GLsync fence)
+{
+	GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if (status == GL_ALREADY_SIGNALED)
+		return false;
+	while (status == GL_TIMEOUT_EXPIRED)
+		status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+	if (status == GL_WAIT_FAILED)
+		std::cout << "ERROR::FRAME_RING::WAIT_FAILED" << std::endl;
+	return true;
+}
+
+inline void FrameRingRelease(FrameRing& ring)
+{
+	for (GLsync& fence : ring.fences) {
+		if (fence) {
+			FrameRingWait(fence);
+			glDeleteSync(fence);
+			fence = 0;
+		}
+	}
+	if (ring.buffer) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &ring.buffer);
+	}
+	ring.buffer = 0;
+	ring.mapped = nullptr;
+}
+
+//Allocates and maps FRAME_RING_FRAMES regions of at least regionSize bytes
+inline bool CreateFrameRing(FrameRing& ring, size_t regionSize)
+{
+	GLint uniformAlignment = 0, storageAlignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+	ring.alignment = (size_t)std::max(16, std::max(uniformAlignment, storageAlignment));
+	ring.regionSize = FrameRingAlign(std::max(regionSize, FRAME_RING_MIN_REGION), ring.alignment);
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	const GLsizeiptr size = (GLsizeiptr)(ring.regionSize * FRAME_RING_FRAMES);
+	glGenBuffers(1, &ring.buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+	ring.mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	if (!ring.mapped) {
+		std::cout << "ERROR::FRAME_RING::MAP_FAILED " << size << " bytes" << std::endl;
+		glDeleteBuffers(1, &ring.buffer);
+		ring.buffer = 0;
+		ring.regionSize = 0;
+		return false;
+	}
+	ring.region = 0;
+	ring.used = 0;
+	return true;
+}
+
+inline void DestroyFrameRing(FrameRing& ring)
+{
+	FrameRingRelease(ring);
+	ring = FrameRing();
+}
+
+//Starts the next frame's region, able to hold bytes (alignment padding included) of allocations.
+//Waits for the GPU only if it still reads that region, or to grow the ring. False when the ring has no mapping,
+//it was never created or growing it failed.
+inline bool BeginFrameRing(FrameRing& ring, size_t bytes)
+{
+	if (!ring.mapped)
+		return false;
+	ring.frames++;
+	if (bytes > ring.regionSize) {
+		size_t regionSize = ring.regionSize;
+		while (regionSize < bytes)
+			regionSize *= 2;
+		FrameRingRelease(ring);
+		ring.grows++;
+		if (!CreateFrameRing(ring, regionSize))
+			return false;
+	}
+	GLsync& fence = ring.fences[ring.region];
+	if (fence) {
+		if (FrameRingWait(fence))
+			ring.stalls++;
+		glDeleteSync(fence);
+		fence = 0;
+	}
+	ring.used = 0;
+	return true;
+}
+
+//Bytes an allocation of size takes from the region
+inline size_t FrameRingSize(const FrameRing& ring, size_t size)
+{
+	return FrameRingAlign(std::max<size_t>(size, 1), ring.alignment);
+}
+
+//Reserves size bytes of the current region, returns where to write them and their offset in ring.buffer.
+//The caller sized the frame in BeginFrameRing, so this only returns null on a miscount; check it all the same.
+inline void* FrameRingAlloc(FrameRing& ring, size_t size, GLintptr& offset)
+{
+	const size_t bytes = FrameRingSize(ring, size);
+	if (ring.used + bytes > ring.regionSize) {
+		std::cout << "ERROR::FRAME_RING::OVERFLOW " << ring.used + bytes << " of " << ring.regionSize << " bytes" << std::endl;
+		return nullptr;
+	}
+	offset = (GLintptr)(ring.region * ring.regionSize + ring.used);
+	ring.used += bytes;
+	return ring.mapped + offset;
+}
+
+//Fences the commands that read the current region and moves to the next one
+inline void EndFrameRing(FrameRing& ring)
+{
+	ring.fences[ring.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	ring.region = (ring.region + 1) % FRAME_RING_FRAMES;
+}
+
+#endif
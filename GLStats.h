@@ -0,0 +1,367 @@
+#ifndef GLSTATS_H
+#define GLSTATS_H
+
+/*
+* GL call interception layer.
+* Include right after the GL headers: the wrappers below are compiled against the real entry points,
+* then the macros at the bottom route every later glDraw* / bind / uniform call through them.
+*
+* Counting is always on (a few increments per call). Redundancy tracking keeps a shadow copy of the
+* bound program, VAO, textures, texture parameters, samplers and uniform values, and flags calls that set the
+* value already in place; it costs a hash lookup per call, so it is only enabled by --gl-stats.
+* Building with THECAR_NO_GL_STATS removes the layer entirely.
+*/
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+//Intercepted call categories
+enum GLCallKind {
+	GL_CALL_DRAW,
+	GL_CALL_USE_PROGRAM,
+	GL_CALL_BIND_VERTEX_ARRAY,
+	GL_CALL_ACTIVE_TEXTURE,
+	GL_CALL_BIND_TEXTURE,
+	GL_CALL_TEX_PARAMETER,
+	GL_CALL_BIND_SAMPLER,
+	GL_CALL_UNIFORM,
+	GL_CALL_KIND_COUNT
+};
+
+inline const char* GLCallKindName(int kind)
+{
+	static const char* names[GL_CALL_KIND_COUNT] = {
+		"draw", "use_program", "bind_vertex_array", "active_texture", "bind_texture", "tex_parameter", "bind_sampler", "uniform"
+	};
+	return names[kind];
+}
+
+struct FrameStats {
+	unsigned drawCalls = 0;		//glDraw* calls
+	unsigned stateChanges = 0;	//program, VAO, texture unit, texture, texture parameter, sampler and uniform calls
+	unsigned redundantStateChanges = 0;	//state changes that set the value already in place (--gl-stats only)
+	unsigned calls[GL_CALL_KIND_COUNT] = {};
+	unsigned redundant[GL_CALL_KIND_COUNT] = {};
+	unsigned uniformCacheHits = 0;		//Shader::set calls skipped because the value was already set
+	unsigned uniformCacheMisses = 0;	//Shader::set calls that reached glUniform
+};
+
+//Counters of the frame being rendered, reset by the render loop
+inline FrameStats gFrameStats;
+
+#ifndef THECAR_NO_GL_STATS
+
+//CPU-side mirror of the GL state the wrappers see, used to spot redundant calls
+struct GLShadowState {
+	static const int MAX_TEXTURE_UNITS = 32;
+	bool tracking = false;	//Redundancy tracking enabled
+	GLuint program = 0;
+	GLuint vertexArray = 0;
+	GLenum activeUnit = 0;	//Index, not GL_TEXTURE0 based
+	GLuint textures[MAX_TEXTURE_UNITS] = {};	//GL_TEXTURE_2D binding of each unit
+	GLuint samplers[MAX_TEXTURE_UNITS] = {};	//Sampler object bound to each unit
+	std::unordered_map<unsigned long long, GLint> texParameters;	//(texture, pname) -> value
+	//(program, location) -> last value, up to a mat4
+	struct UniformValue {
+		GLfloat data[16];
+		unsigned size;
+	};
+	std::unordered_map<unsigned long long, UniformValue> uniforms;
+};
+inline GLShadowState gGLShadow;
+
+//Frame stats history kept for the CSV dump
+inline std::vector<FrameStats> gFrameStatsHistory;
+
+inline void EnableGLStatsTracking()
+{
+	gGLShadow = GLShadowState();
+	gGLShadow.tracking = true;
+}
+
+//Redundant calls are only flagged, never dropped, so tracking cannot change the rendered image
+inline void CountStateChange(GLCallKind kind, bool redundant)
+{
+	gFrameStats.stateChanges++;
+	gFrameStats.calls[kind]++;
+	if (redundant) {
+		gFrameStats.redundantStateChanges++;
+		gFrameStats.redundant[kind]++;
+	}
+}
+
+inline bool UniformRedundant(GLint location, const GLfloat* data, unsigned size)
+{
+	if (!gGLShadow.tracking)
+		return false;
+	if (location < 0)
+		return true; //Inactive uniform: the call has no effect at all
+	unsigned long long key = ((unsigned long long)gGLShadow.program << 32) | (unsigned)location;
+	GLShadowState::UniformValue& value = gGLShadow.uniforms[key];
+	bool same = value.size == size && memcmp(value.data, data, size * sizeof(GLfloat)) == 0;
+	value.size = size;
+	memcpy(value.data, data, size * sizeof(GLfloat));
+	return same;
+}
+
+inline bool UniformRedundant(GLint location, GLint v0)
+{
+	GLfloat bits;
+	memcpy(&bits, &v0, sizeof(bits));
+	return UniformRedundant(location, &bits, 1);
+}
+
+#pragma region GLStatsWrappers
+inline void StatsDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	gFrameStats.drawCalls++;
+	gFrameStats.calls[GL_CALL_DRAW]++;
+	glDrawArrays(mode, first, count);
+}
+inline void StatsDrawArraysInstancedBaseInstance(GLenum mode, GLint first, GLsizei count, GLsizei instanceCount, GLuint baseInstance)
+{
+	gFrameStats.drawCalls++;
+	gFrameStats.calls[GL_CALL_DRAW]++;
+	glDrawArraysInstancedBaseInstance(mode, first, count, instanceCount, baseInstance);
+}
+//One call however many commands it carries, the point of indirect drawing is that the CPU cost does not grow with them
+inline void StatsMultiDrawArraysIndirect(GLenum mode, const void* indirect, GLsizei drawCount, GLsizei stride)
+{
+	gFrameStats.drawCalls++;
+	gFrameStats.calls[GL_CALL_DRAW]++;
+	glMultiDrawArraysIndirect(mode, indirect, drawCount, stride);
+}
+inline void StatsUseProgram(GLuint program)
+{
+	bool redundant = gGLShadow.tracking && gGLShadow.program == program;
+	gGLShadow.program = program;
+	CountStateChange(GL_CALL_USE_PROGRAM, redundant);
+	glUseProgram(program);
+}
+inline void StatsBindVertexArray(GLuint vao)
+{
+	bool redundant = gGLShadow.tracking && gGLShadow.vertexArray == vao;
+	gGLShadow.vertexArray = vao;
+	CountStateChange(GL_CALL_BIND_VERTEX_ARRAY, redundant);
+	glBindVertexArray(vao);
+}
+inline void StatsActiveTexture(GLenum unit)
+{
+	GLenum index = unit - GL_TEXTURE0;
+	bool redundant = gGLShadow.tracking && gGLShadow.activeUnit == index;
+	gGLShadow.activeUnit = index;
+	CountStateChange(GL_CALL_ACTIVE_TEXTURE, redundant);
+	glActiveTexture(unit);
+}
+inline void StatsBindTexture(GLenum target, GLuint texture)
+{
+	bool redundant = false;
+	if (target == GL_TEXTURE_2D && gGLShadow.activeUnit < (GLenum)GLShadowState::MAX_TEXTURE_UNITS) {
+		redundant = gGLShadow.tracking && gGLShadow.textures[gGLShadow.activeUnit] == texture;
+		gGLShadow.textures[gGLShadow.activeUnit] = texture;
+	}
+	CountStateChange(GL_CALL_BIND_TEXTURE, redundant);
+	glBindTexture(target, texture);
+}
+inline void StatsTexParameteri(GLenum target, GLenum pname, GLint param)
+{
+	bool redundant = false;
+	if (gGLShadow.tracking && target == GL_TEXTURE_2D && gGLShadow.activeUnit < (GLenum)GLShadowState::MAX_TEXTURE_UNITS) {
+		//Parameters belong to the texture object bound on the active unit, not to the unit
+		GLuint texture = gGLShadow.textures[gGLShadow.activeUnit];
+		unsigned long long key = ((unsigned long long)texture << 32) | pname;
+		auto it = gGLShadow.texParameters.find(key);
+		redundant = it != gGLShadow.texParameters.end() && it->second == param;
+		gGLShadow.texParameters[key] = param;
+	}
+	CountStateChange(GL_CALL_TEX_PARAMETER, redundant);
+	glTexParameteri(target, pname, param);
+}
+inline void StatsBindSampler(GLuint unit, GLuint sampler)
+{
+	bool redundant = false;
+	if (unit < (GLuint)GLShadowState::MAX_TEXTURE_UNITS) {
+		redundant = gGLShadow.tracking && gGLShadow.samplers[unit] == sampler;
+		gGLShadow.samplers[unit] = sampler;
+	}
+	CountStateChange(GL_CALL_BIND_SAMPLER, redundant);
+	glBindSampler(unit, sampler);
+}
+inline void StatsUniform1i(GLint location, GLint v0)
+{
+	CountStateChange(GL_CALL_UNIFORM, UniformRedundant(location, v0));
+	glUniform1i(location, v0);
+}
+inline void StatsUniform1f(GLint location, GLfloat v0)
+{
+	CountStateChange(GL_CALL_UNIFORM, UniformRedundant(location, &v0, 1));
+	glUniform1f(location, v0);
+}
+inline void StatsUniform2f(GLint location, GLfloat v0, GLfloat v1)
+{
+	const GLfloat v[] = { v0, v1 };
+	CountStateChange(GL_CALL_UNIFORM, UniformRedundant(location, v, 2));
+	glUniform2f(location, v0, v1);
+}
+inline void StatsUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2)
+{
+	const GLfloat v[] = { v0, v1, v2 };
+	CountStateChange(GL_CALL_UNIFORM, UniformRedundant(location, v, 3));
+	glUniform3f(location, v0, v1, v2);
+}
+inline void StatsUniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)
+{
+	const GLfloat v[] = { v0, v1, v2, v3 };
+	CountStateChange(GL_CALL_UNIFORM, UniformRedundant(location, v, 4));
+	glUniform4f(location, v0, v1, v2, v3);
+}
+inline void StatsUniform2fv(GLint location, GLsizei count, const GLfloat* value)
+{
+	CountStateChange(GL_CALL_UNIFORM, count == 1 && UniformRedundant(location, value, 2));
+	glUniform2fv(location, count, value);
+}
+inline void StatsUniform3fv(GLint location, GLsizei count, const GLfloat* value)
+{
+	CountStateChange(GL_CALL_UNIFORM, count == 1 && UniformRedundant(location, value, 3));
+	glUniform3fv(location, count, value);
+}
+inline void StatsUniform4fv(GLint location, GLsizei count, const GLfloat* value)
+{
+	CountStateChange(GL_CALL_UNIFORM, count == 1 && UniformRedundant(location, value, 4));
+	glUniform4fv(location, count, value);
+}
+inline void StatsUniformMatrix2fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+	CountStateChange(GL_CALL_UNIFORM, count == 1 && !transpose && UniformRedundant(location, value, 4));
+	glUniformMatrix2fv(location, count, transpose, value);
+}
+inline void StatsUniformMatrix3fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+	CountStateChange(GL_CALL_UNIFORM, count == 1 && !transpose && UniformRedundant(location, value, 9));
+	glUniformMatrix3fv(location, count, transpose, value);
+}
+inline void StatsUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+	CountStateChange(GL_CALL_UNIFORM, count == 1 && !transpose && UniformRedundant(location, value, 16));
+	glUniformMatrix4fv(location, count, transpose, value);
+}
+#pragma endregion
+
+//Ends a frame: keeps its counters for the CSV dump when tracking
+inline void RecordFrameStats()
+{
+	if (gGLShadow.tracking)
+		gFrameStatsHistory.push_back(gFrameStats);
+}
+
+//One row per frame: totals, then calls and redundant calls of every category
+inline bool WriteFrameStatsCsv(const char* filename)
+{
+	std::ofstream out(filename);
+	if (!out.good()) {
+		std::cout << "ERROR::GLSTATS::CANNOT_WRITE " << filename << std::endl;
+		return false;
+	}
+	out << "frame,draw_calls,state_changes,redundant_state_changes";
+	for (int kind = 0; kind < GL_CALL_KIND_COUNT; kind++)
+		out << "," << GLCallKindName(kind) << "," << GLCallKindName(kind) << "_redundant";
+	out << ",uniform_cache_hits,uniform_cache_misses\n";
+	for (size_t frame = 0; frame < gFrameStatsHistory.size(); frame++) {
+		const FrameStats& stats = gFrameStatsHistory[frame];
+		out << frame << "," << stats.drawCalls << "," << stats.stateChanges << "," << stats.redundantStateChanges;
+		for (int kind = 0; kind < GL_CALL_KIND_COUNT; kind++)
+			out << "," << stats.calls[kind] << "," << stats.redundant[kind];
+		out << "," << stats.uniformCacheHits << "," << stats.uniformCacheMisses << "\n";
+	}
+	return true;
+}
+
+//Average calls per frame of every category and the share that was redundant
+inline void PrintFrameStatsSummary()
+{
+	if (gFrameStatsHistory.empty())
+		return;
+	double frames = (double)gFrameStatsHistory.size();
+	std::cout << "INFO: GL calls per frame (redundant):" << std::endl;
+	for (int kind = 0; kind < GL_CALL_KIND_COUNT; kind++) {
+		double calls = 0.0, redundant = 0.0;
+		for (const FrameStats& stats : gFrameStatsHistory) {
+			calls += stats.calls[kind];
+			redundant += stats.redundant[kind];
+		}
+		std::cout << "  " << GLCallKindName(kind) << ": " << calls / frames << " (" << redundant / frames;
+		if (calls > 0.0)
+			std::cout << ", " << 100.0 * redundant / calls << "%";
+		std::cout << ")" << std::endl;
+	}
+	double hits = 0.0, misses = 0.0;
+	for (const FrameStats& stats : gFrameStatsHistory) {
+		hits += stats.uniformCacheHits;
+		misses += stats.uniformCacheMisses;
+	}
+	std::cout << "  uniform cache: " << hits / frames << " hits, " << misses / frames << " misses";
+	if (hits + misses > 0.0)
+		std::cout << " (" << 100.0 * hits / (hits + misses) << "% skipped)";
+	std::cout << std::endl;
+}
+
+//GLEW defines most of these as macros over its function pointers, drop them before rerouting
+#undef glDrawArrays
+#undef glDrawArraysInstancedBaseInstance
+#undef glMultiDrawArraysIndirect
+#undef glUseProgram
+#undef glBindVertexArray
+#undef glActiveTexture
+#undef glBindTexture
+#undef glTexParameteri
+#undef glBindSampler
+#undef glUniform1i
+#undef glUniform1f
+#undef glUniform2f
+#undef glUniform3f
+#undef glUniform4f
+#undef glUniform2fv
+#undef glUniform3fv
+#undef glUniform4fv
+#undef glUniformMatrix2fv
+#undef glUniformMatrix3fv
+#undef glUniformMatrix4fv
+
+#define glDrawArrays StatsDrawArrays
+#define glDrawArraysInstancedBaseInstance StatsDrawArraysInstancedBaseInstance
+#define glMultiDrawArraysIndirect StatsMultiDrawArraysIndirect
+#define glUseProgram StatsUseProgram
+#define glBindVertexArray StatsBindVertexArray
+#define glActiveTexture StatsActiveTexture
+#define glBindTexture StatsBindTexture
+#define glTexParameteri StatsTexParameteri
+#define glBindSampler StatsBindSampler
+#define glUniform1i StatsUniform1i
+#define glUniform1f StatsUniform1f
+#define glUniform2f StatsUniform2f
+#define glUniform3f StatsUniform3f
+#define glUniform4f StatsUniform4f
+#define glUniform2fv StatsUniform2fv
+#define glUniform3fv StatsUniform3fv
+#define glUniform4fv StatsUniform4fv
+#define glUniformMatrix2fv StatsUniformMatrix2fv
+#define glUniformMatrix3fv StatsUniformMatrix3fv
+#define glUniformMatrix4fv StatsUniformMatrix4fv
+
+#else // THECAR_NO_GL_STATS
+
+inline void EnableGLStatsTracking() {}
+inline void RecordFrameStats() {}
+inline bool WriteFrameStatsCsv(const char* filename)
+{
+	std::cout << "GL stats were compiled out (THECAR_NO_GL_STATS), not writing " << filename << std::endl;
+	return false;
+}
+inline void PrintFrameStatsSummary() {}
+
+#endif // THECAR_NO_GL_STATS
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+/*
+* Golden-image regression checks: the scene is rendered from fixed camera poses, read back and compared
+* with stored reference PNGs. A pixel mismatches when any channel differs by more than the tolerance;
+* a pose fails when more than GOLDEN_MAX_BAD_FRACTION of its pixels mismatch, which leaves room for
+* rasterization differences between GL implementations.
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+//Size the references are stored at
+const int GOLDEN_WIDTH = 200;
+const int GOLDEN_HEIGHT = 150;
+//Default per-channel tolerance, --golden-tolerance overrides it
+const int GOLDEN_CHANNEL_TOLERANCE = 8;
+//Share of pixels allowed beyond the tolerance
+const double GOLDEN_MAX_BAD_FRACTION = 0.001;
+//Frames rendered per pose before readback, so GL state carried over from the previous frame has settled
+const int GOLDEN_WARMUP_FRAMES = 2;
+
+struct GoldenPose {
+	const char* name;	//Reference file is <name>.png
+	glm::vec3 position;
+	float yaw;
+	float pitch;
+};
+
+const GoldenPose GOLDEN_POSES[] = {
+	{ "default",		glm::vec3(0.0f, 8.0f, 25.0f),			-90.0f,   0.0f },
+	{ "front_left",		glm::vec3(-14.142f, 6.852f, 19.142f),	-45.0f, -13.636f },
+	{ "side",			glm::vec3(-20.0f, 5.879f, 5.0f),		  0.0f, -10.975f },
+	{ "rear",			glm::vec3(0.0f, 5.0f, -15.0f),			 90.0f,  -8.531f },
+	{ "top",			glm::vec3(0.0f, 30.0f, 5.0f),			-90.0f, -89.0f },
+	{ "wheel_close",	glm::vec3(-8.0f, 2.0f, 1.0f),			  0.0f,  -5.0f },
+};
+
+struct GoldenResult {
+	int maxDifference = 0;	//Largest channel difference over the image
+	int badPixels = 0;		//Pixels beyond the tolerance
+	int pixels = 0;
+
+	bool passed() const { return badPixels <= pixels * GOLDEN_MAX_BAD_FRACTION; }
+};
+
+//Compares two RGB images of the same size; the diff image shows mismatches in red,
+//differences within tolerance amplified in green and matching pixels as a dimmed copy of the reference
+inline GoldenResult CompareImages(const unsigned char* reference, const unsigned char* actual, int width, int height,
+	int tolerance, std::vector<unsigned char>& diff)
+{
+	GoldenResult result;
+	result.pixels = width * height;
+	diff.resize((size_t)result.pixels * 3);
+	for (int i = 0; i < result.pixels; i++) {
+		const unsigned char* r = reference + i * 3;
+		const unsigned char* a = actual + i * 3;
+		unsigned char* d = &diff[(size_t)i * 3];
+		int difference = std::max({ abs(r[0] - a[0]), abs(r[1] - a[1]), abs(r[2] - a[2]) });
+		result.maxDifference = std::max(result.maxDifference, difference);
+		if (difference > tolerance) {
+			result.badPixels++;
+			d[0] = 255; d[1] = 0; d[2] = 0;
+		}
+		else if (difference > 0) {
+			d[0] = 0; d[1] = (unsigned char)std::min(255, 64 + difference * 16); d[2] = 0;
+		}
+		else {
+			d[0] = r[0] / 4; d[1] = r[1] / 4; d[2] = r[2] / 4;
+		}
+	}
+	return result;
+}
+
+#endif
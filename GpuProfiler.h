@@ -0,0 +1,264 @@
+#ifndef GPUPROFILER_H
+#define GPUPROFILER_H
+
+/*
+* GPU profiler built on GL_TIMESTAMP queries.
+* Queries of a frame are written into one of FRAME_LATENCY query sets and read back FRAME_LATENCY - 1 frames
+* later, when the GPU has long finished them, so reading never stalls the pipeline.
+* With GL_ARB_pipeline_statistics_query, outermost scopes also count vertex and fragment shader invocations
+* (those queries cannot nest, so inner scopes only get timings).
+* A scope begun several times in one frame (once per occlusion group) counts as one scope of that frame, its
+* times added up.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef GL_VERTEX_SHADER_INVOCATIONS_ARB
+#define GL_VERTEX_SHADER_INVOCATIONS_ARB 0x82F0
+#endif
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#endif
+
+class GpuProfiler
+{
+public:
+	//Query sets in flight: results are read two frames after they were issued
+	static const int FRAME_LATENCY = 3;
+
+	//Accumulated results of one named scope
+	struct ScopeTotals {
+		double totalMs = 0.0;
+		double maxMs = 0.0;
+		unsigned long long vertexInvocations = 0;
+		unsigned long long fragmentInvocations = 0;
+		unsigned frames = 0;
+		int depth = 0;
+		int order = 0; //First-seen order, keeps the report in frame order
+		double frameMs = 0.0;	//Of the frame being collected
+		unsigned lastFrame = 0;	//Collected frame frameMs belongs to
+	};
+
+	bool enabled = false;
+
+	void init(bool usePipelineStatistics)
+	{
+		enabled = true;
+		pipelineStats = usePipelineStatistics && hasExtension("GL_ARB_pipeline_statistics_query");
+		for (FrameQueries& frame : frames)
+			glGenQueries(2, frame.frameQueries);
+		std::cout << "INFO: GPU profiler enabled, pipeline statistics " << (pipelineStats ? "on" : "unavailable") << std::endl;
+	}
+
+	void destroy()
+	{
+		if (!enabled)
+			return;
+		for (FrameQueries& frame : frames) {
+			glDeleteQueries(2, frame.frameQueries);
+			for (ScopeQueries& scope : frame.scopes)
+				glDeleteQueries(4, scope.queries);
+		}
+		enabled = false;
+	}
+
+	//Starts a frame: collects the query set issued FRAME_LATENCY frames ago, then reuses it
+	void beginFrame()
+	{
+		if (!enabled)
+			return;
+		current = (current + 1) % FRAME_LATENCY;
+		FrameQueries& frame = frames[current];
+		if (frame.issued)
+			collect(frame);
+		frame.used = 0;
+		frame.issued = true;
+		glQueryCounter(frame.frameQueries[0], GL_TIMESTAMP);
+	}
+
+	void endFrame()
+	{
+		if (!enabled)
+			return;
+		glQueryCounter(frames[current].frameQueries[1], GL_TIMESTAMP);
+	}
+
+	void beginScope(const char* name)
+	{
+		if (!enabled)
+			return;
+		FrameQueries& frame = frames[current];
+		if (frame.used == frame.scopes.size()) {
+			ScopeQueries scope;
+			glGenQueries(4, scope.queries);
+			frame.scopes.push_back(scope);
+		}
+		ScopeQueries& scope = frame.scopes[frame.used];
+		scope.name = name;
+		scope.depth = (int)open.size();
+		scope.hasStats = pipelineStats && !statsActive;
+		open.push_back(frame.used);
+		frame.used++;
+
+		glQueryCounter(scope.queries[0], GL_TIMESTAMP);
+		if (scope.hasStats) {
+			statsActive = true;
+			glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB, scope.queries[2]);
+			glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, scope.queries[3]);
+		}
+	}
+
+	void endScope()
+	{
+		if (!enabled || open.empty())
+			return;
+		ScopeQueries& scope = frames[current].scopes[open.back()];
+		open.pop_back();
+		if (scope.hasStats) {
+			glEndQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB);
+			glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+			statsActive = false;
+		}
+		glQueryCounter(scope.queries[1], GL_TIMESTAMP);
+	}
+
+	//End of run: collects the frames still in flight, waiting for them is fine at this point
+	void finish()
+	{
+		if (!enabled)
+			return;
+		glFinish();
+		for (int i = 1; i <= FRAME_LATENCY; i++) {
+			FrameQueries& frame = frames[(current + i) % FRAME_LATENCY];
+			if (frame.issued)
+				collect(frame);
+			frame.issued = false;
+		}
+	}
+
+	//Average GPU time per scope, printed in the order scopes were first seen
+	void printSummary() const
+	{
+		if (!enabled || framesCollected == 0)
+			return;
+		std::vector<std::pair<const std::string*, const ScopeTotals*>> ordered(totals.size());
+		for (const auto& entry : totals)
+			ordered[entry.second.order] = { &entry.first, &entry.second };
+
+		printf("INFO: GPU time over %u frames (%u dropped), frame mean %.3f ms max %.3f ms\n",
+			framesCollected, framesDropped, frameTotalMs / framesCollected, frameMaxMs);
+		printf("  %-20s %10s %10s %14s %14s\n", "scope", "mean ms", "max ms", "VS invocations", "FS invocations");
+		for (const auto& entry : ordered) {
+			const ScopeTotals& t = *entry.second;
+			std::string label = std::string(t.depth * 2, ' ') + *entry.first;
+			printf("  %-20s %10.3f %10.3f", label.c_str(), t.totalMs / t.frames, t.maxMs);
+			if (pipelineStats && t.depth == 0)
+				printf(" %14llu %14llu\n", t.vertexInvocations / t.frames, t.fragmentInvocations / t.frames);
+			else
+				printf(" %14s %14s\n", "-", "-");
+		}
+	}
+
+	const std::map<std::string, ScopeTotals>& results() const { return totals; }
+
+private:
+	struct ScopeQueries {
+		const char* name = nullptr;
+		GLuint queries[4] = {};	//begin timestamp, end timestamp, VS invocations, FS invocations
+		int depth = 0;
+		bool hasStats = false;
+	};
+	struct FrameQueries {
+		GLuint frameQueries[2] = {};	//frame begin / end timestamps
+		std::vector<ScopeQueries> scopes;	//Pool, grows to the largest scope count seen
+		size_t used = 0;
+		bool issued = false;
+	};
+
+	FrameQueries frames[FRAME_LATENCY];
+	int current = FRAME_LATENCY - 1;
+	std::vector<size_t> open;	//Scopes begun but not ended yet
+	bool pipelineStats = false;
+	bool statsActive = false;
+
+	std::map<std::string, ScopeTotals> totals;
+	double frameTotalMs = 0.0;
+	double frameMaxMs = 0.0;
+	unsigned framesCollected = 0;
+	unsigned framesDropped = 0;
+
+	static bool hasExtension(const char* name)
+	{
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++) {
+			if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	static unsigned long long result(GLuint query)
+	{
+		GLuint64 value = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &value);
+		return value;
+	}
+
+	void collect(FrameQueries& frame)
+	{
+		//The frame end timestamp is the last query issued, if it is ready everything before it is too
+		GLint available = 0;
+		glGetQueryObjectiv(frame.frameQueries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			framesDropped++; //Never wait: drop this frame's numbers and reuse its queries
+			return;
+		}
+		double frameMs = (result(frame.frameQueries[1]) - result(frame.frameQueries[0])) / 1.0e6;
+		frameTotalMs += frameMs;
+		frameMaxMs = frameMs > frameMaxMs ? frameMs : frameMaxMs;
+		framesCollected++;
+
+		for (size_t i = 0; i < frame.used; i++) {
+			const ScopeQueries& scope = frame.scopes[i];
+			auto inserted = totals.emplace(scope.name, ScopeTotals());
+			ScopeTotals& t = inserted.first->second;
+			if (inserted.second) {
+				t.order = (int)totals.size() - 1;
+				t.depth = scope.depth;
+			}
+			double ms = (result(scope.queries[1]) - result(scope.queries[0])) / 1.0e6;
+			if (t.lastFrame != framesCollected) {
+				t.lastFrame = framesCollected;
+				t.frameMs = 0.0;
+				t.frames++;
+			}
+			t.frameMs += ms;
+			t.totalMs += ms;
+			t.maxMs = t.frameMs > t.maxMs ? t.frameMs : t.maxMs;
+			if (scope.hasStats) {
+				t.vertexInvocations += result(scope.queries[2]);
+				t.fragmentInvocations += result(scope.queries[3]);
+			}
+		}
+	}
+};
+
+//Profiles the enclosing block
+class GpuProfileScope
+{
+public:
+	GpuProfileScope(GpuProfiler& profiler, const char* name) : profiler(profiler) { profiler.beginScope(name); }
+	~GpuProfileScope() { profiler.endScope(); }
+	GpuProfileScope(const GpuProfileScope&) = delete;
+	GpuProfileScope& operator=(const GpuProfileScope&) = delete;
+private:
+	GpuProfiler& profiler;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+/*
+* Offscreen rendering support for --headless runs.
+* The EGL path creates a surfaceless desktop GL core context (Mesa llvmpipe works on CPU-only boxes),
+* and the frame is rendered into an FBO instead of the default framebuffer of a window.
+*/
+
+#ifdef THECAR_HAS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <iostream>
+
+//Framebuffer object standing in for the window's back buffer
+struct OffscreenTarget {
+	GLuint fbo = 0;		//Handle for the framebuffer object
+	GLuint colorRbo = 0;	//RGBA8 color attachment
+	GLuint depthRbo = 0;	//24 bit depth / 8 bit stencil attachment
+	int width = 0;
+	int height = 0;
+};
+
+//Create the FBO and leave it bound as the draw and read framebuffer
+inline bool CreateOffscreenTarget(OffscreenTarget& target, int width, int height)
+{
+	target.width = width;
+	target.height = height;
+
+	glGenRenderbuffers(1, &target.colorRbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, target.colorRbo);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+	glGenRenderbuffers(1, &target.depthRbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, target.depthRbo);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &target.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.colorRbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, target.depthRbo);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		std::cout << "ERROR::OFFSCREEN::FRAMEBUFFER_INCOMPLETE status: 0x" << std::hex << status << std::dec << std::endl;
+		return false;
+	}
+
+	glViewport(0, 0, width, height);
+	return true;
+}
+
+inline void DestroyOffscreenTarget(OffscreenTarget& target)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &target.fbo);
+	glDeleteRenderbuffers(1, &target.colorRbo);
+	glDeleteRenderbuffers(1, &target.depthRbo);
+	target = OffscreenTarget();
+}
+
+#ifdef THECAR_HAS_EGL
+//Surfaceless EGL display and GL 4.4 core context, no window system required
+struct HeadlessContext {
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+};
+
+inline bool CreateHeadlessContext(HeadlessContext& ctx)
+{
+	//Prefer the Mesa surfaceless platform so no X11/Wayland server is needed
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+		ctx.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (ctx.display == EGL_NO_DISPLAY)
+		ctx.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (ctx.display == EGL_NO_DISPLAY || !eglInitialize(ctx.display, &major, &minor)) {
+		std::cout << "Failed to initialize EGL display: 0x" << std::hex << eglGetError() << std::dec << std::endl;
+		return false;
+	}
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		std::cout << "EGL display does not support desktop OpenGL" << std::endl;
+		return false;
+	}
+
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 4,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	//EGL_KHR_no_config_context + EGL_KHR_surfaceless_context: no config or pbuffer is needed, we render into an FBO
+	ctx.context = eglCreateContext(ctx.display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttribs);
+	if (ctx.context == EGL_NO_CONTEXT) {
+		std::cout << "Failed to create EGL OpenGL 4.4 core context: 0x" << std::hex << eglGetError() << std::dec << std::endl;
+		return false;
+	}
+	if (!eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx.context)) {
+		std::cout << "Failed to make EGL context current: 0x" << std::hex << eglGetError() << std::dec << std::endl;
+		return false;
+	}
+	return true;
+}
+
+inline void DestroyHeadlessContext(HeadlessContext& ctx)
+{
+	if (ctx.display == EGL_NO_DISPLAY)
+		return;
+	eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (ctx.context != EGL_NO_CONTEXT)
+		eglDestroyContext(ctx.display, ctx.context);
+	eglTerminate(ctx.display);
+	ctx = HeadlessContext();
+}
+#endif // THECAR_HAS_EGL
+
+#endif
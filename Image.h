@@ -0,0 +1,169 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+/*
+* CPU-side image helpers: flipping and resizing decoded texture data before upload, and a minimal PNG writer for
+* golden images and their diffs. The writer stores uncompressed deflate blocks, which keeps it short
+* and dependency free at the cost of larger files.
+*/
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+//Image Flip
+inline void flipImageVertically(unsigned char* image, int width, int height, int channels)
+{
+	for (int j = 0; j < height / 2; j++)
+	{
+		int index1 = j * width * channels;
+		int index2 = (height - 1 - j) * width * channels;
+
+		for (int i = width * channels; i > 0; i--)
+		{
+			unsigned char temp = image[index1];
+			image[index1] = image[index2];
+			image[index2] = temp;
+			index1++;
+			index2++;
+		}
+	}
+}
+
+//One line of a separable resize with a tent filter: count samples step apart in src become dstCount samples
+//in dst. Shrinking widens the tent to the source footprint of a target sample so every source sample counts,
+//growing is plain linear interpolation. Taps past either end are dropped and the weights renormalized.
+template <typename Source, typename Target>
+inline void ResampleLine(const Source* src, int count, size_t srcStep, Target* dst, int dstCount, size_t dstStep, int channels)
+{
+	const float scale = (float)count / dstCount;
+	const float radius = std::max(scale, 1.0f);
+	for (int i = 0; i < dstCount; i++) {
+		const float center = (i + 0.5f) * scale - 0.5f;
+		const int first = std::max(0, (int)std::ceil(center - radius));
+		const int last = std::min(count - 1, (int)std::floor(center + radius));
+		float sum[4] = {};
+		float total = 0.0f;
+		for (int j = first; j <= last; j++) {
+			const float weight = 1.0f - std::fabs(j - center) / radius;
+			if (weight <= 0.0f)
+				continue;
+			for (int c = 0; c < channels; c++)
+				sum[c] += weight * (float)src[j * srcStep + c];
+			total += weight;
+		}
+		if (total <= 0.0f) {
+			//Exactly between two samples of a 1:1 line, or a single sample
+			const int nearest = std::min(count - 1, std::max(0, (int)std::lround(center)));
+			for (int c = 0; c < channels; c++)
+				sum[c] = (float)src[nearest * srcStep + c];
+			total = 1.0f;
+		}
+		for (int c = 0; c < channels; c++)
+			dst[i * dstStep + c] = (Target)(sum[c] / total + (sizeof(Target) == 1 ? 0.5f : 0.0f));
+	}
+}
+
+//Resizes 8 bit pixels with up to 4 channels, rows first, then columns
+inline void ResampleImage(const unsigned char* src, int width, int height, int channels, unsigned char* dst, int dstWidth, int dstHeight)
+{
+	std::vector<float> rows((size_t)dstWidth * height * channels);
+	for (int y = 0; y < height; y++)
+		ResampleLine(src + (size_t)y * width * channels, width, channels, &rows[(size_t)y * dstWidth * channels], dstWidth, channels, channels);
+	for (int x = 0; x < dstWidth; x++)
+		ResampleLine(&rows[(size_t)x * channels], height, (size_t)dstWidth * channels, dst + (size_t)x * channels, dstHeight, (size_t)dstWidth * channels, channels);
+}
+
+inline uint32_t PngCrc(const unsigned char* data, size_t length, uint32_t crc = 0xffffffffu)
+{
+	static const std::array<uint32_t, 256> table = [] {
+		std::array<uint32_t, 256> t;
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			t[n] = c;
+		}
+		return t;
+	}();
+	for (size_t i = 0; i < length; i++)
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+inline void PngPut32(std::vector<unsigned char>& out, uint32_t value)
+{
+	out.push_back((unsigned char)(value >> 24));
+	out.push_back((unsigned char)(value >> 16));
+	out.push_back((unsigned char)(value >> 8));
+	out.push_back((unsigned char)value);
+}
+
+inline void PngChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data)
+{
+	PngPut32(out, (uint32_t)data.size());
+	size_t typeStart = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	PngPut32(out, PngCrc(&out[typeStart], out.size() - typeStart) ^ 0xffffffffu);
+}
+
+//Writes top-down 8 bit RGB (channels 3) or RGBA (channels 4) pixels
+inline bool WritePng(const char* filename, const unsigned char* pixels, int width, int height, int channels)
+{
+	if (channels != 3 && channels != 4)
+		return false;
+	const size_t rowBytes = (size_t)width * channels;
+
+	//Scanlines with filter type 0, the payload of the zlib stream
+	std::vector<unsigned char> raw;
+	raw.reserve((rowBytes + 1) * height);
+	for (int y = 0; y < height; y++) {
+		raw.push_back(0);
+		raw.insert(raw.end(), pixels + y * rowBytes, pixels + (y + 1) * rowBytes);
+	}
+
+	//zlib header, stored deflate blocks of at most 65535 bytes, adler32
+	std::vector<unsigned char> zlib = { 0x78, 0x01 };
+	zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+	size_t offset = 0;
+	do {
+		size_t block = raw.size() - offset < 65535 ? raw.size() - offset : 65535;
+		bool last = offset + block == raw.size();
+		zlib.push_back(last ? 1 : 0);
+		zlib.push_back((unsigned char)(block & 0xff));
+		zlib.push_back((unsigned char)(block >> 8));
+		zlib.push_back((unsigned char)(~block & 0xff));
+		zlib.push_back((unsigned char)((~block >> 8) & 0xff));
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + block);
+		offset += block;
+	} while (offset < raw.size());
+	uint32_t a = 1, b = 0;
+	for (unsigned char byte : raw) {
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	PngPut32(zlib, (b << 16) | a);
+
+	std::vector<unsigned char> header;
+	PngPut32(header, (uint32_t)width);
+	PngPut32(header, (uint32_t)height);
+	header.insert(header.end(), { 8, (unsigned char)(channels == 4 ? 6 : 2), 0, 0, 0 });
+
+	std::vector<unsigned char> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	PngChunk(png, "IHDR", header);
+	PngChunk(png, "IDAT", zlib);
+	PngChunk(png, "IEND", {});
+
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+		return false;
+	bool written = fwrite(png.data(), 1, png.size(), file) == png.size();
+	fclose(file);
+	return written;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef MATERIALS_H
+#define MATERIALS_H
+
+/*
+* Material table.
+* A material is everything a draw sets besides its mesh and transform: both texture maps, the sampler each
+* is read with, the shininess, the point light preset and the UV scale. With texture arrays the maps are
+* layers instead and the wrap modes are applied by the shader, every material then shares one texture set. Materials live in one contiguous
+* table and meshes and draw items refer to them by index, so comparing two materials is comparing two integers.
+* Materials with the same maps and samplers share a texture set, which is what the render queue sorts on.
+* The scalars of every material are also uploaded once as MaterialRecords, which the light shader indexes with
+* each draw's material id, so draws of one texture set need no uniform changes between them.
+* Handles are plain integers, nothing here calls GL.
+*/
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+typedef uint32_t MaterialId;
+const MaterialId INVALID_MATERIAL = UINT32_MAX;
+
+struct Material {
+	uint32_t diffuse = 0;	//Texture of unit 0
+	uint32_t specular = 0;	//Texture of unit 1
+	uint32_t diffuseSampler = 0;	//SamplerIndex (Samplers.h) of unit 0
+	uint32_t specularSampler = 0;	//SamplerIndex of unit 1
+	float shininess = 32.0f;
+	int32_t pointLight = 0;	//PointLightPreset
+	glm::vec2 uvScale = glm::vec2(1.0f);
+	uint32_t textureSet = 0;	//Assigned by MaterialTable::add
+	uint32_t diffuseLayer = 0;	//TextureLayerIndex (TextureArrays.h) of the diffuse map, with texture arrays
+	uint32_t specularLayer = 0;
+	uint32_t diffuseWrap = 0;	//SamplerWrap the shader emulates for the diffuse layer
+	uint32_t specularWrap = 0;
+};
+
+struct MaterialTable {
+	std::vector<Material> materials;
+	uint32_t textureSets = 0;
+
+	//Appends material and returns its id, the ids count up from 0 in the order materials are added
+	MaterialId add(Material material)
+	{
+		material.textureSet = textureSets;
+		for (const Material& other : materials) {
+			if (other.diffuse == material.diffuse && other.specular == material.specular
+				&& other.diffuseSampler == material.diffuseSampler && other.specularSampler == material.specularSampler) {
+				material.textureSet = other.textureSet;
+				break;
+			}
+		}
+		if (material.textureSet == textureSets)
+			textureSets++;
+		materials.push_back(material);
+		return (MaterialId)materials.size() - 1;
+	}
+
+	const Material& operator[](MaterialId id) const
+	{
+		return materials[id];
+	}
+
+	size_t size() const
+	{
+		return materials.size();
+	}
+};
+
+//Material scalars in the light shader's MaterialBlock (std430)
+struct MaterialRecord {
+	glm::vec2 uvScale;
+	float shininess;
+	int32_t pointLight;
+	uint32_t diffuseLayer;
+	uint32_t specularLayer;
+	uint32_t diffuseWrap;
+	uint32_t specularWrap;
+};
+static_assert(sizeof(MaterialRecord) == 32, "MaterialRecord layout");
+
+//Records of every material of table, indexed by MaterialId
+inline std::vector<MaterialRecord> BuildMaterialRecords(const MaterialTable& table)
+{
+	std::vector<MaterialRecord> records;
+	records.reserve(table.size());
+	for (const Material& material : table.materials)
+		records.push_back({ material.uvScale, material.shininess, material.pointLight,
+			material.diffuseLayer, material.specularLayer, material.diffuseWrap, material.specularWrap });
+	return records;
+}
+
+//Material state last given to GL, kept by the submission so binding what is already bound costs nothing
+struct MaterialBinding {
+	MaterialId material = INVALID_MATERIAL;	//Material whose maps and samplers are bound
+	uint32_t diffuse = 0;
+	uint32_t specular = 0;
+	uint32_t diffuseSampler = 0;
+	uint32_t specularSampler = 0;
+	bool texturesBound = false;
+};
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef MESHGEN_H
+#define MESHGEN_H
+
+/*
+* CPU-side vertex generation for the procedural meshes (torus, cylinder, rectangle prism).
+* No GL calls here: Source.cpp uploads the result, benchmarks time the generation on its own.
+* Vertices are interleaved position(3) / normal(3) / uv(2) floats.
+*/
+
+#include <math.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+const unsigned FLOATS_PER_VERTEX = 3 + 3 + 2;
+
+//Axis aligned box and bounding sphere of a mesh's positions, in the mesh's own space
+struct MeshBounds {
+	glm::vec3 min = glm::vec3(0.0f);
+	glm::vec3 max = glm::vec3(0.0f);
+	glm::vec3 center = glm::vec3(0.0f);	//Center of the box
+	float radius = 0.0f;	//Distance from center to the farthest vertex, tighter than half the box diagonal
+};
+
+//Bounds of interleaved vertices, empty bounds at the origin when there are none
+inline MeshBounds ComputeMeshBounds(const std::vector<float>& data)
+{
+	MeshBounds bounds;
+	if (data.size() < FLOATS_PER_VERTEX)
+		return bounds;
+	bounds.min = bounds.max = glm::vec3(data[0], data[1], data[2]);
+	for (size_t i = 0; i + FLOATS_PER_VERTEX <= data.size(); i += FLOATS_PER_VERTEX) {
+		const glm::vec3 position(data[i], data[i + 1], data[i + 2]);
+		bounds.min = glm::min(bounds.min, position);
+		bounds.max = glm::max(bounds.max, position);
+	}
+	bounds.center = (bounds.min + bounds.max) * 0.5f;
+	float radius2 = 0.0f;
+	for (size_t i = 0; i + FLOATS_PER_VERTEX <= data.size(); i += FLOATS_PER_VERTEX) {
+		const glm::vec3 offset = glm::vec3(data[i], data[i + 1], data[i + 2]) - bounds.center;
+		radius2 = std::max(radius2, glm::dot(offset, offset));
+	}
+	bounds.radius = std::sqrt(radius2);
+	return bounds;
+}
+
+//Generated vertices plus the counts of the three draw ranges a cylinder / rectangle is made of
+struct MeshVertices {
+	std::vector<float> data;
+	unsigned sideVerts = 0;		//Triangle strip around the tube
+	unsigned topVerts = 0;		//Triangle fan closing the top
+	unsigned bottomVerts = 0;	//Triangle fan closing the bottom
+
+	size_t vertexCount() const { return data.size() / FLOATS_PER_VERTEX; }
+};
+
+//Torus as rSeg triangle strips of cSeg + 1 vertex pairs, r is the tube and c the ring radius
+inline void BuildTorusVertices(MeshVertices& out, float r, float c, int rSeg, int cSeg, int zMulti)
+{
+	std::vector<float>& newTorusVertices = out.data;
+	newTorusVertices.clear();
+	newTorusVertices.reserve((size_t)rSeg * (cSeg + 1) * 2 * FLOATS_PER_VERTEX);
+
+	const float TAU = 2.0f * (float)M_PI;
+
+	for (int i = 0; i < rSeg; i++) {
+		for (int j = 0; j <= cSeg; j++) {
+			for (int k = 0; k <= 1; k++) {
+				float s = (float)((i + k) % rSeg + 0.5);
+				float t = (float)(j % (cSeg + 1));
+
+				float x = (float)(zMulti * ((c + 0.5 * r * cos(s * TAU / rSeg)) * cos(t * TAU / cSeg)));
+				float y = (float)(zMulti * ((c + 0.5 * r * cos(s * TAU / rSeg)) * sin(t * TAU / cSeg)));
+				float z = (float)(zMulti * (zMulti * r * sin(s * TAU / rSeg)));
+
+				float u = (i + k) / (float)rSeg;
+				float v = t / (float)cSeg;
+				float mag = (float)(sqrt(pow(x, 2) + pow(y, 2) + pow(z, 2)));
+				newTorusVertices.push_back(x);
+				newTorusVertices.push_back(y);
+				newTorusVertices.push_back(z);
+				newTorusVertices.push_back(x / mag);
+				newTorusVertices.push_back(y / mag);
+				newTorusVertices.push_back(z / mag);
+				newTorusVertices.push_back(u);
+				newTorusVertices.push_back(v);
+			}
+		}
+	}
+	out.sideVerts = 0;
+	out.topVerts = 0;
+	out.bottomVerts = 0;
+}
+
+//Cylinder along +z: side strip, then top and bottom fans, stepping 0.1 radians around the circle
+inline void BuildCylinderVertices(MeshVertices& out, float radius, float height)
+{
+	float x = 0.0f;
+	float y = 0.0f;
+	float angle = 0.0f;
+	float angle_stepsize = 0.1f;
+	std::vector<float>& cylinderVertices = out.data;
+	cylinderVertices.clear();
+	out.sideVerts = 0;
+	out.topVerts = 0;
+	out.bottomVerts = 0;
+	float mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(height, 2));
+	float mag2 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(0.0, 2));
+	///** Draw the tube */
+	angle = 0.0;
+	while (angle <= 2 * M_PI) {
+		x = radius * cos(angle);
+		y = radius * sin(angle);
+		mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(height, 2));
+		mag2 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(0.0, 2));
+		cylinderVertices.insert(cylinderVertices.end(), { x, y, height, x / mag1, y / mag1, height / mag1, angle, 1.0f });//Top
+		cylinderVertices.insert(cylinderVertices.end(), { x, y, 0.0f, x / mag2, y / mag2, 0.0f, angle, 0.0f });//Bottom
+		angle = angle + angle_stepsize;
+		out.sideVerts += 2;
+	}
+	mag1 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(height, 2));
+	mag2 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(0.0, 2));
+	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, height, radius / mag1, 0.0f, height / mag1, angle, 1.0f });
+	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, 0.0f, radius / mag2, 0.0f, 0.0f, angle, 0.0f });
+	out.sideVerts += 2;
+
+	/** Draw the circle on top of cylinder */
+	angle = 0.0;
+	while (angle <= 2 * M_PI) {
+		x = radius * cos(angle);
+		y = radius * sin(angle);
+		mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(height, 2));
+		cylinderVertices.insert(cylinderVertices.end(), { x, y, height, x / mag1, y / mag1, height / mag1, angle, 1.0f });
+		angle = angle + angle_stepsize;
+		out.topVerts++;
+	}
+	out.topVerts++;
+	mag1 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(height, 2));
+	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, height, radius / mag1, 0.0f, height / mag1, angle, 1.0f });
+
+	angle = 0.0;
+	while (angle <= 2 * M_PI) {
+		x = radius * cos(angle);
+		y = radius * sin(angle);
+
+		mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(0.0, 2));
+		cylinderVertices.insert(cylinderVertices.end(), { x, y, 0.0, x / mag1, y / mag1, 0.0, angle, 1.0f });
+		angle = angle + angle_stepsize;
+		out.bottomVerts++;
+	}
+	mag1 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(height, 2));
+	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, height, radius / mag1, 0.0f, height / mag1, angle, 1.0f });
+	out.bottomVerts++;
+}
+
+//Four sided prism built like the cylinder, used for the spokes and the body
+inline void BuildRectangleVertices(MeshVertices& out, float radius, float height)
+{
+	float x = 0.0f;
+	float y = 0.0f;
+	int numSlices = 4;
+	float angle = 0.0f;
+	float angle_stepsize = 2.0f * (float)M_PI / (float)numSlices;
+	std::vector<float>& cylinderVertices = out.data;
+	cylinderVertices.clear();
+	out.sideVerts = 0;
+	out.topVerts = 0;
+	out.bottomVerts = 0;
+	float mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(height, 2));
+	float mag2 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(0.0, 2));
+	///** Draw the tube */
+	angle = 0.0;
+	while (angle <= numSlices + 1) {
+		x = radius * cos(angle);
+		y = radius * sin(angle);
+		mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(height, 2));
+		mag2 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(0.0, 2));
+		cylinderVertices.insert(cylinderVertices.end(), { x, y, height, x / mag1, y / mag1, height / mag1, angle, 1.0f });//Top
+		cylinderVertices.insert(cylinderVertices.end(), { x, y, 0.0f, x / mag2, y / mag2, 0.0f, angle, 0.0f });//Bottom
+		angle = angle + angle_stepsize;
+		out.sideVerts += 2;
+	}
+	mag1 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(height, 2));
+	mag2 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(0.0, 2));
+	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, height, radius / mag1, 0.0f, height / mag1, angle, 1.0f });
+	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, 0.0f, radius / mag2, 0.0f, 0.0f, angle, 0.0f });
+	out.sideVerts += 2;
+
+	/** Draw the circle on top of cylinder */
+	angle = 0.0;
+	while (angle <= numSlices + 1) {
+		x = radius * cos(angle);
+		y = radius * sin(angle);
+		mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(height, 2));
+		cylinderVertices.insert(cylinderVertices.end(), { x, y, height, x / mag1, y / mag1, height / mag1, angle, 1.0f });
+		angle = angle + angle_stepsize;
+		out.topVerts++;
+	}
+	out.topVerts++;
+	mag1 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(height, 2));
+	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, height, radius / mag1, 0.0f, height / mag1, angle, 1.0f });
+	angle = 0.0;
+	while (angle <= numSlices + 1) {
+		x = radius * cos(angle);
+		y = radius * sin(angle);
+
+		mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(0.0, 2));
+		cylinderVertices.insert(cylinderVertices.end(), { x, y, 0.0, x / mag1, y / mag1, 0.0, angle, 1.0f });
+		angle = angle + angle_stepsize;
+		out.bottomVerts++;
+	}
+	mag1 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(height, 2));
+	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, 0.0f, radius / mag1, 0.0f, 0.0f, angle, 1.0f });
+	out.bottomVerts++;
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef NORMALMATRIX_H
+#define NORMALMATRIX_H
+
+/*
+* Normal matrix (inverse transpose of the model's upper 3x3) computed once per draw on the CPU,
+* instead of inverse() for every vertex in the light vertex shader.
+* For a 3x3 matrix with columns c0, c1, c2 the inverse transpose is the cofactor matrix over the determinant,
+* and the cofactor columns are cross(c1, c2), cross(c2, c0), cross(c0, c1): three cross products and a dot.
+* When the columns are orthogonal and equally long (rotation times uniform scale s) the inverse transpose
+* is the matrix itself divided by s^2, no cofactors needed. Testing for that costs about as much as the
+* cofactors themselves, so the caller, who knows how the transform was built, picks the fast path.
+*/
+
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define THECAR_NORMAL_MATRIX_SSE
+#include <emmintrin.h>
+#endif
+
+//Inverse transpose through cofactors, plain glm
+inline glm::mat3 NormalMatrixCofactor(const glm::mat4& model)
+{
+	const glm::vec3 c0(model[0]), c1(model[1]), c2(model[2]);
+	const glm::vec3 x = glm::cross(c1, c2);
+	const float invDet = 1.0f / glm::dot(c0, x);
+	return glm::mat3(x * invDet, glm::cross(c2, c0) * invDet, glm::cross(c0, c1) * invDet);
+}
+
+#ifdef THECAR_NORMAL_MATRIX_SSE
+//(a.y, a.z, a.x) style lane rotation used by the cross products
+#define NORMAL_MATRIX_YZX(v) _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1))
+
+inline __m128 NormalMatrixCross(__m128 a, __m128 b)
+{
+	//cross(a, b) = (a * b.yzx - a.yzx * b).yzx
+	__m128 c = _mm_sub_ps(_mm_mul_ps(a, NORMAL_MATRIX_YZX(b)), _mm_mul_ps(NORMAL_MATRIX_YZX(a), b));
+	return NORMAL_MATRIX_YZX(c);
+}
+
+//Same cofactor formula with the three columns in SSE registers; the w lanes of the model are ignored
+inline glm::mat3 NormalMatrixCofactorSse(const glm::mat4& model)
+{
+	const __m128 w0 = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	const __m128 c0 = _mm_and_ps(_mm_loadu_ps(&model[0][0]), w0);
+	const __m128 c1 = _mm_and_ps(_mm_loadu_ps(&model[1][0]), w0);
+	const __m128 c2 = _mm_and_ps(_mm_loadu_ps(&model[2][0]), w0);
+	const __m128 x = NormalMatrixCross(c1, c2);
+	const __m128 y = NormalMatrixCross(c2, c0);
+	const __m128 z = NormalMatrixCross(c0, c1);
+	//Horizontal sum of c0 * x, the w lane is zero
+	__m128 d = _mm_mul_ps(c0, x);
+	d = _mm_add_ps(d, _mm_movehl_ps(d, d));
+	d = _mm_add_ss(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 1, 1, 1)));
+	const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), _mm_shuffle_ps(d, d, 0));
+
+	float out[12];
+	_mm_storeu_ps(out, _mm_mul_ps(x, invDet));
+	_mm_storeu_ps(out + 4, _mm_mul_ps(y, invDet));
+	_mm_storeu_ps(out + 8, _mm_mul_ps(z, invDet));
+	return glm::mat3(out[0], out[1], out[2], out[4], out[5], out[6], out[8], out[9], out[10]);
+}
+#undef NORMAL_MATRIX_YZX
+#endif
+
+//Normal matrix of any invertible model matrix, through cofactors (SSE where available)
+inline glm::mat3 NormalMatrix(const glm::mat4& model)
+{
+#ifdef THECAR_NORMAL_MATRIX_SSE
+	return NormalMatrixCofactorSse(model);
+#else
+	return NormalMatrixCofactor(model);
+#endif
+}
+
+//Fast path for callers that built the model from rotations, translations and one uniform scale:
+//no cofactors and no check, the 3x3 over s^2 is already the inverse transpose
+inline glm::mat3 NormalMatrixUniformScale(const glm::mat4& model)
+{
+	const glm::vec3 c0(model[0]);
+	return glm::mat3(model) * (1.0f / glm::dot(c0, c0));
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef OCCLUSIONQUERIES_H
+#define OCCLUSIONQUERIES_H
+
+/*
+* Occlusion culling with conditional rendering.
+* With --occlusion every car is an occlusion group (SceneGraph.h). Once the frame's scene is drawn, the world box of each group is
+* drawn with color and depth writes off inside a GL_ANY_SAMPLES_PASSED_CONSERVATIVE query, so it only tests against
+* the depth the other cars and the ground left. The next frame draws the group's passes between
+* glBeginConditionalRender(query, GL_QUERY_NO_WAIT) and glEndConditionalRender: the GPU skips every one of them when
+* no sample of the box passed, and draws them when the result is not in yet. The CPU never reads a result, so it
+* never waits for one.
+* Only a group tested in the frame before is drawn conditionally; a car that was outside the frustum, or whose box
+* holds the camera (the near plane could clip the box while the car fills the view), is drawn unconditionally.
+* The result is one frame old: a car coming out from behind another shows one frame late. Conditional rendering
+* applies per draw call, so every group's draws go out as passes of their own instead of sharing the scene's.
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+struct OcclusionQueries {
+	std::vector<GLuint> queries;	//Query of each group, indexed by group, entry 0 unused
+	std::vector<uint8_t> tested;	//Set when the group's query was issued by the last frame's tests
+	unsigned testedGroups = 0;	//Groups the last frame's tests issued a query for
+};
+
+//One query for each of the groups 1 to groupCount
+inline void CreateOcclusionQueries(OcclusionQueries& occlusion, uint32_t groupCount)
+{
+	occlusion.queries.assign(groupCount + 1, 0);
+	occlusion.tested.assign(groupCount + 1, 0);
+	occlusion.testedGroups = 0;
+	if (groupCount > 0)
+		glGenQueries((GLsizei)groupCount, occlusion.queries.data() + 1);
+}
+
+inline void DestroyOcclusionQueries(OcclusionQueries& occlusion)
+{
+	if (occlusion.queries.size() > 1)
+		glDeleteQueries((GLsizei)occlusion.queries.size() - 1, occlusion.queries.data() + 1);
+	occlusion = OcclusionQueries();
+}
+
+//Query the group's draws are conditional on, 0 when they are drawn unconditionally
+inline GLuint OcclusionCondition(const OcclusionQueries& occlusion, uint32_t group)
+{
+	return group < occlusion.tested.size() && occlusion.tested[group] ? occlusion.queries[group] : 0;
+}
+
+//Turns color and depth writes off for the tests and forgets which groups the last frame tested
+inline void BeginOcclusionTests(OcclusionQueries& occlusion)
+{
+	std::fill(occlusion.tested.begin(), occlusion.tested.end(), 0);
+	occlusion.testedGroups = 0;
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+}
+
+//The draws between this and EndOcclusionTest decide whether group is drawn next frame
+inline void BeginOcclusionTest(OcclusionQueries& occlusion, uint32_t group)
+{
+	glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, occlusion.queries[group]);
+	occlusion.tested[group] = 1;
+	occlusion.testedGroups++;
+}
+
+inline void EndOcclusionTest()
+{
+	glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+}
+
+inline void EndOcclusionTests()
+{
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthMask(GL_TRUE);
+}
+
+//Groups the last frame's tests found hidden. Waits for their results: for the end of the run only.
+inline unsigned CountHiddenGroups(const OcclusionQueries& occlusion)
+{
+	unsigned hidden = 0;
+	for (size_t group = 1; group < occlusion.queries.size(); group++) {
+		if (!occlusion.tested[group])
+			continue;
+		GLuint passed = 0;
+		glGetQueryObjectuiv(occlusion.queries[group], GL_QUERY_RESULT, &passed);
+		hidden += passed ? 0 : 1;
+	}
+	return hidden;
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+/*
+* CPU profiler: RAII scopes written as Chrome trace "complete" events (load the file in Perfetto or chrome://tracing).
+* Each thread appends to its own buffer, so recording takes no lock. Buffers are linked into a global list
+* with a compare-and-swap the first time a thread records, and are read by WriteChromeTrace once the
+* threads that recorded have finished their work.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+//One finished scope
+struct TraceEvent {
+	const char* name;	//Must outlive the profiler, string literals in practice
+	const char* detail;	//Optional argument shown in the event details, may be null
+	int64_t startUs;
+	int64_t durationUs;
+};
+
+//Events recorded by one thread
+struct ThreadTrace {
+	uint32_t id = 0;
+	std::string name;
+	std::vector<TraceEvent> events;
+	ThreadTrace* next = nullptr;
+};
+
+inline std::atomic<bool> gProfilerEnabled{ false };
+inline std::atomic<ThreadTrace*> gThreadTraces{ nullptr };
+inline std::atomic<uint32_t> gNextTraceThreadId{ 1 };
+inline const std::chrono::steady_clock::time_point gProfilerEpoch = std::chrono::steady_clock::now();
+
+inline int64_t ProfilerNowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - gProfilerEpoch).count();
+}
+
+//Buffer of the calling thread, created and pushed onto the global list on first use
+inline ThreadTrace& ProfilerThreadTrace()
+{
+	thread_local ThreadTrace* trace = nullptr;
+	if (trace == nullptr) {
+		trace = new ThreadTrace(); //Never freed: the trace must outlive the thread for the final export
+		trace->id = gNextTraceThreadId.fetch_add(1);
+		trace->name = "thread " + std::to_string(trace->id);
+		trace->events.reserve(4096);
+		ThreadTrace* head = gThreadTraces.load(std::memory_order_relaxed);
+		do {
+			trace->next = head;
+		} while (!gThreadTraces.compare_exchange_weak(head, trace, std::memory_order_release, std::memory_order_relaxed));
+	}
+	return *trace;
+}
+
+inline void EnableProfiler()
+{
+	gProfilerEnabled.store(true);
+}
+
+//Label shown for the calling thread's track
+inline void ProfilerSetThreadName(const char* name)
+{
+	ProfilerThreadTrace().name = name;
+}
+
+//Times its own lifetime, or until end() is called
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* name, const char* detail = nullptr)
+		: name(name), detail(detail), active(gProfilerEnabled.load(std::memory_order_relaxed))
+	{
+		if (active)
+			startUs = ProfilerNowUs();
+	}
+	~ProfileScope() { end(); }
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+	void end()
+	{
+		if (!active)
+			return;
+		active = false;
+		ProfilerThreadTrace().events.push_back({ name, detail, startUs, ProfilerNowUs() - startUs });
+	}
+
+private:
+	const char* name;
+	const char* detail;
+	bool active;
+	int64_t startUs = 0;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+//Profiles the rest of the enclosing block
+#define PROFILE_SCOPE(...) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(__VA_ARGS__)
+
+inline void WriteJsonString(FILE* file, const char* text)
+{
+	fputc('"', file);
+	for (const char* c = text; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fputc('\\', file);
+		if ((unsigned char)*c >= 0x20)
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+//Chrome trace event format, call once the recording threads are done
+inline bool WriteChromeTrace(const char* filename)
+{
+	FILE* file = fopen(filename, "w");
+	if (!file) {
+		printf("ERROR::PROFILER::FILE_NOT_WRITTEN %s\n", filename);
+		return false;
+	}
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	size_t count = 0;
+	for (const ThreadTrace* trace = gThreadTraces.load(std::memory_order_acquire); trace; trace = trace->next) {
+		fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", trace->id);
+		WriteJsonString(file, trace->name.c_str());
+		fprintf(file, "}}");
+		first = false;
+		for (const TraceEvent& event : trace->events) {
+			fprintf(file, ",\n{\"ph\":\"X\",\"cat\":\"cpu\",\"name\":");
+			WriteJsonString(file, event.name);
+			fprintf(file, ",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld", trace->id, (long long)event.startUs, (long long)event.durationUs);
+			if (event.detail) {
+				fprintf(file, ",\"args\":{\"detail\":");
+				WriteJsonString(file, event.detail);
+				fprintf(file, "}");
+			}
+			fprintf(file, "}");
+		}
+		count += trace->events.size();
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+	printf("INFO: %zu trace events written to %s\n", count, filename);
+	return true;
+}
+
+#endif
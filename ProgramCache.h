@@ -0,0 +1,160 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+/*
+* On-disk cache of linked program binaries (glGetProgramBinary / glProgramBinary).
+* A binary is keyed by a 64 bit FNV-1a hash of the shader sources plus the GL vendor, renderer and version
+* strings, so a driver update or a source edit simply misses. Each file starts with a small header repeating
+* the key; a file whose header does not match, that is truncated, or that the driver rejects is deleted and
+* the program is compiled from source again.
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+const uint32_t PROGRAM_CACHE_MAGIC = 0x42504354; //"TCPB"
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+struct ProgramCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;	//Binary format returned by glGetProgramBinary
+	uint32_t length;	//Bytes of binary following the header
+};
+
+struct ProgramCacheStats {
+	int hits = 0;
+	int misses = 0;
+	int rejected = 0;	//Files found but invalid or refused by the driver, deleted
+};
+
+//Directory holding the binaries, empty (the default) disables the cache
+inline std::string gProgramCacheDir;
+inline ProgramCacheStats gProgramCacheStats;
+
+inline uint64_t ProgramCacheHash(const char* text, uint64_t hash = 14695981039346656037ull)
+{
+	for (; text && *text; text++)
+		hash = (hash ^ (uint64_t)(unsigned char)*text) * 1099511628211ull;
+	return hash;
+}
+
+//Key of a program built from the given stages (null stages are skipped) on the current context's driver
+inline uint64_t ProgramCacheKey(const char* vertexSource, const char* fragmentSource, const char* geometrySource)
+{
+	const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+	uint64_t hash = ProgramCacheHash(nullptr);
+	for (GLenum name : driverStrings) {
+		hash = ProgramCacheHash((const char*)glGetString(name), hash);
+		hash = ProgramCacheHash("\n", hash); //Separator, "ab"+"c" must not equal "a"+"bc"
+	}
+	for (const char* source : { vertexSource, fragmentSource, geometrySource }) {
+		hash = ProgramCacheHash(source, hash);
+		hash = ProgramCacheHash("\n", hash);
+	}
+	return hash;
+}
+
+//False when the cache is off or the driver exposes no binary format
+inline bool ProgramCacheAvailable()
+{
+	if (gProgramCacheDir.empty())
+		return false;
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+inline std::string ProgramCachePath(uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+	return (std::filesystem::path(gProgramCacheDir) / name).string();
+}
+
+inline void RemoveProgramBinary(const std::string& path)
+{
+	std::error_code error;
+	std::filesystem::remove(path, error);
+	gProgramCacheStats.rejected++;
+}
+
+//Loads the cached binary into program, true when the program is linked and ready to use
+inline bool LoadProgramBinary(GLuint program, uint64_t key)
+{
+	if (!ProgramCacheAvailable())
+		return false;
+	const std::string path = ProgramCachePath(key);
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file) {
+		gProgramCacheStats.misses++;
+		return false;
+	}
+	ProgramCacheHeader header = {};
+	std::vector<char> binary;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1
+		&& header.magic == PROGRAM_CACHE_MAGIC && header.version == PROGRAM_CACHE_VERSION && header.key == key;
+	if (valid) {
+		binary.resize(header.length);
+		valid = header.length > 0 && fread(binary.data(), 1, binary.size(), file) == binary.size();
+	}
+	fclose(file);
+	if (valid) {
+		glProgramBinary(program, (GLenum)header.format, binary.data(), (GLsizei)binary.size());
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		valid = linked == GL_TRUE;
+	}
+	if (!valid) {
+		std::cout << "WARNING::PROGRAM_CACHE::BINARY_REJECTED " << path << ", compiling from source" << std::endl;
+		RemoveProgramBinary(path);
+		gProgramCacheStats.misses++;
+		return false;
+	}
+	gProgramCacheStats.hits++;
+	return true;
+}
+
+//Writes the binary of a linked program, through a temporary file so a crash never leaves half a binary behind
+inline bool StoreProgramBinary(GLuint program, uint64_t key)
+{
+	if (!ProgramCacheAvailable())
+		return false;
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return false;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+
+	std::error_code error;
+	std::filesystem::create_directories(gProgramCacheDir, error);
+	const std::string path = ProgramCachePath(key);
+	const std::string temporary = path + ".tmp";
+	FILE* file = fopen(temporary.c_str(), "wb");
+	if (!file) {
+		std::cout << "ERROR::PROGRAM_CACHE::FILE_NOT_WRITTEN " << temporary << std::endl;
+		return false;
+	}
+	const ProgramCacheHeader header = { PROGRAM_CACHE_MAGIC, PROGRAM_CACHE_VERSION, key, (uint32_t)format, (uint32_t)length };
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(binary.data(), 1, (size_t)length, file) == (size_t)length;
+	written = fclose(file) == 0 && written;
+	if (written)
+		std::filesystem::rename(temporary, path, error);
+	if (!written || error) {
+		std::cout << "ERROR::PROGRAM_CACHE::FILE_NOT_WRITTEN " << path << std::endl;
+		std::filesystem::remove(temporary, error);
+		return false;
+	}
+	return true;
+}
+
+#endif
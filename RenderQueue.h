@@ -0,0 +1,363 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+/*
+* Sorted render queue.
+* Draw functions no longer touch GL: they push a DrawItem (program, mesh, material id, transform and up to three
+* glDrawArrays ranges) with a 64 bit sort key, the queue is radix sorted once per frame and a single pass
+* submits it, changing the program and textures only where the sorted key changes.
+* Key layout, most significant first:
+*   layer 4 bits | program 8 bits | texture set 16 bits | mesh 12 bits | depth 24 bits
+* so items sharing state end up next to each other, and within the same state opaque objects go front to back.
+* Runs of sorted items that differ only by their transform (the 4 tires, the 32 spokes) become one RenderBatch:
+* their transforms are laid out back to back in the instance buffer.
+* Every mesh lives in one shared vertex buffer, so batches of the same layer, program and texture set only differ
+* by their vertex range, transforms and material scalars: buildPasses() turns each batch range into an indirect
+* command plus a RenderDraw record (first instance, material) and groups the commands into RenderPasses, each
+* drawn with one glMultiDrawArraysIndirect. A pass holds a single primitive mode, the one thing a multi-draw
+* cannot vary, so the number of draw calls depends on the scene's materials and not on how many cars it holds.
+* Layers order passes whose result depends on draw order: outlines drawn over coplanar faces with GL_LESS only
+* show when the faces went first.
+* Items may belong to an occlusion group (OcclusionQueries.h). sort() then keeps each group's items together, the
+* ungrouped ones first, and neither batches nor passes cross a group: its passes are drawn under one condition.
+* Every item also names the part of the scene it draws (RenderCategory). With splitCategories set (--gpu-profile)
+* sort() keeps each category's items together within a group and passes do not cross a category either, so the
+* submission can time each category in a GPU scope of its own; otherwise the category only keeps batches apart.
+* Nothing here calls GL, the handles are plain integers and the submission lives with the renderer.
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Materials.h"
+#include "MeshGen.h"
+#include "NormalMatrix.h"
+
+//One glDrawArrays call
+struct DrawRange {
+	uint32_t mode;
+	uint32_t first;
+	uint32_t count;
+};
+
+const int DRAW_ITEM_MAX_RANGES = 3;
+
+//Where a mesh's vertices are: its VAO, the offset of its first vertex there and a small id the sort groups by
+struct MeshRef {
+	uint32_t vao = 0;
+	uint32_t id = 0;
+	uint32_t firstVertex = 0;
+	MeshBounds bounds;	//Of every vertex of the mesh, in its own space
+};
+
+struct DrawItem {
+	uint32_t layer;	//RenderLayer
+	uint32_t program;	//Caller's program key, the light shader variant's features
+	uint32_t vao;
+	uint32_t mesh;	//MeshRef::id
+	MaterialId material;	//Index in the MaterialTable the queue was cleared with
+	uint32_t transform;	//Index in RenderQueue::transforms
+	bool uniformScale;	//Transform built from rotations and one uniform scale, see NormalMatrixUniformScale
+	uint32_t group;	//Occlusion group, 0 for none
+	uint32_t category;	//RenderCategory
+	int rangeCount;
+	DrawRange ranges[DRAW_ITEM_MAX_RANGES];	//First vertices relative to the VAO, the mesh offset included
+};
+
+//Per-instance transform in the light shader's InstanceBlock (std430): the model and the normal matrix,
+//its columns padded to 16 bytes
+struct RenderInstance {
+	glm::mat4 model;
+	glm::vec4 normal[3];
+};
+static_assert(sizeof(RenderInstance) == 112, "RenderInstance layout");
+
+//Sorted items drawn together: the first item's state and ranges, instanceCount transforms from baseInstance
+struct RenderBatch {
+	uint32_t item;
+	uint32_t baseInstance;
+	uint32_t instanceCount;
+};
+
+//Per-command record in the light shader's DrawBlock (std430), read as draws[drawBase + gl_DrawID]
+struct RenderDraw {
+	uint32_t firstInstance;	//Index of the command's first instance among those buildBatches() wrote
+	uint32_t material;	//MaterialId, index in the material buffer
+	uint32_t pad[2];
+};
+static_assert(sizeof(RenderDraw) == 16, "RenderDraw layout");
+
+//Command layout glMultiDrawArraysIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawArraysIndirectCommand {
+	uint32_t count;
+	uint32_t instanceCount;
+	uint32_t first;
+	uint32_t baseInstance;	//Always 0, the instance comes from RenderDraw::firstInstance
+};
+
+//Commands drawn by one multi-draw: same layer, program, VAO, texture set, occlusion group and primitive mode, and
+//the same category when the queue splits them
+struct RenderPass {
+	uint32_t item;	//Item whose program, VAO and textures the pass uses
+	uint32_t mode;
+	uint32_t firstCommand;	//Index in RenderQueue::commands and RenderQueue::draws
+	uint32_t commandCount;
+};
+
+//What the radix sort moves around: the key and the item it belongs to
+struct RenderSortEntry {
+	uint64_t key;
+	uint32_t item;
+};
+
+//24 bit depth: the bit pattern of a non-negative float grows with its value, its top 24 bits keep the order
+inline uint32_t RenderSortDepth(float depth)
+{
+	if (!(depth > 0.0f))
+		return 0;
+	uint32_t bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	return bits >> 7;
+}
+
+//Passes in submission order
+enum RenderLayer {
+	RENDER_LAYER_OPAQUE,
+	RENDER_LAYER_OUTLINE,	//Lines over opaque faces at the same depth
+};
+
+//Part of the scene an item draws, each timed on its own with --gpu-profile, in submission order when split
+enum RenderCategory {
+	RENDER_CATEGORY_GROUND,
+	RENDER_CATEGORY_WING,
+	RENDER_CATEGORY_WHEELS,
+	RENDER_CATEGORY_CAR,	//The car body
+};
+const int RENDER_CATEGORY_COUNT = 4;
+const char* const RENDER_CATEGORY_NAMES[RENDER_CATEGORY_COUNT] = { "ground", "wing", "wheels", "car" };
+
+inline uint64_t RenderSortKey(uint32_t layer, uint32_t program, uint32_t textureSet, uint32_t mesh, float depth)
+{
+	return ((uint64_t)(layer & 0xf) << 60) | ((uint64_t)(program & 0xff) << 52) | ((uint64_t)(textureSet & 0xffff) << 36)
+		| ((uint64_t)(mesh & 0xfff) << 24) | RenderSortDepth(depth);
+}
+
+//Below this many entries clearing and scanning the histograms costs more than a comparison sort
+const size_t RADIX_SORT_MIN_ENTRIES = 256;
+
+//LSD radix sort on 8 bit digits, stable. All eight histograms are built in one read of the keys and digits
+//every key shares (the program byte of a one-shader scene, the high depth bits) are skipped.
+inline void RadixSortEntries(std::vector<RenderSortEntry>& entries, std::vector<RenderSortEntry>& scratch)
+{
+	const size_t count = entries.size();
+	if (count < RADIX_SORT_MIN_ENTRIES) {
+		std::stable_sort(entries.begin(), entries.end(), [](const RenderSortEntry& a, const RenderSortEntry& b) { return a.key < b.key; });
+		return;
+	}
+	uint32_t histograms[8][256] = {};
+	for (const RenderSortEntry& entry : entries)
+		for (int digit = 0; digit < 8; digit++)
+			histograms[digit][(entry.key >> (digit * 8)) & 0xff]++;
+
+	scratch.resize(count);
+	RenderSortEntry* source = entries.data();
+	RenderSortEntry* target = scratch.data();
+	for (int digit = 0; digit < 8; digit++) {
+		uint32_t* histogram = histograms[digit];
+		if (histogram[(source[0].key >> (digit * 8)) & 0xff] == count)
+			continue;
+		uint32_t offset = 0;
+		for (int bucket = 0; bucket < 256; bucket++) {
+			const uint32_t bucketCount = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += bucketCount;
+		}
+		for (size_t i = 0; i < count; i++)
+			target[histogram[(source[i].key >> (digit * 8)) & 0xff]++] = source[i];
+		std::swap(source, target);
+	}
+	if (source != entries.data())
+		entries.swap(scratch);
+}
+
+struct RenderQueue {
+	std::vector<DrawItem> items;
+	std::vector<glm::mat4> transforms;
+	std::vector<RenderSortEntry> order;	//Submission order after sort()
+	std::vector<RenderSortEntry> scratch;
+	uint32_t groupCount = 0;	//Highest occlusion group pushed
+	std::vector<uint32_t> groupOffsets;	//Scratch of the group and category passes of sort()
+	bool splitCategories = false;	//Keep categories in passes of their own, for timing them
+	std::vector<RenderBatch> batches;	//Built by buildBatches() from the sorted order
+	uint32_t instanceCount = 0;	//Transforms buildBatches() wrote, one per item
+	std::vector<RenderPass> passes;	//Built by buildPasses()
+	std::vector<DrawArraysIndirectCommand> commands;	//Commands of the passes, back to back
+	std::vector<RenderDraw> draws;	//One per command
+	const MaterialTable* materials = nullptr;	//Materials the items refer to
+	glm::vec3 viewPos = glm::vec3(0.0f);	//Depth of an item is its origin's distance from here
+
+	//Starts a frame seen from eye, drawing with materials from table
+	void clear(const glm::vec3& eye, const MaterialTable& table)
+	{
+		items.clear();
+		transforms.clear();
+		order.clear();
+		groupCount = 0;
+		batches.clear();
+		instanceCount = 0;
+		passes.clear();
+		commands.clear();
+		draws.clear();
+		viewPos = eye;
+		materials = &table;
+	}
+
+	//Queues mesh drawn with ranges, whose first vertices count from the mesh's first vertex
+	void push(uint32_t program, const MeshRef& mesh, MaterialId material, const glm::mat4& model, bool uniformScale, std::initializer_list<DrawRange> ranges, uint32_t layer = RENDER_LAYER_OPAQUE, uint32_t group = 0, uint32_t category = RENDER_CATEGORY_CAR)
+	{
+		push(program, mesh, material, model, uniformScale, ranges.begin(), (int)ranges.size(), layer, group, category);
+	}
+
+	void push(uint32_t program, const MeshRef& mesh, MaterialId material, const glm::mat4& model, bool uniformScale, const DrawRange* ranges, int rangeCount, uint32_t layer = RENDER_LAYER_OPAQUE, uint32_t group = 0, uint32_t category = RENDER_CATEGORY_CAR)
+	{
+		DrawItem item = {};
+		item.layer = layer;
+		item.program = program;
+		item.vao = mesh.vao;
+		item.mesh = mesh.id;
+		item.material = material;
+		item.transform = (uint32_t)transforms.size();
+		item.uniformScale = uniformScale;
+		item.group = group;
+		item.category = category;
+		groupCount = std::max(groupCount, group);
+		for (int i = 0; i < rangeCount && item.rangeCount < DRAW_ITEM_MAX_RANGES; i++)
+			item.ranges[item.rangeCount++] = { ranges[i].mode, mesh.firstVertex + ranges[i].first, ranges[i].count };
+		transforms.push_back(model);
+
+		const float depth = glm::length(glm::vec3(model[3]) - viewPos);
+		order.push_back({ RenderSortKey(layer, program, (*materials)[material].textureSet, mesh.id, depth), (uint32_t)items.size() });
+		items.push_back(item);
+	}
+
+	void sort()
+	{
+		RadixSortEntries(order, scratch);
+		//Stable counting passes, the category first so the group ends up on top: items stay in key order
+		if (splitCategories)
+			sortBy(RENDER_CATEGORY_COUNT, &DrawItem::category);
+		if (groupCount > 0)
+			sortBy(groupCount + 1, &DrawItem::group);
+	}
+
+	//Stable counting sort of order on field, whose values are below bucketCount
+	void sortBy(uint32_t bucketCount, uint32_t DrawItem::* field)
+	{
+		groupOffsets.assign(bucketCount, 0);
+		for (const RenderSortEntry& entry : order)
+			groupOffsets[items[entry.item].*field]++;
+		uint32_t offset = 0;
+		for (uint32_t& bucketOffset : groupOffsets) {
+			const uint32_t bucketItems = bucketOffset;
+			bucketOffset = offset;
+			offset += bucketItems;
+		}
+		scratch.resize(order.size());
+		for (const RenderSortEntry& entry : order)
+			scratch[groupOffsets[items[entry.item].*field]++] = entry;
+		order.swap(scratch);
+	}
+
+	//Groups the sorted items into batches and writes their instances, normal matrices included, to
+	//instances, which holds one per item. Each is written whole and in order, never read back: instances may
+	//point into write-combined GPU memory.
+	void buildBatches(RenderInstance* instances)
+	{
+		batches.clear();
+		instanceCount = 0;
+		for (const RenderSortEntry& entry : order) {
+			const DrawItem& item = items[entry.item];
+			if (batches.empty() || !sameBatch(items[batches.back().item], item))
+				batches.push_back({ entry.item, instanceCount, 0 });
+			batches.back().instanceCount++;
+
+			const glm::mat4& model = transforms[item.transform];
+			const glm::mat3 normal = item.uniformScale ? NormalMatrixUniformScale(model) : NormalMatrix(model);
+			RenderInstance instance;
+			instance.model = model;
+			for (int column = 0; column < 3; column++)
+				instance.normal[column] = glm::vec4(normal[column], 0.0f);
+			instances[instanceCount++] = instance;
+		}
+	}
+
+	//Builds the batches, then one command and draw record per batch range, grouped into passes.
+	//Within a run of batches sharing a pass's state the commands go mode by mode, each mode in the order it first
+	//appears; only draws of different primitive modes swap places, and those are distinct meshes.
+	void buildPasses(RenderInstance* instances)
+	{
+		buildBatches(instances);
+		passes.clear();
+		commands.clear();
+		draws.clear();
+		size_t runStart = 0;
+		while (runStart < batches.size()) {
+			const DrawItem& first = items[batches[runStart].item];
+			size_t runEnd = runStart + 1;
+			while (runEnd < batches.size() && samePass(first, items[batches[runEnd].item]))
+				runEnd++;
+
+			uint64_t modesDone = 0;	//GL primitive modes are below 64
+			for (size_t b = runStart; b < runEnd; b++) {
+				const DrawItem& item = items[batches[b].item];
+				for (int r = 0; r < item.rangeCount; r++) {
+					const uint32_t mode = item.ranges[r].mode;
+					if (modesDone & (1ull << mode))
+						continue;
+					modesDone |= 1ull << mode;
+					RenderPass pass = { batches[runStart].item, mode, (uint32_t)commands.size(), 0 };
+					for (size_t c = b; c < runEnd; c++) {
+						const RenderBatch& batch = batches[c];
+						const DrawItem& other = items[batch.item];
+						for (int i = 0; i < other.rangeCount; i++) {
+							const DrawRange& range = other.ranges[i];
+							if (range.mode != mode)
+								continue;
+							commands.push_back({ range.count, batch.instanceCount, range.first, 0 });
+							draws.push_back({ batch.baseInstance, other.material, { 0, 0 } });
+							pass.commandCount++;
+						}
+					}
+					passes.push_back(pass);
+				}
+			}
+			runStart = runEnd;
+		}
+	}
+
+	//Items whose commands can go into the same multi-draw, given the same primitive mode
+	bool samePass(const DrawItem& a, const DrawItem& b) const
+	{
+		return a.layer == b.layer && a.program == b.program && a.vao == b.vao && a.group == b.group
+			&& (!splitCategories || a.category == b.category) && (*materials)[a.material].textureSet == (*materials)[b.material].textureSet;
+	}
+
+	//Items that can share one instanced draw: everything but the transform is equal
+	static bool sameBatch(const DrawItem& a, const DrawItem& b)
+	{
+		if (a.layer != b.layer || a.program != b.program || a.vao != b.vao || a.group != b.group || a.category != b.category || a.material != b.material || a.rangeCount != b.rangeCount)
+			return false;
+		for (int i = 0; i < a.rangeCount; i++)
+			if (a.ranges[i].mode != b.ranges[i].mode || a.ranges[i].first != b.ranges[i].first || a.ranges[i].count != b.ranges[i].count)
+				return false;
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef SAMPLERS_H
+#define SAMPLERS_H
+
+/*
+* Prebuilt sampler objects, one per wrap mode and filter.
+* A sampler bound to a texture unit overrides the sampling parameters of whatever texture is bound there, so
+* materials choose how their maps are sampled with one glBindSampler instead of glTexParameteri on the texture:
+* texture objects stay untouched after they are uploaded and the driver has nothing to revalidate at draw time.
+* The anisotropic filter is trilinear plus the largest anisotropy the driver allows, up to SAMPLER_MAX_ANISOTROPY;
+* without GL_ARB/EXT_texture_filter_anisotropic it falls back to plain trilinear.
+*/
+
+#include <cstring>
+#include <iostream>
+
+enum SamplerWrap {
+	SAMPLER_WRAP_REPEAT,
+	SAMPLER_WRAP_MIRRORED,
+	SAMPLER_WRAP_CLAMP,
+	SAMPLER_WRAP_COUNT
+};
+
+enum SamplerFilter {
+	SAMPLER_FILTER_LINEAR,	//Bilinear on the base level, what the textures were always sampled with
+	SAMPLER_FILTER_TRILINEAR,	//Bilinear between the two nearest mipmaps
+	SAMPLER_FILTER_ANISOTROPIC,	//Trilinear with anisotropic filtering
+	SAMPLER_FILTER_COUNT
+};
+
+const int SAMPLER_COUNT = SAMPLER_WRAP_COUNT * SAMPLER_FILTER_COUNT;
+const float SAMPLER_MAX_ANISOTROPY = 16.0f;
+
+//Index of a sampler in SamplerSet::samplers, what materials store
+inline uint32_t SamplerIndex(SamplerWrap wrap, SamplerFilter filter)
+{
+	return (uint32_t)(wrap * SAMPLER_FILTER_COUNT + filter);
+}
+
+struct SamplerSet {
+	GLuint samplers[SAMPLER_COUNT] = {};
+	float anisotropy = 1.0f;	//Level of the anisotropic samplers, 1 when unsupported
+};
+
+inline bool SamplerAnisotropySupported()
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (name && (strcmp(name, "GL_ARB_texture_filter_anisotropic") == 0 || strcmp(name, "GL_EXT_texture_filter_anisotropic") == 0))
+			return true;
+	}
+	return false;
+}
+
+inline void CreateSamplers(SamplerSet& set)
+{
+	const GLint wraps[SAMPLER_WRAP_COUNT] = { GL_REPEAT, GL_MIRRORED_REPEAT, GL_CLAMP_TO_EDGE };
+	set.anisotropy = 1.0f;
+	if (SamplerAnisotropySupported()) {
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &set.anisotropy);
+		if (set.anisotropy > SAMPLER_MAX_ANISOTROPY)
+			set.anisotropy = SAMPLER_MAX_ANISOTROPY;
+	}
+	else
+		std::cout << "WARNING::SAMPLERS::NO_ANISOTROPY anisotropic samplers are trilinear" << std::endl;
+
+	glGenSamplers(SAMPLER_COUNT, set.samplers);
+	for (int wrap = 0; wrap < SAMPLER_WRAP_COUNT; wrap++) {
+		for (int filter = 0; filter < SAMPLER_FILTER_COUNT; filter++) {
+			const GLuint sampler = set.samplers[SamplerIndex((SamplerWrap)wrap, (SamplerFilter)filter)];
+			glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, wraps[wrap]);
+			glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, wraps[wrap]);
+			glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, filter == SAMPLER_FILTER_LINEAR ? GL_LINEAR : GL_LINEAR_MIPMAP_LINEAR);
+			if (filter == SAMPLER_FILTER_ANISOTROPIC && set.anisotropy > 1.0f)
+				glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY, set.anisotropy);
+		}
+	}
+}
+
+inline void DestroySamplers(SamplerSet& set)
+{
+	glDeleteSamplers(SAMPLER_COUNT, set.samplers);
+	set = SamplerSet();
+}
+
+#endif
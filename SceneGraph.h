@@ -0,0 +1,244 @@
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+/*
+* Scene graph with cached transforms.
+* Every node has a local matrix relative to its parent and caches its world matrix. Nodes sit in one vector
+* in creation order and a parent is always created before its children, so a forward pass sees every parent's
+* world matrix before its children's, and every node's subtree lies within [node, subtreeEnd). setLocal marks a
+* node dirty and records it; update() walks only the recorded nodes' ranges, recomputing the world matrices of
+* dirty nodes and of everything under them, so moving one car touches that car's subtree and its draws, found
+* through each node's list of draws. A scene where nothing moved costs nothing.
+* Draws hang off nodes: a SceneDraw is what the render queue needs besides the transform (mesh, material,
+* ranges, layer), and submit() pushes each with its node's cached world matrix.
+* update() also moves the world bounding sphere of every draw whose node moved, kept as structure-of-arrays for
+* cull() (Culling.h), whose worker threads the graph keeps; submit() skips the draws the last cull() found outside
+* the frustum.
+* A root node may open an occlusion group that everything under it belongs to (a car); boundGroups() boxes each
+* group's visible spheres for its occlusion query, and submit() tags the group's draws so they are drawn together.
+* Nothing here calls GL.
+*/
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+#include "RenderQueue.h"
+
+typedef uint32_t SceneNodeId;
+const SceneNodeId SCENE_NO_PARENT = UINT32_MAX;
+const uint32_t SCENE_NO_DRAW = UINT32_MAX;
+
+struct SceneNode {
+	SceneNodeId parent = SCENE_NO_PARENT;
+	glm::mat4 local = glm::mat4(1.0f);
+	glm::mat4 world = glm::mat4(1.0f);	//parent's world * local, valid after update()
+	bool dirty = true;	//local changed since the last update()
+	uint32_t movedPass = 0;	//update() pass that last recomputed world, children compare it with the current one
+	uint32_t group = 0;	//Occlusion group, 0 for none
+	SceneNodeId subtreeEnd = 0;	//One past the last node under this one, nodes of other subtrees may lie between
+	uint32_t firstDraw = SCENE_NO_DRAW;	//Draws at this node, linked through SceneDraw::nextDraw
+};
+
+//Mesh drawn at a node: ranges are relative to the mesh's first vertex, as RenderQueue::push takes them
+struct SceneDraw {
+	SceneNodeId node;
+	MeshRef mesh;
+	MaterialId material;
+	uint32_t layer;	//RenderLayer
+	uint32_t group;	//Its node's occlusion group
+	uint32_t category;	//RenderCategory
+	uint32_t nextDraw;	//Next draw at the same node, SCENE_NO_DRAW after the last
+	bool uniformScale;	//World built from rotations, translations and one uniform scale, see NormalMatrixUniformScale
+	int rangeCount;
+	DrawRange ranges[DRAW_ITEM_MAX_RANGES];
+};
+
+//World box around the visible draws of an occlusion group, empty (min > max) when none is
+struct SceneBox {
+	glm::vec3 min;
+	glm::vec3 max;
+
+	bool empty() const
+	{
+		return min.x > max.x;
+	}
+
+	//point lies within margin of the box
+	bool contains(const glm::vec3& point, float margin) const
+	{
+		return glm::all(glm::greaterThanEqual(point, min - margin)) && glm::all(glm::lessThanEqual(point, max + margin));
+	}
+};
+
+struct SceneGraph {
+	std::vector<SceneNode> nodes;
+	std::vector<SceneDraw> draws;
+	uint32_t updatedNodes = 0;	//World matrices the last update() recomputed
+	uint32_t pass = 0;	//update() calls so far
+	std::vector<SceneNodeId> dirtyNodes;	//Nodes marked dirty since the last update(), each once
+	CullingSpheres spheres;	//World bounding sphere of each draw, index for index
+	std::vector<uint8_t> visible;	//Bit i % 8 of byte i / 8 set when draw i is drawn
+	uint32_t visibleDraws = 0;	//Draws the last cull() kept
+	uint32_t groupCount = 0;	//Highest occlusion group of any node
+	std::vector<SceneBox> groupBoxes;	//Built by boundGroups(), indexed by group, entry 0 unused
+	std::unique_ptr<CullWorkers> cullWorkers = std::unique_ptr<CullWorkers>(new CullWorkers());	//Threads of cull(), kept from frame to frame
+
+	//A node without a group takes its parent's, group 0 is none
+	SceneNodeId addNode(SceneNodeId parent, const glm::mat4& local, uint32_t group = 0)
+	{
+		SceneNode node;
+		node.parent = parent;
+		node.local = local;
+		node.group = (group || parent == SCENE_NO_PARENT) ? group : nodes[parent].group;
+		groupCount = std::max(groupCount, node.group);
+		const SceneNodeId id = (SceneNodeId)nodes.size();
+		node.subtreeEnd = id + 1;
+		nodes.push_back(node);
+		for (SceneNodeId ancestor = parent; ancestor != SCENE_NO_PARENT; ancestor = nodes[ancestor].parent)
+			nodes[ancestor].subtreeEnd = id + 1;
+		dirtyNodes.push_back(id);
+		return id;
+	}
+
+	void addDraw(SceneNodeId node, const MeshRef& mesh, MaterialId material, bool uniformScale, std::initializer_list<DrawRange> ranges, uint32_t layer = RENDER_LAYER_OPAQUE, uint32_t category = RENDER_CATEGORY_CAR)
+	{
+		SceneDraw draw = {};
+		draw.node = node;
+		draw.mesh = mesh;
+		draw.material = material;
+		draw.layer = layer;
+		draw.group = nodes[node].group;
+		draw.category = category;
+		draw.nextDraw = nodes[node].firstDraw;
+		nodes[node].firstDraw = (uint32_t)draws.size();
+		draw.uniformScale = uniformScale;
+		for (const DrawRange& range : ranges)
+			if (draw.rangeCount < DRAW_ITEM_MAX_RANGES)
+				draw.ranges[draw.rangeCount++] = range;
+		draws.push_back(draw);
+		//Its sphere is placed by the next update()
+		markDirty(node);
+	}
+
+	void setLocal(SceneNodeId node, const glm::mat4& local)
+	{
+		nodes[node].local = local;
+		markDirty(node);
+	}
+
+	void markDirty(SceneNodeId node)
+	{
+		if (!nodes[node].dirty)
+			dirtyNodes.push_back(node);
+		nodes[node].dirty = true;
+	}
+
+	const glm::mat4& world(SceneNodeId node) const
+	{
+		return nodes[node].world;
+	}
+
+	//Recomputes the world matrices of dirty nodes and their subtrees, and the spheres of their draws
+	void update()
+	{
+		updatedNodes = 0;
+		if (dirtyNodes.empty())
+			return;
+		pass++;
+		//Draws added since the last pass start the arrays over, all visible until culled
+		const bool allDraws = spheres.count != draws.size();
+		if (allDraws) {
+			spheres.resize(draws.size());
+			showAll();
+		}
+		//In node order the ranges of the dirty nodes go parents first; a range inside a walked one is skipped
+		std::sort(dirtyNodes.begin(), dirtyNodes.end());
+		SceneNodeId walked = 0;
+		for (SceneNodeId dirty : dirtyNodes) {
+			const SceneNodeId end = nodes[dirty].subtreeEnd;
+			for (SceneNodeId i = std::max(dirty, walked); i < end; i++)
+				updateNode(i, !allDraws);
+			walked = std::max(walked, end);
+		}
+		dirtyNodes.clear();
+
+		if (!allDraws)
+			return;
+		for (size_t i = 0; i < draws.size(); i++)
+			placeSphere((uint32_t)i);
+	}
+
+	//Recomputes node's world matrix when it or its parent moved in this pass, and its draws' spheres if moveSpheres
+	void updateNode(SceneNodeId id, bool moveSpheres)
+	{
+		SceneNode& node = nodes[id];
+		const SceneNode* parent = node.parent == SCENE_NO_PARENT ? nullptr : &nodes[node.parent];
+		if (!node.dirty && !(parent && parent->movedPass == pass))
+			return;
+		node.world = parent ? parent->world * node.local : node.local;
+		node.dirty = false;
+		node.movedPass = pass;
+		updatedNodes++;
+		for (uint32_t draw = node.firstDraw; moveSpheres && draw != SCENE_NO_DRAW; draw = draws[draw].nextDraw)
+			placeSphere(draw);
+	}
+
+	//World sphere of draw i from its node's world matrix
+	void placeSphere(uint32_t i)
+	{
+		const SceneDraw& draw = draws[i];
+		glm::vec3 center;
+		float radius;
+		TransformSphere(nodes[draw.node].world, draw.mesh.bounds.center, draw.mesh.bounds.radius, center, radius);
+		spheres.set(i, center, radius);
+	}
+
+	//Keeps the draws whose sphere intersects frustum, tested on up to threads threads
+	void cull(const FrustumPlanes& frustum, unsigned threads)
+	{
+		CullSpheresThreaded(frustum, spheres, visible.data(), threads, *cullWorkers);
+		visibleDraws = 0;
+		for (size_t i = 0; i < draws.size(); i++)
+			visibleDraws += (visible[i >> 3] >> (i & 7)) & 1;
+	}
+
+	void showAll()
+	{
+		visible.assign(spheres.groups(), 0xff);
+		visibleDraws = (uint32_t)draws.size();
+	}
+
+	//Boxes the world spheres of each group's visible draws
+	void boundGroups()
+	{
+		groupBoxes.assign(groupCount + 1, { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) });
+		for (size_t i = 0; i < draws.size(); i++) {
+			const uint32_t group = draws[i].group;
+			if (!group || !((visible[i >> 3] >> (i & 7)) & 1))
+				continue;
+			const glm::vec3 center(spheres.x[i], spheres.y[i], spheres.z[i]);
+			const float radius = spheres.radius[i];
+			groupBoxes[group].min = glm::min(groupBoxes[group].min, center - radius);
+			groupBoxes[group].max = glm::max(groupBoxes[group].max, center + radius);
+		}
+	}
+
+	//Pushes every visible draw with its node's world matrix, drawn with the light shader variant program
+	void submit(RenderQueue& queue, uint32_t program) const
+	{
+		for (size_t i = 0; i < draws.size(); i++) {
+			const SceneDraw& draw = draws[i];
+			if ((visible[i >> 3] >> (i & 7)) & 1)
+				queue.push(program, draw.mesh, draw.material, nodes[draw.node].world, draw.uniformScale, draw.ranges, draw.rangeCount, draw.layer, draw.group, draw.category);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef SHADERVARIANTS_H
+#define SHADERVARIANTS_H
+
+/*
+* Feature flags of the light shader. A variant key is a set of flags; every flag becomes a
+* "#define NAME 0|1" line inserted right after the #version line of both stages, and the GLSL branches on
+* those constants so the compiler strips the lighting a variant does not use.
+* The GLSL() macro stringifies its argument, so the shader bodies cannot hold #ifdef themselves.
+* The same goes for #extension: lines that depend on the driver rather than the variant, such as where DRAW_ID
+* comes from, are passed in as a prelude and go in front of the feature defines.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+enum ShaderFeature : uint32_t {
+	LIGHT_DIR = 1u << 0,	//Directional light from LightBlock
+	LIGHT_POINT = 1u << 1,	//Point light preset chosen with pointLightIndex
+	LIGHT_SPOT = 1u << 2,	//Flashlight following the camera (spotLight uniforms)
+	SPECULAR_MAP = 1u << 3,	//Specular term sampled from material.specular, matte without it
+	TEXTURE_ARRAY = 1u << 4,	//Maps are layers of textureArrays[] named by the material buffer (TextureArrays.h)
+};
+
+//Flags above, feature i is bit 1 << i
+const int SHADER_FEATURE_COUNT = 5;
+
+const char* const SHADER_FEATURE_NAMES[SHADER_FEATURE_COUNT] = { "LIGHT_DIR", "LIGHT_POINT", "LIGHT_SPOT", "SPECULAR_MAP", "TEXTURE_ARRAY" };
+
+//No light at all: the diffuse texture as is
+const uint32_t SHADING_UNLIT = 0;
+
+//DRAW_ID, the index of the command within a multi-draw: gl_DrawIDARB with GL_ARB_shader_draw_parameters,
+//otherwise 0 and the renderer issues one draw per command, moving the drawBase uniform instead
+inline std::string ShaderDrawIdPrelude(bool drawParameters)
+{
+	if (drawParameters)
+		return "#extension GL_ARB_shader_draw_parameters : require\n#define DRAW_ID gl_DrawIDARB\n";
+	return "#define DRAW_ID 0\n";
+}
+
+//Source with prelude and the feature defines inserted after its first line, which must be the #version directive
+inline std::string InjectShaderFeatures(const char* source, uint32_t features, const std::string& prelude = std::string())
+{
+	const char* body = strchr(source, '\n');
+	body = body ? body + 1 : source + strlen(source);
+	std::string result(source, body);
+	result += prelude;
+	for (int i = 0; i < SHADER_FEATURE_COUNT; i++) {
+		result += "#define ";
+		result += SHADER_FEATURE_NAMES[i];
+		result += (features & (1u << i)) ? " 1\n" : " 0\n";
+	}
+	result += body;
+	return result;
+}
+
+//Readable key for logs, e.g. "LIGHT_DIR|SPECULAR_MAP"
+inline std::string ShaderFeatureString(uint32_t features)
+{
+	std::string name;
+	for (int i = 0; i < SHADER_FEATURE_COUNT; i++) {
+		if (features & (1u << i)) {
+			if (!name.empty())
+				name += "|";
+			name += SHADER_FEATURE_NAMES[i];
+		}
+	}
+	return name.empty() ? "UNLIT" : name;
+}
+
+#endif
@@ -1,10 +1,20 @@
+#ifdef THECAR_NO_GLEW
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h> //Core profile prototypes, exported directly by libOpenGL (glvnd)
+#else
 #include <GL/glew.h> //GLEW Library
+#endif
+#ifndef THECAR_NO_GLFW
 #include <GLFW/glfw3.h> //GLFW Library
+#endif
+#include "GLStats.h" //Per-frame GL call counters, must follow the GL headers
 //IO Librarys
 #include <iostream> //cout, cerr
 #include <fstream> //ifstream
 #include <cstdlib> // EXIT_FAILURE
+#include <cstdio> //sscanf
 #include <string>
+#include <cstring> //strcmp
 #include <sstream>
 
 #define _USE_MATH_DEFINES
@@ -21,6 +31,33 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <chrono>
 #include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+#include <memory>
+#include <unordered_map>
+
+#include "Camera.h" //Fly camera
+#include "Uniforms.h" //Typed uniform handles
+#include "UniformBlocks.h" //std140 camera and light blocks
+#include "MeshGen.h" //Procedural mesh vertices
+#include "Image.h" //Texture data helpers
+#include "Headless.h" //Offscreen context and render target
+#include "Benchmark.h" //Scripted camera paths and result files
+#include "GpuProfiler.h" //GPU timer queries per render scope
+#include "Profiler.h" //CPU scopes exported as a Chrome trace
+#include "Golden.h" //Reference image poses and comparison
+#include "ProgramCache.h" //Linked program binaries kept between runs
+#include "ShaderVariants.h" //Feature defines of the light shader variants
+#include "FrameRing.h" //Persistently mapped per-frame data
+#include "SceneGraph.h" //Node hierarchy with cached world matrices
+#include "Assembly.h" //Rigid assemblies merged into one mesh per material
+#include "OcclusionQueries.h" //Car boxes tested for the next frame's conditional rendering
+#include "NormalMatrix.h" //Per-draw normal matrices
+#include "Materials.h" //Material table
+#include "Samplers.h" //Sampler objects per wrap mode and filter
+#include "TextureArrays.h" //Maps as layers of texture arrays
+#include "RenderQueue.h" //Sorted draw items
 
 
 //Fragment and Vertext Shaders
@@ -40,17 +77,43 @@ layout(location = 2) in vec2 textureCoordinate;
 out vec3 vertexNormal; // For outgoing normals to fragment shader
 out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
 out vec2 vertexTextureCoordinate;
+flat out uint vertexMaterial; // Index in MaterialBlock
 
-//Uniform / Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+//Camera, filled once per frame (FrameBlock in UniformBlocks.h)
+layout(std140, binding = 0) uniform FrameBlock {
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+//Per-instance transforms of the frame (RenderInstance in RenderQueue.h), the normal matrix is the inverse
+//transpose of the model's 3x3 computed once per instance on the CPU (NormalMatrix.h)
+struct Instance {
+	mat4 model;
+	vec4 normalMatrix[3];
+};
+layout(std430, binding = 0) readonly buffer InstanceBlock {
+	Instance instances[];
+};
+//One record per indirect command (RenderDraw in RenderQueue.h)
+struct Draw {
+	uint firstInstance;
+	uint material;
+	uvec2 pad;
+};
+layout(std430, binding = 1) readonly buffer DrawBlock {
+	Draw draws[];
+};
+uniform int drawBase; //Record of the multi-draw's first command, DRAW_ID counts from it
 
 void main()
 {
-	vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
-	vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
+	Draw draw = draws[drawBase + DRAW_ID];
+	Instance instance = instances[draw.firstInstance + uint(gl_InstanceID)];
+	mat3 normalMatrix = mat3(instance.normalMatrix[0].xyz, instance.normalMatrix[1].xyz, instance.normalMatrix[2].xyz);
+	vertexFragmentPos = vec3(instance.model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+	vertexNormal = normalMatrix * normal; // get normal vectors in world space only and exclude normal translation properties
 	vertexTextureCoordinate = textureCoordinate;
+	vertexMaterial = draw.material;
 
 	gl_Position = projection * view * vec4(vertexFragmentPos, 1.0f); // Transforms vertices into clip coordinates
 }
@@ -65,7 +128,6 @@ const GLchar* lightFragmentShaderSource = GLSL(440,
 struct Material {
 	sampler2D diffuse;
 	sampler2D specular;
-	float shininess;
 };
 
 struct DirLight {
@@ -106,13 +168,74 @@ struct SpotLight {
 in vec3 vertexFragmentPos;
 in vec3 vertexNormal;
 in vec2 vertexTextureCoordinate;
+flat in uint vertexMaterial;
 
-uniform vec3 viewPos;
-uniform DirLight dirLight;
-uniform PointLight pointLights;
+//Camera, filled once per frame (FrameBlock in UniformBlocks.h)
+layout(std140, binding = 0) uniform FrameBlock {
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+//Scene lights (LightBlock in UniformBlocks.h), the array length is POINT_LIGHT_PRESET_COUNT
+layout(std140, binding = 1) uniform LightBlock {
+	DirLight dirLight;
+	PointLight pointLights[4];
+};
+//Scalars of every material (MaterialRecord in Materials.h), indexed by the draw's material id
+struct MaterialParams {
+	vec2 uvScale;
+	float shininess;
+	int pointLightIndex; //Point light preset
+	uint diffuseLayer; //Array and layer of the maps in TEXTURE_ARRAY variants (TextureLayerIndex in TextureArrays.h)
+	uint specularLayer;
+	uint diffuseWrap; //Wrap mode the TEXTURE_ARRAY variants emulate (SamplerWrap in Samplers.h)
+	uint specularWrap;
+};
+layout(std430, binding = 2) readonly buffer MaterialBlock {
+	MaterialParams materials[];
+};
 uniform SpotLight spotLight;
 uniform Material material;
-uniform vec2 uvScale;
+//Texture arrays of TEXTURE_ARRAY variants, TEXTURE_ARRAY_MAX_COUNT of them from TEXTURE_ARRAY_FIRST_UNIT
+layout(binding = 2) uniform sampler2DArray textureArrays[8];
+//Of the fragment's material, set first thing in main()
+float shininess;
+vec3 diffuseColor;
+vec3 specularColor;
+
+// Coordinate a repeating sampler reads for wrap: mirrored coordinates are folded back into 0..1, mirrored and
+// clamped ones are kept half a texel inside the edges, where the hardware modes stop filtering
+vec2 WrapCoordinate(vec2 uv, uint wrap, vec2 size)
+{
+	if (wrap == 1u)
+		uv = 1.0 - abs(mod(uv, 2.0) - 1.0);
+	if (wrap != 0u)
+		uv = clamp(uv, 0.5 / size, 1.0 - 0.5 / size);
+	return uv;
+}
+
+// Gradients of the unwrapped coordinate, so folding does not change the mipmap picked at the fold
+vec4 SampleArray(sampler2DArray map, uint layer, uint wrap, vec2 uv)
+{
+	vec2 size = vec2(textureSize(map, 0).xy);
+	return textureGrad(map, vec3(WrapCoordinate(uv, wrap, size), float(layer & 0xffffu)), dFdx(uv), dFdy(uv));
+}
+
+// Sampler arrays only take constant indices here, the array is the same for every fragment of a draw
+vec4 SampleLayer(uint layer, uint wrap, vec2 uv)
+{
+	switch (layer >> 16)
+	{
+	case 1u: return SampleArray(textureArrays[1], layer, wrap, uv);
+	case 2u: return SampleArray(textureArrays[2], layer, wrap, uv);
+	case 3u: return SampleArray(textureArrays[3], layer, wrap, uv);
+	case 4u: return SampleArray(textureArrays[4], layer, wrap, uv);
+	case 5u: return SampleArray(textureArrays[5], layer, wrap, uv);
+	case 6u: return SampleArray(textureArrays[6], layer, wrap, uv);
+	case 7u: return SampleArray(textureArrays[7], layer, wrap, uv);
+	default: return SampleArray(textureArrays[0], layer, wrap, uv);
+	}
+}
 
 // function prototypes
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
@@ -122,6 +245,21 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 void main()
 {
 	// properties
+	MaterialParams params = materials[vertexMaterial];
+	shininess = params.shininess;
+	vec2 uv = vertexTextureCoordinate * params.uvScale;
+	if (TEXTURE_ARRAY == 1)
+	{
+		diffuseColor = vec3(SampleLayer(params.diffuseLayer, params.diffuseWrap, uv));
+		if (SPECULAR_MAP == 1)
+			specularColor = vec3(SampleLayer(params.specularLayer, params.specularWrap, uv));
+	}
+	else
+	{
+		diffuseColor = vec3(texture(material.diffuse, uv));
+		if (SPECULAR_MAP == 1)
+			specularColor = vec3(texture(material.specular, uv));
+	}
 	vec3 norm = normalize(vertexNormal);
 	vec3 viewDir = normalize(viewPos - vertexFragmentPos);
 
@@ -130,13 +268,21 @@ void main()
 	// For each phase, a calculate function is defined that calculates the corresponding color
 	// per lamp. In the main() function we take all the calculated colors and sum them up for
 	// this fragment's final color.
+	// Which phases run is chosen per variant (ShaderVariants.h), the compiler removes the others.
 	// == =====================================================
+	vec3 result = vec3(0.0);
 	// phase 1: directional lighting
-	vec3 result = CalcDirLight(dirLight, norm, viewDir);
+	if (LIGHT_DIR == 1)
+		result += CalcDirLight(dirLight, norm, viewDir);
 	// phase 2: point lights
-	result += CalcPointLight(pointLights, norm, vertexFragmentPos, viewDir);
+	if (LIGHT_POINT == 1)
+		result += CalcPointLight(pointLights[params.pointLightIndex], norm, vertexFragmentPos, viewDir);
 	// phase 3: spot light
-	//result += CalcSpotLight(spotLight, norm, vertexFragmentPos, viewDir);
+	if (LIGHT_SPOT == 1)
+		result += CalcSpotLight(spotLight, norm, vertexFragmentPos, viewDir);
+	// unlit variant: the diffuse map as is
+	if (LIGHT_DIR == 0 && LIGHT_POINT == 0 && LIGHT_SPOT == 0)
+		result = diffuseColor;
 
 	fragmentColor = vec4(result, 1.0);
 }
@@ -147,13 +293,17 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
 	vec3 lightDir = normalize(-light.direction);
 	// diffuse shading
 	float diff = max(dot(normal, lightDir), 0.0);
-	// specular shading
-	vec3 reflectDir = reflect(-lightDir, normal);
-	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
 	// combine results
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse, vertexTextureCoordinate * uvScale));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, vertexTextureCoordinate * uvScale));
-	vec3 specular = light.specular * spec * vec3(texture(material.specular, vertexTextureCoordinate * uvScale));
+	vec3 ambient = light.ambient * diffuseColor;
+	vec3 diffuse = light.diffuse * diff * diffuseColor;
+	vec3 specular = vec3(0.0);
+	if (SPECULAR_MAP == 1)
+	{
+		// specular shading
+		vec3 reflectDir = reflect(-lightDir, normal);
+		float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+		specular = light.specular * spec * specularColor;
+	}
 	return (ambient + diffuse + specular);
 }
 
@@ -163,16 +313,20 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 	vec3 lightDir = normalize(light.position - fragPos);
 	// diffuse shading
 	float diff = max(dot(normal, lightDir), 0.0);
-	// specular shading
-	vec3 reflectDir = reflect(-lightDir, normal);
-	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
 	// attenuation
 	float distance = length(light.position - fragPos);
 	float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
 	// combine results
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse, vertexTextureCoordinate * uvScale));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, vertexTextureCoordinate * uvScale));
-	vec3 specular = light.specular * spec * vec3(texture(material.specular, vertexTextureCoordinate * uvScale));
+	vec3 ambient = light.ambient * diffuseColor;
+	vec3 diffuse = light.diffuse * diff * diffuseColor;
+	vec3 specular = vec3(0.0);
+	if (SPECULAR_MAP == 1)
+	{
+		// specular shading
+		vec3 reflectDir = reflect(-lightDir, normal);
+		float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+		specular = light.specular * spec * specularColor;
+	}
 	ambient *= attenuation;
 	diffuse *= attenuation;
 	specular *= attenuation;
@@ -185,9 +339,6 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 	vec3 lightDir = normalize(light.position - fragPos);
 	// diffuse shading
 	float diff = max(dot(normal, lightDir), 0.0);
-	// specular shading
-	vec3 reflectDir = reflect(-lightDir, normal);
-	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
 	// attenuation
 	float distance = length(light.position - fragPos);
 	float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
@@ -196,9 +347,16 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 	float epsilon = light.cutOff - light.outerCutOff;
 	float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
 	// combine results
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse, vertexTextureCoordinate * uvScale));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, vertexTextureCoordinate * uvScale));
-	vec3 specular = light.specular * spec * vec3(texture(material.specular, vertexTextureCoordinate * uvScale));
+	vec3 ambient = light.ambient * diffuseColor;
+	vec3 diffuse = light.diffuse * diff * diffuseColor;
+	vec3 specular = vec3(0.0);
+	if (SPECULAR_MAP == 1)
+	{
+		// specular shading
+		vec3 reflectDir = reflect(-lightDir, normal);
+		float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+		specular = light.specular * spec * specularColor;
+	}
 	ambient *= attenuation * intensity;
 	diffuse *= attenuation * intensity;
 	specular *= attenuation * intensity;
@@ -275,6 +433,27 @@ void main()
 	fragmentColor = texture(texture1, vertexTexture * auvScale) + vec4(vertexColor);
 }
 );
+
+/*Occlusion Test Shader: a box from boxMin to boxMax, its vertices made from gl_VertexID, only depth tested*/
+const GLchar* occlusionVertexShaderSource = GLSL(440,
+uniform mat4 viewProjection;
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+void main()
+{
+	//The unit cube as a 14 vertex triangle strip, one bit of each mask per vertex and axis
+	int bit = 1 << gl_VertexID;
+	vec3 corner = vec3((0x287a & bit) != 0, (0x02af & bit) != 0, (0x31e3 & bit) != 0);
+	gl_Position = viewProjection * vec4(mix(boxMin, boxMax, corner), 1.0f);
+}
+);
+
+const GLchar* occlusionFragmentShaderSource = GLSL(440,
+void main()
+{
+}
+);
 #pragma endregion
 
 //Shader Class
@@ -284,10 +463,13 @@ class Shader
 {
 public:
 	unsigned int ID;
-	// constructor generates the shader on the fly
+	// true when the driver compiles and links on its own threads (GL_KHR_parallel_shader_compile), see UEnableParallelShaderCompile
+	static inline bool parallelCompile = false;
+	// constructor submits the shaders for compilation and linking, finish() collects the result
 	// ------------------------------------------------------------------------
 	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
 	{
+		PROFILE_SCOPE("Shader::Shader");
 		// 1. retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
 		std::string fragmentCode;
@@ -295,112 +477,237 @@ public:
 
 		const char* vShaderCode = vertexPath;
 		const char* fShaderCode = fragmentPath;
-		// 2. compile shaders
-		unsigned int vertex, fragment;
-		// vertex shader
+		const char* gShaderCode = geometryPath != nullptr ? geometryCode.c_str() : nullptr;
+		// 2. reuse the driver's binary from an earlier run when nothing changed
+		ID = glCreateProgram();
+		cacheKey = ProgramCacheKey(vShaderCode, fShaderCode, gShaderCode);
+		if (LoadProgramBinary(ID, cacheKey))
+		{
+			fromCache = true;
+			return;
+		}
+		// 3. submit the shaders, no status query here so the driver is free to compile in the background
 		vertex = glCreateShader(GL_VERTEX_SHADER);
 		glShaderSource(vertex, 1, &vShaderCode, NULL);
 		glCompileShader(vertex);
-		checkCompileErrors(vertex, "VERTEX");
 		// fragment Shader
 		fragment = glCreateShader(GL_FRAGMENT_SHADER);
 		glShaderSource(fragment, 1, &fShaderCode, NULL);
 		glCompileShader(fragment);
-		checkCompileErrors(fragment, "FRAGMENT");
 		// if geometry shader is given, compile geometry shader
-		unsigned int geometry;
 		if (geometryPath != nullptr)
 		{
-			const char* gShaderCode = geometryCode.c_str();
 			geometry = glCreateShader(GL_GEOMETRY_SHADER);
 			glShaderSource(geometry, 1, &gShaderCode, NULL);
 			glCompileShader(geometry);
-			checkCompileErrors(geometry, "GEOMETRY");
 		}
 		// shader Program
-		ID = glCreateProgram();
 		glAttachShader(ID, vertex);
 		glAttachShader(ID, fragment);
-		if (geometryPath != nullptr)
+		if (geometry != 0)
 			glAttachShader(ID, geometry);
+		glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 		glLinkProgram(ID);
-		checkCompileErrors(ID, "PROGRAM");
+	}
+	// true once finish() will not block, always true without parallel compilation since any query would wait anyway
+	// ------------------------------------------------------------------------
+	bool isReady() const
+	{
+		if (finished || fromCache || !parallelCompile)
+			return true;
+		GLint complete = GL_FALSE;
+		glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &complete);
+		return complete == GL_TRUE;
+	}
+	// waits for the link if needed, reports errors, stores the binary and reflects the uniforms; false when linking failed
+	// ------------------------------------------------------------------------
+	bool finish()
+	{
+		if (finished)
+			return linked;
+		PROFILE_SCOPE("Shader::finish");
+		finished = true;
+		if (fromCache)
+		{
+			linked = true;
+			reflectUniforms();
+			return linked;
+		}
+		checkCompileErrors(vertex, "VERTEX");
+		checkCompileErrors(fragment, "FRAGMENT");
+		if (geometry != 0)
+			checkCompileErrors(geometry, "GEOMETRY");
+		linked = checkCompileErrors(ID, "PROGRAM");
+		if (linked)
+			StoreProgramBinary(ID, cacheKey);
+		reflectUniforms();
 		// delete the shaders as they're linked into our program now and no longer necessery
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
-		if (geometryPath != nullptr)
+		if (geometry != 0)
 			glDeleteShader(geometry);
-
+		vertex = fragment = geometry = 0;
+		return linked;
 	}
 	// activate the shader
 	// ------------------------------------------------------------------------
-	void use()
+	void use() const
 	{
 		glUseProgram(ID);
 	}
-	// utility uniform functions
+	// resolves a typed handle for an active uniform, reflected at link time
 	// ------------------------------------------------------------------------
-	void setBool(const std::string& name, bool value) const
+	// warnIfInactive is false for uniforms a shader variant may legitimately compile out
+	template<typename T>
+	Uniform<T> uniform(UniformName name, bool warnIfInactive = true) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		Uniform<T> handle;
+		auto it = std::lower_bound(uniforms.begin(), uniforms.end(), name.hash,
+			[](const UniformInfo& info, uint32_t hash) { return info.hash < hash; });
+		if (it == uniforms.end() || it->hash != name.hash)
+		{
+			if (warnIfInactive)
+				std::cout << "WARNING::SHADER::UNIFORM_NOT_ACTIVE " << name.text << std::endl;
+			return handle;
+		}
+		if (!UniformTypeMatches<T>(it->type))
+		{
+			std::cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH " << name.text << " is GL type 0x" << std::hex << it->type << std::dec << std::endl;
+			return handle;
+		}
+		handle.location = it->location;
+		handle.slot = (int)(it - uniforms.begin());
+		return handle;
 	}
+	// utility uniform functions, one glUniform call each unless the program already holds the value
 	// ------------------------------------------------------------------------
-	void setInt(const std::string& name, int value) const
+	void set(Uniform<bool> uniform, bool value)
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		if (changed(uniform, (int)value))
+			glUniform1i(uniform.location, (int)value);
 	}
 	// ------------------------------------------------------------------------
-	void setFloat(const std::string& name, float value) const
+	void set(Uniform<int> uniform, int value)
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		if (changed(uniform, value))
+			glUniform1i(uniform.location, value);
 	}
 	// ------------------------------------------------------------------------
-	void setVec2(const std::string& name, const glm::vec2& value) const
+	void set(Uniform<float> uniform, float value)
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		if (changed(uniform, value))
+			glUniform1f(uniform.location, value);
 	}
-	void setVec2(const std::string& name, float x, float y) const
+	// ------------------------------------------------------------------------
+	void set(Uniform<glm::vec2> uniform, const glm::vec2& value)
+	{
+		if (changed(uniform, value))
+			glUniform2fv(uniform.location, 1, &value[0]);
+	}
+	void set(Uniform<glm::vec2> uniform, float x, float y)
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		set(uniform, glm::vec2(x, y));
 	}
 	// ------------------------------------------------------------------------
-	void setVec3(const std::string& name, const glm::vec3& value) const
+	void set(Uniform<glm::vec3> uniform, const glm::vec3& value)
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		if (changed(uniform, value))
+			glUniform3fv(uniform.location, 1, &value[0]);
 	}
-	void setVec3(const std::string& name, float x, float y, float z) const
+	void set(Uniform<glm::vec3> uniform, float x, float y, float z)
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		set(uniform, glm::vec3(x, y, z));
 	}
 	// ------------------------------------------------------------------------
-	void setVec4(const std::string& name, const glm::vec4& value) const
+	void set(Uniform<glm::vec4> uniform, const glm::vec4& value)
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		if (changed(uniform, value))
+			glUniform4fv(uniform.location, 1, &value[0]);
 	}
-	void setVec4(const std::string& name, float x, float y, float z, float w)
+	void set(Uniform<glm::vec4> uniform, float x, float y, float z, float w)
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		set(uniform, glm::vec4(x, y, z, w));
 	}
 	// ------------------------------------------------------------------------
-	void setMat2(const std::string& name, const glm::mat2& mat) const
+	void set(Uniform<glm::mat2> uniform, const glm::mat2& mat)
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (changed(uniform, mat))
+			glUniformMatrix2fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat3(const std::string& name, const glm::mat3& mat) const
+	void set(Uniform<glm::mat3> uniform, const glm::mat3& mat)
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (changed(uniform, mat))
+			glUniformMatrix3fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string& name, const glm::mat4& mat) const
+	void set(Uniform<glm::mat4> uniform, const glm::mat4& mat)
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (changed(uniform, mat))
+			glUniformMatrix4fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
 	}
 
 private:
+	unsigned int vertex = 0, fragment = 0, geometry = 0; // stages until finish() deletes them
+	uint64_t cacheKey = 0;
+	bool fromCache = false; // loaded with glProgramBinary, nothing was compiled
+	bool finished = false;
+	bool linked = false;
+	std::vector<UniformInfo> uniforms; // active uniforms sorted by name hash
+	std::vector<UniformShadow> shadows; // last value set per entry of uniforms
+
+	// compares value with the shadow of the uniform and counts the outcome, false when the GL call can be skipped
+	// ------------------------------------------------------------------------
+	template<typename T, typename V>
+	bool changed(Uniform<T> uniform, const V& value)
+	{
+		if (uniform.slot < 0)
+			return true; // inactive uniform, glUniform ignores location -1
+		if (!shadows[uniform.slot].update(value))
+		{
+			gFrameStats.uniformCacheHits++;
+			return false;
+		}
+		gFrameStats.uniformCacheMisses++;
+		return true;
+	}
+
+	// reads name, type and location of every active uniform of the linked program
+	// ------------------------------------------------------------------------
+	void reflectUniforms()
+	{
+		GLint count = 0;
+		GLint maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<GLchar> name(maxLength + 1);
+		uniforms.clear();
+		for (GLint i = 0; i < count; i++)
+		{
+			GLint size;
+			GLenum type;
+			GLsizei length;
+			glGetActiveUniform(ID, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, name.data());
+			// arrays are reported as "name[0]", callers use the plain name
+			if (length > 3 && strcmp(&name[length - 3], "[0]") == 0)
+				name[length - 3] = '\0';
+			GLint location = glGetUniformLocation(ID, name.data());
+			if (location < 0)
+				continue; // uniform block members have no location
+			uniforms.push_back({ UniformHash(name.data()), location, type, size });
+		}
+		std::sort(uniforms.begin(), uniforms.end(), [](const UniformInfo& a, const UniformInfo& b) { return a.hash < b.hash; });
+		for (size_t i = 1; i < uniforms.size(); i++)
+		{
+			if (uniforms[i].hash == uniforms[i - 1].hash)
+				std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION at locations " << uniforms[i - 1].location << " and " << uniforms[i].location << std::endl;
+		}
+		// a freshly linked program holds defaults the shadows know nothing about, the first set always reaches GL
+		shadows.assign(uniforms.size(), UniformShadow());
+	}
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
-	void checkCompileErrors(GLuint shader, std::string type)
+	bool checkCompileErrors(GLuint shader, std::string type)
 	{
 		GLint success;
 		GLchar infoLog[1024];
@@ -422,139 +729,15 @@ private:
 				std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
 			}
 		}
+		return success == GL_TRUE;
 	}
 };
 #pragma endregion
 
-//Camera Class
-#pragma region CameraClass
-// Defines several possible options for camera movement. Used as abstraction to stay away from window-system specific input methods
-enum class Camera_Movement {
-	FORWARD,
-	BACKWARD,
-	LEFT,
-	RIGHT,
-	UP,
-	DOWN
-};
-
-// Default camera values
-const float YAW = -90.0f;
-const float PITCH = 0.0f;
-const float SPEED = 2.5f;
-const float SENSITIVITY = 0.1f;
-const float ZOOM = 45.0f;
-
-
-// An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
-class Camera
-{
-public:
-	// camera Attributes
-	glm::vec3 Position;
-	glm::vec3 Front;
-	glm::vec3 Up;
-	glm::vec3 Right;
-	glm::vec3 WorldUp;
-	// euler Angles
-	float Yaw;
-	float Pitch;
-	// camera options
-	float MovementSpeed;
-	float MouseSensitivity;
-	float Zoom;
-
-	// constructor with vectors
-	Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
-	{
-		Position = position;
-		WorldUp = up;
-		Yaw = yaw;
-		Pitch = pitch;
-		updateCameraVectors();
-	}
-	// constructor with scalar values
-	Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
-	{
-		Position = glm::vec3(posX, posY, posZ);
-		WorldUp = glm::vec3(upX, upY, upZ);
-		Yaw = yaw;
-		Pitch = pitch;
-		updateCameraVectors();
-	}
-
-	// returns the view matrix calculated using Euler Angles and the LookAt Matrix
-	glm::mat4 GetViewMatrix() const
-	{
-		return glm::lookAt(Position, Position + Front, Up);
-	}
-
-	// processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
-	void ProcessKeyboard(Camera_Movement direction, float deltaTime)
-	{
-		float velocity = MovementSpeed * deltaTime;
-		if (direction == Camera_Movement::FORWARD)
-			Position += Front * velocity;
-		if (direction == Camera_Movement::BACKWARD)
-			Position -= Front * velocity;
-		if (direction == Camera_Movement::LEFT)
-			Position -= Right * velocity;
-		if (direction == Camera_Movement::RIGHT)
-			Position += Right * velocity;
-		if (direction == Camera_Movement::UP)
-			Position += Up * velocity;
-		if (direction == Camera_Movement::DOWN)
-			Position -= Up * velocity;
-	}
-
-	// processes input received from a mouse input system. Expects the offset value in both the x and y direction.
-	void ProcessMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch = true)
-	{
-		xoffset *= MouseSensitivity;
-		yoffset *= MouseSensitivity;
 
-		Yaw += xoffset;
-		Pitch += yoffset;
-
-		// make sure that when pitch is out of bounds, screen doesn't get flipped
-		if (constrainPitch)
-		{
-			if (Pitch > 89.0f)
-				Pitch = 89.0f;
-			if (Pitch < -89.0f)
-				Pitch = -89.0f;
-		}
-
-		// update Front, Right and Up Vectors using the updated Euler angles
-		updateCameraVectors();
-	}
-
-	// processes input received from a mouse scroll-wheel event. Only requires input on the vertical wheel-axis
-	void ProcessMouseScroll(float yoffset)
-	{
-		Zoom -= (float)yoffset;
-		if (Zoom < 1.0f)
-			Zoom = 1.0f;
-		if (Zoom > 45.0f)
-			Zoom = 45.0f;
-	}
-
-private:
-	// calculates the front vector from the Camera's (updated) Euler Angles
-	void updateCameraVectors()
-	{
-		// calculate the new Front vector
-		glm::vec3 front;
-		front.x = cos(glm::radians(Yaw)) * cos(glm::radians(Pitch));
-		front.y = sin(glm::radians(Pitch));
-		front.z = sin(glm::radians(Yaw)) * cos(glm::radians(Pitch));
-		Front = glm::normalize(front);
-		// also re-calculate the Right and Up vector
-		Right = glm::normalize(glm::cross(Front, WorldUp));  // normalize the vectors, because their length gets closer to 0 the more you look up or down which results in slower movement.
-		Up = glm::normalize(glm::cross(Right, Front));
-	}
-};
-#pragma endregion
+#ifdef THECAR_NO_GLFW
+typedef struct GLFWwindow GLFWwindow; //Opaque handle, never created in headless-only builds
+#endif
 
 //Unnamed namspace
 namespace {
@@ -564,18 +747,162 @@ namespace {
 	const int WINDOW_WIDTH = 800;
 	const int WINDOW_HEIGHT = 600;
 
-	//Stores the GL data relative to a given mesh
-	struct GLMesh {
-		GLuint vao;		//Handle for the vertex array object
-		GLuint vbos[2];	//Handles for the vertex buffer objects
+	//Stores the GL data relative to a given mesh: where it is in the shared geometry and how its vertices split
+	struct GLMesh : MeshRef {
 		GLuint nIndices;//Number of indices of the mesh
 		GLuint sideVerts;
 		GLuint topVerts;
 		GLuint bottomVerts;
+		MaterialId material = INVALID_MATERIAL;	//Material the mesh is drawn with unless the draw picks another
+	};
+
+	//Texture pixels decoded off the GL thread, freed once uploaded
+	struct DecodedImage {
+		unsigned char* pixels = nullptr;
+		int width = 0;
+		int height = 0;
+		int channels = 0;
+		std::vector<unsigned char> resampled;	//Owns pixels once resized to a texture array layer, stb_image's otherwise
+	};
+
+	//Command line options
+	struct RunOptions {
+		bool headless = false;		//Render into an offscreen FBO instead of a window
+		int frames = 0;				//Number of frames to render, 0 runs until the window is closed
+		int width = WINDOW_WIDTH;	//Framebuffer size
+		int height = WINDOW_HEIGHT;
+		std::string benchPath;		//Camera path driving a benchmark run
+		std::string benchOut = "benchmark.json"; //Benchmark result file
+		std::string recordPath;		//Records key presses as a camera path file
+		std::string compareA;		//Result files compared by --compare
+		std::string compareB;
+		std::string glStatsPath;	//Per-frame GL call / redundancy CSV
+		bool gpuProfile = false;	//Time render scopes with GPU timer queries
+		std::string tracePath;		//Chrome trace JSON of CPU scopes
+		std::string goldenDir;		//Reference images compared (or written with --golden-update)
+		std::string goldenOut = "golden_out"; //Actual and diff images of failing poses
+		bool goldenUpdate = false;
+		int goldenTolerance = GOLDEN_CHANNEL_TOLERANCE;
+		std::string shaderCacheDir = "shader_cache"; //Program binaries, empty with --no-shader-cache
+		bool flashlight = false;	//Adds the camera spot light (LIGHT_SPOT variant)
+		SamplerFilter textureFilter = SAMPLER_FILTER_LINEAR;	//Filter of every material's samplers
+		bool textureArrays = false;	//Maps as texture array layers (TEXTURE_ARRAY variant) instead of one texture each
+		int cars = 1;				//Cars in the scene, the first one where the single car always stood
+		bool multiDraw = true;		//One glMultiDrawArraysIndirect per pass, off issues one draw per command
+		bool bake = true;			//Car bodies and wheels drawn from baked meshes, off draws every part on its own
+		bool cull = true;			//Skip the draws whose bounding sphere is outside the view frustum
+		bool occlusion = false;		//Draw each car conditionally on its box passing the last frame's occlusion query
+	};
+	RunOptions gOptions;
+	//Handles of the light shader uniforms set by URender and the submission, resolved per variant
+	struct LightShaderUniforms {
+		Uniform<int> drawBase;
+		Uniform<int> materialDiffuse;
+		Uniform<int> materialSpecular;
+		//Flashlight, active in LIGHT_SPOT variants only
+		Uniform<glm::vec3> spotPosition;
+		Uniform<glm::vec3> spotDirection;
+		Uniform<float> spotCutOff;
+		Uniform<float> spotOuterCutOff;
+		Uniform<float> spotConstant;
+		Uniform<float> spotLinear;
+		Uniform<float> spotQuadratic;
+		Uniform<glm::vec3> spotAmbient;
+		Uniform<glm::vec3> spotDiffuse;
+		Uniform<glm::vec3> spotSpecular;
+	};
+	//One program of the light shader and its uniform handles
+	struct LightVariant {
+		uint32_t features;
+		Shader shader;
+		LightShaderUniforms uniforms;
+		bool resolved = false; //Linked, uniforms looked up and sampler units set
+
+		LightVariant(uint32_t features, const std::string& vertexSource, const std::string& fragmentSource)
+			: features(features), shader(vertexSource.c_str(), fragmentSource.c_str()) {}
+	};
+	//Light shader variants by feature key (ShaderVariants.h), compiled on first request and kept for the run
+	std::unordered_map<uint32_t, std::unique_ptr<LightVariant>> gLightVariants;
+	//Features the lit objects are drawn with: every material has a specular map and sees both scene lights
+	uint32_t gSceneShading = LIGHT_DIR | LIGHT_POINT | SPECULAR_MAP;
+	//Camera and light uniform blocks of the light shader
+	UniformBlockBuffers gUniformBlocks;
+	//GPU time per render scope, only active with --gpu-profile
+	GpuProfiler gGpuProfiler;
+	//Draw items of the frame being built
+	RenderQueue gRenderQueue;
+	//Ground, cars and their parts, built once by UBuildScene; URender only updates what moved
+	SceneGraph gScene;
+	//Threads the frustum culling may split a large scene across
+	const unsigned gCullThreads = std::max(1u, std::thread::hardware_concurrency());
+	//How a car's parts are placed: the wheels at the car's corners, facing out on their side (0 left, 1 right)
+	const glm::vec3 CAR_WHEEL_LOCATIONS[4] = {
+		glm::vec3(-2.5f, 1.0f, 1.0f),
+		glm::vec3( 2.5f, 1.0f, 1.0f),
+		glm::vec3(-2.5f, 1.0f, 9.0f),
+		glm::vec3( 2.5f, 1.0f, 9.0f),
+	};
+	const int CAR_WHEEL_SIDES[4] = { 0, 1, 0, 1 };
+	const GLfloat CAR_WHEEL_ROTATIONS[2] = { -90.0f, 90.0f };
+	const glm::vec3 CAR_WHEEL_SCALE = glm::vec3(0.0225f, 0.0225f, 0.0225f);
+	const glm::vec3 CAR_BODY_LOCATION = glm::vec3(0.0f, 1.5f, -0.6f);
+	const glm::vec3 CAR_BODY_SCALE = glm::vec3(0.5f, 0.5f, 1.0f);
+	//Spacing of the --cars grid, wider and longer than a car (6 x 16.2 with its wheels) so no two cars intersect
+	const float CAR_GRID_COLUMN_PITCH = 8.0f;
+	const float CAR_GRID_ROW_PITCH = 18.0f;
+	//A merged mesh of a baked assembly and how it is drawn
+	struct BakedMesh {
+		GLMesh mesh;
+		uint32_t mode;	//GL_TRIANGLES or GL_LINES
+		uint32_t layer;	//RenderLayer
+		uint32_t category;	//RenderCategory, the wing stays apart from the body
+	};
+	//Car body and wing baked in car space, and a left and a right wheel in wheel space (UBakeAssemblies)
+	std::vector<BakedMesh> gBakedCar;
+	std::vector<BakedMesh> gBakedWheels[2];
+	//Vertices of every mesh back to back behind one VAO: UAddMesh appends, UCreateSharedGeometry uploads
+	struct SharedGeometry {
+		std::vector<GLfloat> vertices;	//Freed once uploaded
+		GLuint vao = 0;
+		GLuint vbo = 0;
+		uint32_t meshCount = 0;
+	};
+	SharedGeometry gGeometry;
+	//Material records of the light shader, uploaded once
+	GLuint gMaterialBuffer = 0;
+	//Camera block, instances, draw records and indirect commands of the last three frames, written in place
+	FrameRing gFrameRing;
+	//One occlusion query per car, tested after the scene and drawn on in the next frame (OcclusionQueries.h)
+	OcclusionQueries gOcclusion;
+	//Program drawing the tested boxes, only made with occlusion culling on
+	std::unique_ptr<Shader> gOcclusionShader;
+	struct OcclusionShaderUniforms {
+		Uniform<glm::mat4> viewProjection;
+		Uniform<glm::vec3> boxMin;
+		Uniform<glm::vec3> boxMax;
 	};
+	OcclusionShaderUniforms gOcclusionUniforms;
+	//A car whose box is within this of the camera is drawn without a test, more than the near plane distance
+	const float OCCLUSION_CAMERA_MARGIN = 0.5f;
+	//Passes go out as one glMultiDrawArraysIndirect each, needs gl_DrawIDARB (GL_ARB_shader_draw_parameters)
+	bool gMultiDraw = false;
+	//Frames rendered when --headless is given without --frames
+	const int DEFAULT_HEADLESS_FRAMES = 100;
+	//Process exit codes besides EXIT_SUCCESS / EXIT_FAILURE
+	const int EXIT_BAD_ARGUMENTS = 2;
+	const int EXIT_GL_ERROR = 3;
+	const int EXIT_GOLDEN_MISMATCH = 4;
 
 	//Main GLFW window
 	GLFWwindow* gWindow = nullptr;
+	//Offscreen render target used instead of gWindow in headless mode
+	OffscreenTarget gOffscreen;
+#ifdef THECAR_HAS_EGL
+	HeadlessContext gHeadlessContext;
+#endif
+	//Current framebuffer size, drives the projection aspect ratio
+	int gViewportWidth = WINDOW_WIDTH;
+	int gViewportHeight = WINDOW_HEIGHT;
 	//Triangle mesh data
 	GLMesh gMesh;
 	GLMesh gPlane;
@@ -592,12 +919,38 @@ namespace {
 	GLMesh gTop;
 	//Shader program
 	GLuint gProgramId;
-	//ZTexture ID
-	GLuint texture1, texture2, texture3, texture4, texture5, texture6;
-	GLuint texture7, texture8, texture9, texture10, texture11, texture12;
-	GLuint texture13, texture14;
-	glm::vec2 gUVScale(2.0f, 2.0f);
-	GLint gTexWrapMode = GL_REPEAT;
+	//Texture maps in load order, each diffuse map followed by its specular map
+	enum TextureId {
+		TEXTURE_PAVEMENT, TEXTURE_PAVEMENT_SPECULAR,
+		TEXTURE_PAINT, TEXTURE_PAINT_SPECULAR,
+		TEXTURE_TIRE, TEXTURE_TIRE_SPECULAR,
+		TEXTURE_GLASS, TEXTURE_GLASS_SPECULAR,
+		TEXTURE_FRONT, TEXTURE_FRONT_SPECULAR,
+		TEXTURE_BACK, TEXTURE_BACK_SPECULAR,
+		TEXTURE_SIDE, TEXTURE_SIDE_SPECULAR,
+		TEXTURE_COUNT
+	};
+	GLuint gTextures[TEXTURE_COUNT];
+	//Materials of the scene, ids into gMaterials in this order
+	enum SceneMaterial {
+		MATERIAL_GROUND,
+		MATERIAL_WING,
+		MATERIAL_TIRE,
+		MATERIAL_TRIM,	//Rims and wheel wells
+		MATERIAL_HUB,	//Hubs and spokes
+		MATERIAL_PAINT,	//Body, the block inside the top and the top's edges
+		MATERIAL_GLASS,	//Top
+		MATERIAL_SIDE,	//Center top and right side
+		MATERIAL_SIDE_STRETCHED,	//Left side
+		MATERIAL_FRONT,
+		MATERIAL_BACK,
+		SCENE_MATERIAL_COUNT
+	};
+	MaterialTable gMaterials;
+	//Samplers the materials read their maps with
+	SamplerSet gSamplers;
+	//The maps with --texture-arrays, gTextures stays empty then
+	TextureArraySet gTextureArrays;
 	//camera
 	Camera gCamera(glm::vec3(0.0f, 8.0f, 25.0f));
 	float gLastX = WINDOW_WIDTH / 2.0f;
@@ -607,6 +960,10 @@ namespace {
 	//timing
 	float gDeltaTime = 0.0f; //time between current frame and last frame
 	float gLastFrame = 0.0f;
+	int gFrameIndex = 0; //frame being rendered
+	//benchmark camera path and key presses recorded for --record
+	CameraPath gCameraPath;
+	std::vector<InputEvent> gRecordedInput;
 //	bool isPerspective = true;
 	int kCount = 0;//Used for torus loop
 
@@ -618,52 +975,70 @@ namespace {
 *  and render graphics on the screen
 */
 #pragma region Prototypes
+bool UParseArguments(int argc, char* argv[], RunOptions& options);
+int UArgumentValueCount(const std::string& arg);
 bool UInitialize(int, char* [], GLFWwindow** window);
+void UShutdown();
+void UPresentFrame();
+bool UShouldClose(int frame);
+void UPrintFrameTimeSummary(const std::vector<float>& frameTimes);
+void UMoveCamera(char key, float deltaTime);
+void UApplyCameraPath(int frame);
+bool UWriteRecording(const std::string& filename);
+bool URunGoldenTests(Shader& bShader);
+LightVariant& USubmitLightVariant(uint32_t features);
+LightVariant& ULightVariant(uint32_t features);
+void UResolveLightUniforms(LightVariant& variant);
+bool UDrawParametersSupported();
+bool UCreateSceneBuffers();
+#ifndef THECAR_NO_GLFW
 void UResizeWindow(GLFWwindow* window, int width, int height);
 //Input Controls
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+#endif
 //Create Objects and texture
 void Plane(GLMesh& mesh);
 void Wing(GLMesh& mesh);
 void DrawTorus(GLMesh& mesh, float r, float c, int rSeg, int cSeg, int texture, int zMulti);
 void DrawCylinder(GLMesh& mesh, GLfloat radius, GLfloat height);
 void DrawRectangle(GLMesh& mesh, GLfloat radius, GLfloat height);
-void UDestroyMesh(GLMesh& mesh);
+void UAddMesh(GLMesh& mesh, const MeshVertices& vertices);
+void UCreateSharedGeometry(GLMesh* meshes[], int count);
+void UDestroySharedGeometry();
 void DrawCube(GLMesh& mesh);
 void DrawPyramid(GLMesh& mesh);
-void DrawWheel(Shader ourShader, GLMesh& tMesh, GLMesh& wMesh, GLMesh& cMesh, GLMesh& sMesh, glm::vec3 loc, glm::vec3 aScale, GLfloat angle, bool sides);
-void DrawCar(Shader ourShader, GLMesh& bMesh, GLMesh& fMesh, GLMesh& rMesh, GLMesh& sMesh, GLMesh& cTMesh, GLMesh& tMesh, glm::vec3 loc, glm::vec3 aScale, GLfloat angle);
+glm::vec3 UCarOffset(int car);
+void UBuildScene();
+void UAddCarParts(SceneGraph& scene, SceneNodeId car, bool wheels);
+void UAssignMeshMaterials();
+bool UBakeAssemblies();
+bool UBakeAssembly(SceneGraph& parts, std::vector<BakedMesh>& baked);
+void UAddWheel(SceneGraph& scene, SceneNodeId car, GLMesh& tMesh, GLMesh& wMesh, GLMesh& cMesh, GLMesh& sMesh, glm::vec3 loc, glm::vec3 aScale, GLfloat angle, bool sides);
+void UAddCar(SceneGraph& scene, SceneNodeId car, GLMesh& bMesh, GLMesh& fMesh, GLMesh& rMesh, GLMesh& sMesh, GLMesh& cTMesh, GLMesh& tMesh, glm::vec3 loc, glm::vec3 aScale, GLfloat angle);
+//Shader compilation
+void UEnableParallelShaderCompile();
+bool UFinishShaders(Shader* shaders[], int count);
 //Texture Create and Destroy
+bool UDecodeTexture(const char* filename, DecodedImage& image);
+void UResampleToLayerSize(DecodedImage& image);
+void UReleaseDecodedImage(DecodedImage& image);
+bool UUploadTexture(DecodedImage& image, GLuint& textureId);
+bool UCreateTextureArrays(DecodedImage images[], int count);
 bool CreateTexture(const char* filename, GLuint& textureId);
 void DestroyTexture(GLuint textureID);
 //Memory Clean up
 //void UDestroyShaderProgram(GLuint programId);
 //Push to our shader and put on screen
-void URender(Shader aShader, Shader bShader);
-
+bool URender(Shader& bShader);
+bool USubmitRenderQueue(RenderQueue& queue, const FrameBlock& frame);
+void UTestOcclusion(const FrameBlock& frame);
+void UCreateSceneMaterials();
+void UBindMaterial(MaterialBinding& binding, MaterialId id);
 
 
-//Image Flip
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
-{
-	for (int j = 0; j < height / 2; j++)
-	{
-		int index1 = j * width * channels;
-		int index2 = (height - 1 - j) * width * channels;
-
-		for (int i = width * channels; i > 0; i--)
-		{
-			unsigned char temp = image[index1];
-			image[index1] = image[index2];
-			image[index2] = temp;
-			index1++;
-			index2++;
-		}
-	}
-}
 
 /*File path test Credit - https://stackoverflow.com/questions/12774207/fastest-way-to-check-if-a-file-exist-using-standard-c-c11-c */
 inline bool exists_test0(const std::string& name) {
@@ -677,9 +1052,86 @@ inline bool exists_test0(const std::string& name) {
 
 int main(int argc, char* argv[]) {
 
+	if (!UParseArguments(argc, argv, gOptions))
+		return EXIT_BAD_ARGUMENTS;
+
+	//Comparing two result files needs no GL context
+	if (!gOptions.compareA.empty())
+		return CompareBenchmarkFiles(gOptions.compareA.c_str(), gOptions.compareB.c_str()) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (!gOptions.glStatsPath.empty())
+		EnableGLStatsTracking();
+	if (!gOptions.tracePath.empty()) {
+		EnableProfiler();
+		ProfilerSetThreadName("main");
+	}
+	ProfileScope startupScope("startup");
+
+	if (!gOptions.benchPath.empty()) {
+		if (!LoadCameraPath(gOptions.benchPath.c_str(), gCameraPath))
+			return EXIT_BAD_ARGUMENTS;
+		if (gOptions.frames == 0)
+			gOptions.frames = gCameraPath.frameCount();
+	}
 
 	if (!UInitialize(argc, argv, &gWindow))
 		return EXIT_FAILURE;
+	if (gOptions.gpuProfile) {
+		gGpuProfiler.init(true);
+		//Ground, wing, wheels and car body get passes of their own, each timed in a scope of its own
+		gRenderQueue.splitCategories = true;
+	}
+
+	//Initiate Shaders
+	//Submitted first: the driver compiles them while the meshes are built and the textures decoded
+	gProgramCacheDir = gOptions.shaderCacheDir;
+	UEnableParallelShaderCompile();
+	if (gOptions.flashlight)
+		gSceneShading |= LIGHT_SPOT;
+	if (gOptions.textureArrays)
+		gSceneShading |= TEXTURE_ARRAY;
+	gMultiDraw = gOptions.multiDraw && UDrawParametersSupported();
+	if (gOptions.multiDraw && !gMultiDraw)
+		std::cout << "WARNING::RENDER::NO_DRAW_PARAMETERS drawing one command at a time" << std::endl;
+	Shader& lightShader = USubmitLightVariant(gSceneShading).shader;
+	Shader basicShader(basicVertexShaderSource, basicFragmentShaderSource);
+	if (gOptions.occlusion)
+		gOcclusionShader.reset(new Shader(occlusionVertexShaderSource, occlusionFragmentShaderSource));
+
+	//Load texture (relative to projects directory)
+	const char* texFilename[TEXTURE_COUNT];
+	texFilename[TEXTURE_PAVEMENT] = "Resources/Textures/pavement.png";
+	texFilename[TEXTURE_PAVEMENT_SPECULAR] = "Resources/Textures/pavement_specular.png";
+	texFilename[TEXTURE_PAINT] = "Resources/Textures/TruePaintColor.png";
+	texFilename[TEXTURE_PAINT_SPECULAR] = "Resources/Textures/TruePaintColor_specular3.png";
+	texFilename[TEXTURE_TIRE] = "Resources/Textures/tire_tread.png";
+	texFilename[TEXTURE_TIRE_SPECULAR] = "Resources/Textures/tire_tread_specular.png";
+	texFilename[TEXTURE_GLASS] = "Resources/Textures/keyshot-materials-glitter-glass.png";
+	texFilename[TEXTURE_GLASS_SPECULAR] = "Resources/Textures/keyshot-materials-glitter-glass_specular.png";
+	texFilename[TEXTURE_FRONT] = "Resources/Textures/FrontNose_1.png";
+	texFilename[TEXTURE_FRONT_SPECULAR] = "Resources/Textures/FrontNose_specular.png";
+	texFilename[TEXTURE_BACK] = "Resources/Textures/BackSide.png";
+	texFilename[TEXTURE_BACK_SPECULAR] = "Resources/Textures/BackSide_specular.png";
+	texFilename[TEXTURE_SIDE] = "Resources/Textures/theSide.png";
+	texFilename[TEXTURE_SIDE_SPECULAR] = "Resources/Textures/theSide_specular.png";
+	//keyshot-materials-glitter-glass
+	//Test File path
+	for (int i = 0; i < TEXTURE_COUNT; i++) {
+		if (exists_test0(texFilename[i]))
+			std::cout << " file: \""<< texFilename[i] << "\" good" << std::endl;
+		else
+			std::cout << " file not good" << std::endl;
+	}
+	//Decoding needs no GL context, a worker does it while this thread builds the meshes
+	DecodedImage decodedImages[TEXTURE_COUNT];
+	std::thread decodeThread([&]() {
+		if (gProfilerEnabled)
+			ProfilerSetThreadName("texture decode");
+		for (int i = 0; i < TEXTURE_COUNT; i++) {
+			if (UDecodeTexture(texFilename[i], decodedImages[i]) && gOptions.textureArrays)
+				UResampleToLayerSize(decodedImages[i]);
+		}
+	});
 
 	//Create the Meshes
 	Plane(gPlane);
@@ -694,193 +1146,582 @@ int main(int argc, char* argv[]) {
 	DrawCylinder(gSides, 15.0f, 14.5f);
 	DrawCube(gCenterTop);
 	DrawPyramid(gTop);
-	//Initiate Shaders
-	Shader lightShader(lightVertexShaderSource, lightFragmentShaderSource);
-	Shader basicShader(basicVertexShaderSource, basicFragmentShaderSource);
-	
-	//Load texture (relative to projects directory)
-	const char* texFilename[14];
-	texFilename[0] = "Resources/Textures/pavement.png";
-	texFilename[1] = "Resources/Textures/pavement_specular.png";
-	texFilename[2] = "Resources/Textures/TruePaintColor.png";
-	texFilename[3] = "Resources/Textures/TruePaintColor_specular3.png";
-	texFilename[4] = "Resources/Textures/tire_tread.png";
-	texFilename[5] = "Resources/Textures/tire_tread_specular.png";
-	texFilename[6] = "Resources/Textures/keyshot-materials-glitter-glass.png";
-	texFilename[7] = "Resources/Textures/keyshot-materials-glitter-glass_specular.png";
-	texFilename[8] = "Resources/Textures/FrontNose_1.png";
-	texFilename[9] = "Resources/Textures/FrontNose_specular.png";
-	texFilename[10] = "Resources/Textures/BackSide.png";
-	texFilename[11] = "Resources/Textures/BackSide_specular.png";
-	texFilename[12] = "Resources/Textures/theSide.png";
-	texFilename[13] = "Resources/Textures/theSide_specular.png";
-	//keyshot-materials-glitter-glass
-	//Test File path
-	for (int i = 0; i < 14; i++) {
-		if (exists_test0(texFilename[i]))
-			std::cout << " file: \""<< texFilename[i] << "\" good" << std::endl;
-		else
-			std::cout << " file not good" << std::endl;
-	}
-	//Create Shader
-	if (!CreateTexture(texFilename[0] , texture1))
-	{
-		std::cout << "Failed to load texture " << texFilename[0] << std::endl;
+	UAssignMeshMaterials();
+	if (gOptions.bake && !UBakeAssemblies())
 		return EXIT_FAILURE;
+	std::vector<GLMesh*> meshes = { &gPlane, &gWing, &gTire, &gWheel, &gCHub, &gSpoke, &gBody, &gFront, &gRear, &gSides, &gCenterTop, &gTop };
+	for (BakedMesh& baked : gBakedCar)
+		meshes.push_back(&baked.mesh);
+	for (std::vector<BakedMesh>& wheel : gBakedWheels)
+		for (BakedMesh& baked : wheel)
+			meshes.push_back(&baked.mesh);
+	UCreateSharedGeometry(meshes.data(), (int)meshes.size());
+
+	//Create Shader
+	ProfileScope decodeWaitScope("wait texture decode");
+	decodeThread.join();
+	decodeWaitScope.end();
+	bool texturesLoaded = true;
+	if (gOptions.textureArrays)
+		texturesLoaded = UCreateTextureArrays(decodedImages, TEXTURE_COUNT);
+	else {
+		for (int i = 0; i < TEXTURE_COUNT; i++) {
+			if (!UUploadTexture(decodedImages[i], gTextures[i])) {
+				std::cout << "Failed to load texture " << texFilename[i] << std::endl;
+				texturesLoaded = false;
+			}
+		}
 	}
-	if (!CreateTexture(texFilename[1], texture2))
-	{
-		std::cout << "Failed to load texture " << texFilename[1] << std::endl;
+	if (!texturesLoaded)
 		return EXIT_FAILURE;
-	}
-	if (!CreateTexture(texFilename[2], texture3))
-	{
-		std::cout << "Failed to load texture " << texFilename[2] << std::endl;
+	CreateSamplers(gSamplers);
+	if (gOptions.textureArrays)
+		BindTextureArrays(gTextureArrays, gSamplers.samplers[SamplerIndex(SAMPLER_WRAP_REPEAT, gOptions.textureFilter)]);
+	UCreateSceneMaterials();
+	if (!UCreateSceneBuffers())
 		return EXIT_FAILURE;
-	}
-	if (!CreateTexture(texFilename[3], texture4))
-	{
-		std::cout << "Failed to load texture " << texFilename[3] << std::endl;
+	UBuildScene();
+	CreateOcclusionQueries(gOcclusion, gScene.groupCount);
+
+	std::vector<Shader*> shaders = { &lightShader, &basicShader };
+	if (gOcclusionShader)
+		shaders.push_back(gOcclusionShader.get());
+	if (!UFinishShaders(shaders.data(), (int)shaders.size()))
 		return EXIT_FAILURE;
+	if (gOcclusionShader) {
+		gOcclusionUniforms.viewProjection = gOcclusionShader->uniform<glm::mat4>(UNIFORM("viewProjection"));
+		gOcclusionUniforms.boxMin = gOcclusionShader->uniform<glm::vec3>(UNIFORM("boxMin"));
+		gOcclusionUniforms.boxMax = gOcclusionShader->uniform<glm::vec3>(UNIFORM("boxMax"));
 	}
-	if (!CreateTexture(texFilename[4], texture5))
-	{
-		std::cout << "Failed to load texture " << texFilename[4] << std::endl;
-		return EXIT_FAILURE;
+	if (!gProgramCacheDir.empty())
+		std::cout << "INFO: Program cache " << gProgramCacheDir << ": " << gProgramCacheStats.hits << " hits, "
+			<< gProgramCacheStats.misses << " misses, " << gProgramCacheStats.rejected << " rejected" << std::endl;
+	ULightVariant(gSceneShading);
+	CreateUniformBlockBuffers(gUniformBlocks, SceneLights());
+	//DrawTorus(gTorus, 10.0, 30.0, 30, 36, gTextures[TEXTURE_PAVEMENT], 2, 1.0f, 1.0f, 0.0f); //Not working yet
+	//Sets the background color of the window to block (it will be implicitely used by glClear)
+
+
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	startupScope.end();
+#ifndef THECAR_NO_GLFW
+	if (!gOptions.headless)
+		glfwSetKeyCallback(gWindow, key_callback);
+#endif
+	int exitCode = EXIT_SUCCESS;
+	if (!gOptions.goldenDir.empty()) {
+		//Golden image run: render the fixed poses instead of the frame loop
+		if (!URunGoldenTests(basicShader))
+			exitCode = EXIT_GOLDEN_MISMATCH;
 	}
-	if (!CreateTexture(texFilename[5], texture6))
-	{
-		std::cout << "Failed to load texture " << texFilename[5] << std::endl;
-		return EXIT_FAILURE;
+
+	//render loop
+	//----------
+	std::vector<float> frameTimes; //CPU time of each frame in milliseconds
+	std::vector<FrameSample> benchSamples;
+	if (gOptions.frames > 0) {
+		frameTimes.reserve(gOptions.frames);
+		benchSamples.reserve(gOptions.frames);
 	}
-	if (!CreateTexture(texFilename[6], texture7))
-	{
-		std::cout << "Failed to load texture " << texFilename[6] << std::endl;
-		return EXIT_FAILURE;
+	const bool benchmarking = !gOptions.benchPath.empty();
+	const auto startTime = std::chrono::steady_clock::now();
+	int f = 0;
+	while (!UShouldClose(f)) {
+
+		//input
+		//-----
+		PROFILE_SCOPE("frame");
+		const auto frameStart = std::chrono::steady_clock::now();
+		gFrameIndex = f;
+		if (benchmarking) {
+			//Scripted runs advance by a fixed step so every run sees the same camera poses
+			gDeltaTime = BENCH_TIME_STEP;
+			UApplyCameraPath(f);
+		}
+		else {
+			float currentFrame = std::chrono::duration<float>(frameStart - startTime).count();
+			gDeltaTime = currentFrame - gLastFrame;
+			gLastFrame = currentFrame;
+		}
+		gFrameStats = FrameStats();
+
+		//Render this frame
+		gGpuProfiler.beginFrame();
+		const bool rendered = URender(basicShader);//Pass the difference 
+		//URender(ourShader);
+		gGpuProfiler.endFrame();
+		if (!rendered) {
+			std::cout << "ERROR::RENDER::FRAME_RING_UNAVAILABLE stopping at frame " << f << std::endl;
+			exitCode = EXIT_FAILURE;
+			break;
+		}
+		const auto submitEnd = std::chrono::steady_clock::now();
+		ProfileScope presentScope("UPresentFrame");
+		UPresentFrame();
+		presentScope.end();
+
+		const auto frameEnd = std::chrono::steady_clock::now();
+		float frameMs = std::chrono::duration<float, std::milli>(frameEnd - frameStart).count();
+		frameTimes.push_back(frameMs);
+		RecordFrameStats();
+		if (benchmarking) {
+			float cpuMs = std::chrono::duration<float, std::milli>(submitEnd - frameStart).count();
+			benchSamples.push_back({ frameMs, cpuMs, gFrameStats.drawCalls, gFrameStats.stateChanges });
+		}
+		f++;
 	}
-	if (!CreateTexture(texFilename[7], texture8))
-	{
-		std::cout << "Failed to load texture " << texFilename[7] << std::endl;
-		return EXIT_FAILURE;
+
+	UPrintFrameTimeSummary(frameTimes);
+	if (benchmarking) {
+		if (WriteBenchmarkJson(gOptions.benchOut.c_str(), benchSamples, gOptions.benchPath,
+			(const char*)glGetString(GL_RENDERER), gViewportWidth, gViewportHeight))
+			std::cout << "INFO: Benchmark results written to " << gOptions.benchOut << std::endl;
 	}
-	if (!CreateTexture(texFilename[8], texture9))
-	{
-		std::cout << "Failed to load texture " << texFilename[8] << std::endl;
-		return EXIT_FAILURE;
+	if (!gOptions.recordPath.empty())
+		UWriteRecording(gOptions.recordPath);
+	if (!gOptions.glStatsPath.empty()) {
+		PrintFrameStatsSummary();
+		std::cout << "INFO: Frame ring " << FRAME_RING_FRAMES << " x " << gFrameRing.regionSize / 1024 << " KB, " << gFrameRing.stalls << " of "
+			<< gFrameRing.frames << " frames waited for the GPU, grown " << gFrameRing.grows << " times" << std::endl;
+		std::cout << "INFO: Culling: " << gScene.visibleDraws << " of " << gScene.draws.size() << " scene draws visible in the last frame, " << CullKernelName() << " kernel" << std::endl;
+		if (gOptions.occlusion)
+			std::cout << "INFO: Occlusion: " << gOcclusion.testedGroups << " of " << gScene.groupCount << " cars tested in the last frame, "
+				<< CountHiddenGroups(gOcclusion) << " of them hidden" << std::endl;
+		if (WriteFrameStatsCsv(gOptions.glStatsPath.c_str()))
+			std::cout << "INFO: GL call stats written to " << gOptions.glStatsPath << std::endl;
 	}
-	if (!CreateTexture(texFilename[9], texture10))
-	{
-		std::cout << "Failed to load texture " << texFilename[9] << std::endl;
-		return EXIT_FAILURE;
+	if (!gOptions.tracePath.empty())
+		WriteChromeTrace(gOptions.tracePath.c_str());
+	gGpuProfiler.finish();
+	gGpuProfiler.printSummary();
+	gGpuProfiler.destroy();
+	GLenum glError = glGetError();
+	if (glError != GL_NO_ERROR) {
+		std::cout << "ERROR::GL: 0x" << std::hex << glError << std::dec << " raised while rendering" << std::endl;
+		exitCode = EXIT_GL_ERROR;
 	}
-	if (!CreateTexture(texFilename[10], texture11))
-	{
-		std::cout << "Failed to load texture " << texFilename[10] << std::endl;
-		return EXIT_FAILURE;
+
+
+	//Release shader program
+	UDestroySharedGeometry();
+	for (int i = 0; i < TEXTURE_COUNT; i++)
+		DestroyTexture(gTextures[i]);
+	DestroyTextureArrays(gTextureArrays);
+	DestroySamplers(gSamplers);
+	glDeleteBuffers(1, &gMaterialBuffer);
+	DestroyFrameRing(gFrameRing);
+	DestroyOcclusionQueries(gOcclusion);
+	gOcclusionShader.reset();
+	DestroyUniformBlockBuffers(gUniformBlocks);
+	gScene = SceneGraph();	//Joins the cull worker threads before exit
+
+	UShutdown();
+	return exitCode; //Terminates the program, non-zero if rendering raised a GL error
+}
+
+/*
+* Command line parsing.
+* --headless       render offscreen (EGL/FBO) instead of opening a window
+* --frames N       render N frames then exit
+* --size WxH       framebuffer size, defaults to the window size
+* --bench FILE     drive the camera along a camera path file, frames default to the path length
+* --bench-out FILE benchmark result JSON, defaults to benchmark.json
+* --record FILE    record key presses of a windowed run as a camera path file
+* --compare A B    compare two benchmark result files and exit
+* --gl-stats FILE  flag redundant GL state changes and write per-frame call counts as CSV
+* --gpu-profile    print GPU time (and shader invocations where supported) per render scope
+* --trace FILE     write startup and per-frame CPU scopes as a Chrome trace JSON
+* --golden DIR     render the golden poses headless and compare them with DIR/<pose>.png
+* --golden-update  write the rendered poses to the --golden directory instead of comparing
+* --golden-out DIR where actual and diff images of failing poses go, defaults to golden_out
+* --golden-tolerance N  per-channel difference still counted as a match, defaults to 8
+* --shader-cache DIR    where linked program binaries are kept between runs, defaults to shader_cache
+* --no-shader-cache     always compile the shaders from source
+* --flashlight     adds a spot light following the camera (LIGHT_SPOT shader variant)
+* --texture-filter linear|trilinear|anisotropic  how the materials sample their maps, defaults to linear
+* --texture-arrays    stores the maps as texture array layers, so switching materials binds no texture
+* --cars N         draws N cars in a grid around the first one, defaults to 1
+* --no-multi-draw  one instanced draw per command instead of one multi-draw per pass
+* --no-bake        draws every part of the cars on its own instead of the baked body and wheel meshes
+* --no-cull        draws every object, also those outside the view frustum
+* --occlusion      skips the cars the last frame found hidden behind others, at one pass per car
+*/
+bool UParseArguments(int argc, char* argv[], RunOptions& options) {
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		const int values = UArgumentValueCount(arg);
+		if (i + values >= argc) {
+			std::cout << arg << " expects " << (values == 1 ? "a value" : "two values") << std::endl;
+			return false;
+		}
+		if (arg == "--headless") {
+			options.headless = true;
+		}
+		else if (arg == "--frames") {
+			options.frames = atoi(argv[++i]);
+			if (options.frames <= 0) {
+				std::cout << "--frames expects a positive frame count" << std::endl;
+				return false;
+			}
+		}
+		else if (arg == "--size") {
+			if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 || options.width <= 0 || options.height <= 0) {
+				std::cout << "--size expects WIDTHxHEIGHT, e.g. 800x600" << std::endl;
+				return false;
+			}
+		}
+		else if (arg == "--bench") {
+			options.benchPath = argv[++i];
+		}
+		else if (arg == "--bench-out") {
+			options.benchOut = argv[++i];
+		}
+		else if (arg == "--record") {
+			options.recordPath = argv[++i];
+		}
+		else if (arg == "--gl-stats") {
+			options.glStatsPath = argv[++i];
+		}
+		else if (arg == "--trace") {
+			options.tracePath = argv[++i];
+		}
+		else if (arg == "--golden") {
+			options.goldenDir = argv[++i];
+		}
+		else if (arg == "--golden-update") {
+			options.goldenUpdate = true;
+		}
+		else if (arg == "--golden-out") {
+			options.goldenOut = argv[++i];
+		}
+		else if (arg == "--golden-tolerance") {
+			options.goldenTolerance = atoi(argv[++i]);
+		}
+		else if (arg == "--shader-cache") {
+			options.shaderCacheDir = argv[++i];
+		}
+		else if (arg == "--no-shader-cache") {
+			options.shaderCacheDir.clear();
+		}
+		else if (arg == "--flashlight") {
+			options.flashlight = true;
+		}
+		else if (arg == "--texture-filter") {
+			std::string filter = argv[++i];
+			if (filter == "linear")
+				options.textureFilter = SAMPLER_FILTER_LINEAR;
+			else if (filter == "trilinear")
+				options.textureFilter = SAMPLER_FILTER_TRILINEAR;
+			else if (filter == "anisotropic")
+				options.textureFilter = SAMPLER_FILTER_ANISOTROPIC;
+			else {
+				std::cout << "--texture-filter expects linear, trilinear or anisotropic" << std::endl;
+				return false;
+			}
+		}
+		else if (arg == "--texture-arrays") {
+			options.textureArrays = true;
+		}
+		else if (arg == "--cars") {
+			options.cars = atoi(argv[++i]);
+			if (options.cars <= 0) {
+				std::cout << "--cars expects a positive car count" << std::endl;
+				return false;
+			}
+		}
+		else if (arg == "--no-multi-draw") {
+			options.multiDraw = false;
+		}
+		else if (arg == "--no-bake") {
+			options.bake = false;
+		}
+		else if (arg == "--no-cull") {
+			options.cull = false;
+		}
+		else if (arg == "--occlusion") {
+			options.occlusion = true;
+		}
+		else if (arg == "--gpu-profile") {
+			options.gpuProfile = true;
+		}
+		else if (arg == "--compare") {
+			options.compareA = argv[++i];
+			options.compareB = argv[++i];
+		}
+		else {
+			std::cout << "Unknown argument: " << arg << std::endl;
+			std::cout << "Usage: " << argv[0] << " [--headless] [--frames N] [--size WxH] [--bench PATH] [--bench-out FILE] [--record FILE] [--compare A B] [--gl-stats FILE] [--gpu-profile] [--trace FILE] [--golden DIR [--golden-update] [--golden-out DIR] [--golden-tolerance N]] [--shader-cache DIR | --no-shader-cache] [--flashlight] [--texture-filter linear|trilinear|anisotropic] [--texture-arrays] [--cars N] [--no-multi-draw] [--no-bake] [--no-cull] [--occlusion]" << std::endl;
+			return false;
+		}
 	}
-	if (!CreateTexture(texFilename[11], texture12))
-	{
-		std::cout << "Failed to load texture " << texFilename[11] << std::endl;
-		return EXIT_FAILURE;
+#ifdef THECAR_NO_GLFW
+	//Built without a window system, offscreen is the only option
+	options.headless = true;
+#endif
+	if (!options.goldenDir.empty()) {
+		//References are stored at a fixed size and always rendered offscreen
+		options.headless = true;
+		options.width = GOLDEN_WIDTH;
+		options.height = GOLDEN_HEIGHT;
 	}
-	if (!CreateTexture(texFilename[12], texture13))
-	{
-		std::cout << "Failed to load texture " << texFilename[12] << std::endl;
-		return EXIT_FAILURE;
+	else if (options.goldenUpdate) {
+		std::cout << "--golden-update needs --golden DIR" << std::endl;
+		return false;
 	}
-	if (!CreateTexture(texFilename[13], texture14))
+	if (options.headless && options.frames == 0 && options.benchPath.empty())
+		options.frames = DEFAULT_HEADLESS_FRAMES;
+	return true;
+}
+
+//Values the flag arg is followed by, 0 for flags that take none
+int UArgumentValueCount(const std::string& arg) {
+
+	static const char* const ONE_VALUE[] = { "--frames", "--size", "--bench", "--bench-out", "--record", "--gl-stats", "--trace",
+		"--golden", "--golden-out", "--golden-tolerance", "--shader-cache", "--texture-filter", "--cars" };
+	if (arg == "--compare")
+		return 2;
+	for (const char* flag : ONE_VALUE)
+		if (arg == flag)
+			return 1;
+	return 0;
+}
+
+//Moves the camera for one key press (W/A/S/D forward, left, back, right, Q/E down, up)
+void UMoveCamera(char key, float deltaTime) {
+
+	float cameraOffset = cameraSpeed * deltaTime;
+	switch (key)
 	{
-		std::cout << "Failed to load texture " << texFilename[13] << std::endl;
-		return EXIT_FAILURE;
+	case 'W': gCamera.ProcessKeyboard(Camera_Movement::FORWARD, cameraOffset); break;
+	case 'S': gCamera.ProcessKeyboard(Camera_Movement::BACKWARD, cameraOffset); break;
+	case 'A': gCamera.ProcessKeyboard(Camera_Movement::LEFT, cameraOffset); break;
+	case 'D': gCamera.ProcessKeyboard(Camera_Movement::RIGHT, cameraOffset); break;
+	case 'Q': gCamera.ProcessKeyboard(Camera_Movement::DOWN, cameraOffset); break;
+	case 'E': gCamera.ProcessKeyboard(Camera_Movement::UP, cameraOffset); break;
+	default: break;
 	}
-	//DrawTorus(gTorus, 10.0, 30.0, 30, 36, texture1, 2, 1.0f, 1.0f, 0.0f); //Not working yet
-	//Sets the background color of the window to block (it will be implicitely used by glClear)
+}
 
-	lightShader.use();
-	lightShader.setInt("material.diffuse", 0);
-	lightShader.setInt("material.specular", 1);
+//Poses gCamera for a benchmark frame: spline keys first, then any recorded key presses of that frame
+void UApplyCameraPath(int frame) {
 
+	if (!gCameraPath.keys.empty()) {
+		CameraKey pose = SampleCameraPath(gCameraPath, frame * BENCH_TIME_STEP);
+		gCamera.SetPose(pose.position, pose.yaw, pose.pitch);
+	}
+	for (const InputEvent& event : gCameraPath.inputs) {
+		if (event.frame == frame)
+			UMoveCamera(event.key, event.deltaTime);
+	}
+}
 
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-	//render loop
-	//----------
-	int f = 0;
-	while (!glfwWindowShouldClose(gWindow)) {
+//Writes the key presses captured by key_callback in the camera path format
+bool UWriteRecording(const std::string& filename) {
 
-		//input
-		//-----
-		float currentFrame = (float) glfwGetTime();
-		gDeltaTime = currentFrame - gLastFrame;
-		gLastFrame = currentFrame;
+	std::ofstream out(filename);
+	if (!out.good()) {
+		std::cout << "Failed to write recording " << filename << std::endl;
+		return false;
+	}
+	out << "# Recorded input: input <frame> <key> <delta time>\n";
+	for (const InputEvent& event : gRecordedInput)
+		out << "input " << event.frame << " " << event.key << " " << event.deltaTime << "\n";
+	std::cout << "INFO: Recorded " << gRecordedInput.size() << " key presses to " << filename << std::endl;
+	return true;
+}
 
-		//UProcessInput(gWindow);
-		glfwSetKeyCallback(gWindow, key_callback);
-		//Render this frame
-		
-		URender(lightShader, basicShader);//Pass the difference 
-		//URender(ourShader);
+//Creates the light shader variant for the features and submits it for compilation, without waiting for the result
+LightVariant& USubmitLightVariant(uint32_t features) {
 
-		glfwPollEvents();
+	std::unique_ptr<LightVariant>& variant = gLightVariants[features];
+	if (!variant) {
+		PROFILE_SCOPE("USubmitLightVariant");
+		variant = std::make_unique<LightVariant>(features,
+			InjectShaderFeatures(lightVertexShaderSource, features, ShaderDrawIdPrelude(gMultiDraw)),
+			InjectShaderFeatures(lightFragmentShaderSource, features));
 	}
+	return *variant;
+}
 
+//Light shader variant ready to draw with, compiled and linked now if it was never requested before
+LightVariant& ULightVariant(uint32_t features) {
 
-	//Release shader program
-	UDestroyMesh(gPlane);
-	//UDestroyMesh(gTorus);
-	UDestroyMesh(gWing);
-	UDestroyMesh(gWheel);
-	UDestroyMesh(gCHub);
-	UDestroyMesh(gTire);
-	UDestroyMesh(gSpoke);
-	UDestroyMesh(gCenterTop);
-	UDestroyMesh(gFront);
-	UDestroyMesh(gSides);
-	UDestroyMesh(gRear);
-	UDestroyMesh(gTop);
-	DestroyTexture(texture1);
-	DestroyTexture(texture2);
-	DestroyTexture(texture3);
-	DestroyTexture(texture4);
-	DestroyTexture(texture5);
-	DestroyTexture(texture6);
-	DestroyTexture(texture7);
-	DestroyTexture(texture8);
-	DestroyTexture(texture9);
-	DestroyTexture(texture10);
-
-	exit(EXIT_SUCCESS); //Terminates the program successfully
+	LightVariant& variant = USubmitLightVariant(features);
+	if (!variant.resolved) {
+		if (!variant.shader.finish())
+			std::cout << "ERROR::SHADER::VARIANT_NOT_LINKED " << ShaderFeatureString(features) << std::endl;
+		UResolveLightUniforms(variant);
+		variant.resolved = true;
+	}
+	return variant;
+}
+
+//Looks up the uniform handles of a light shader variant once, after it is linked.
+//Uniforms of lights the variant leaves out are compiled away, their handles stay inactive without a warning.
+void UResolveLightUniforms(LightVariant& variant) {
+
+	const Shader& shader = variant.shader;
+	LightShaderUniforms& uniforms = variant.uniforms;
+	uniforms.drawBase = shader.uniform<int>(UNIFORM("drawBase"));
+	//TEXTURE_ARRAY variants sample textureArrays[] instead, on units fixed in the shader
+	const bool textureUnits = (variant.features & TEXTURE_ARRAY) == 0;
+	uniforms.materialDiffuse = shader.uniform<int>(UNIFORM("material.diffuse"), textureUnits);
+	uniforms.materialSpecular = shader.uniform<int>(UNIFORM("material.specular"), false);
+	uniforms.spotPosition = shader.uniform<glm::vec3>(UNIFORM("spotLight.position"), false);
+	uniforms.spotDirection = shader.uniform<glm::vec3>(UNIFORM("spotLight.direction"), false);
+	uniforms.spotCutOff = shader.uniform<float>(UNIFORM("spotLight.cutOff"), false);
+	uniforms.spotOuterCutOff = shader.uniform<float>(UNIFORM("spotLight.outerCutOff"), false);
+	uniforms.spotConstant = shader.uniform<float>(UNIFORM("spotLight.constant"), false);
+	uniforms.spotLinear = shader.uniform<float>(UNIFORM("spotLight.linear"), false);
+	uniforms.spotQuadratic = shader.uniform<float>(UNIFORM("spotLight.quadratic"), false);
+	uniforms.spotAmbient = shader.uniform<glm::vec3>(UNIFORM("spotLight.ambient"), false);
+	uniforms.spotDiffuse = shader.uniform<glm::vec3>(UNIFORM("spotLight.diffuse"), false);
+	uniforms.spotSpecular = shader.uniform<glm::vec3>(UNIFORM("spotLight.specular"), false);
+
+	CheckUniformBlockSize(shader.ID, "FrameBlock", sizeof(FrameBlock));
+	if (variant.features & (LIGHT_DIR | LIGHT_POINT))
+		CheckUniformBlockSize(shader.ID, "LightBlock", sizeof(LightBlock));
+
+	variant.shader.use();
+	variant.shader.set(uniforms.materialDiffuse, 0);
+	variant.shader.set(uniforms.materialSpecular, 1);
+}
+
+//Renders every golden pose offscreen and compares it with its reference, or writes the references with --golden-update
+bool URunGoldenTests(Shader& bShader) {
+
+	namespace fs = std::filesystem;
+	const int width = gViewportWidth;
+	const int height = gViewportHeight;
+	const fs::path outDir = gOptions.goldenUpdate ? fs::path(gOptions.goldenDir) : fs::path(gOptions.goldenOut);
+	std::error_code error;
+	fs::create_directories(outDir, error);
+
+	std::vector<unsigned char> actual((size_t)width * height * 3);
+	std::vector<unsigned char> diff;
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	int failures = 0;
+	for (const GoldenPose& pose : GOLDEN_POSES) {
+		gCamera.SetPose(pose.position, pose.yaw, pose.pitch);
+		bool rendered = true;
+		for (int i = 0; i <= GOLDEN_WARMUP_FRAMES; i++)
+			rendered = URender(bShader) && rendered;
+		if (!rendered)
+			return false;
+		glFinish();
+		glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, actual.data());
+		flipImageVertically(actual.data(), width, height, 3); //GL rows start at the bottom, PNG rows at the top
+
+		const std::string file = std::string(pose.name) + ".png";
+		if (gOptions.goldenUpdate) {
+			if (!WritePng((outDir / file).string().c_str(), actual.data(), width, height, 3)) {
+				std::cout << "ERROR::GOLDEN::FILE_NOT_WRITTEN " << (outDir / file).string() << std::endl;
+				failures++;
+			}
+			continue;
+		}
+
+		const std::string referencePath = (fs::path(gOptions.goldenDir) / file).string();
+		int refWidth, refHeight, refChannels;
+		unsigned char* reference = stbi_load(referencePath.c_str(), &refWidth, &refHeight, &refChannels, 3);
+		if (!reference) {
+			std::cout << "ERROR::GOLDEN::REFERENCE_NOT_FOUND " << referencePath << std::endl;
+			failures++;
+			continue;
+		}
+		if (refWidth != width || refHeight != height) {
+			std::cout << "ERROR::GOLDEN::SIZE_MISMATCH " << referencePath << " is " << refWidth << "x" << refHeight << std::endl;
+			stbi_image_free(reference);
+			failures++;
+			continue;
+		}
+		GoldenResult result = CompareImages(reference, actual.data(), width, height, gOptions.goldenTolerance, diff);
+		stbi_image_free(reference);
+
+		std::cout << (result.passed() ? "PASS " : "FAIL ") << pose.name << ": max difference " << result.maxDifference
+			<< ", " << result.badPixels << " of " << result.pixels << " pixels over tolerance " << gOptions.goldenTolerance << std::endl;
+		if (!result.passed()) {
+			failures++;
+			WritePng((outDir / (std::string(pose.name) + "_actual.png")).string().c_str(), actual.data(), width, height, 3);
+			WritePng((outDir / (std::string(pose.name) + "_diff.png")).string().c_str(), diff.data(), width, height, 3);
+		}
+	}
+
+	const int poseCount = (int)(sizeof(GOLDEN_POSES) / sizeof(GOLDEN_POSES[0]));
+	if (gOptions.goldenUpdate)
+		std::cout << "INFO: " << poseCount - failures << " golden images written to " << outDir.string() << std::endl;
+	else if (failures > 0)
+		std::cout << "ERROR::GOLDEN::MISMATCH " << failures << " of " << poseCount << " poses differ, see " << outDir.string() << std::endl;
+	else
+		std::cout << "INFO: All " << poseCount << " golden poses match" << std::endl;
+	return failures == 0;
 }
 
 //Initialize GLFW, GLEW, and create a wiundow
 bool UInitialize(int argc, char* argv[], GLFWwindow** window) {
 
-	//GLFW: initialize and configure
-	//------------------------------
-	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	PROFILE_SCOPE("UInitialize");
+	if (gOptions.headless) {
+#ifdef THECAR_HAS_EGL
+		//EGL: surfaceless context, nothing is shown on screen
+		//-----------------------------------------------------
+		if (!CreateHeadlessContext(gHeadlessContext))
+			return false;
+#elif !defined(THECAR_NO_GLFW)
+		//No EGL available: an invisible GLFW window only provides the context
+		//--------------------------------------------------------------------
+		glfwInit();
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		*window = glfwCreateWindow(1, 1, WINDOW_TITLE, NULL, NULL);
+		if (*window == NULL) {
+			std::cout << "Failed to create hidden GLFW window" << std::endl;
+			glfwTerminate();
+			return false;
+		}
+		glfwMakeContextCurrent(*window);
+#else
+		std::cout << "Headless mode needs EGL or GLFW, neither was available at build time" << std::endl;
+		return false;
+#endif
+	}
+	else {
+#ifndef THECAR_NO_GLFW
+		//GLFW: initialize and configure
+		//------------------------------
+		glfwInit();
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif // 
 
-	//GLFW: window creation
-	//---------------------
-	* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
-	if (*window == NULL) {
-		std::cout << "Failed to create GLFW window" << std::endl;
-		glfwTerminate();
-		return false;
+		//GLFW: window creation
+		//---------------------
+		* window = glfwCreateWindow(gOptions.width, gOptions.height, WINDOW_TITLE, NULL, NULL);
+		if (*window == NULL) {
+			std::cout << "Failed to create GLFW window" << std::endl;
+			glfwTerminate();
+			return false;
+		}
+		glfwMakeContextCurrent(*window);
+		glfwSetFramebufferSizeCallback(*window, UResizeWindow);
+		glfwSetCursorPosCallback(*window, UMousePositionCallback);
+		glfwSetScrollCallback(*window, UMouseScrollCallback);
+		glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+
+		// tell GLFW to capture our mouse
+		glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+		glfwGetFramebufferSize(*window, &gViewportWidth, &gViewportHeight);
+#endif
 	}
-	glfwMakeContextCurrent(*window);
-	glfwSetFramebufferSizeCallback(*window, UResizeWindow);
-	glfwSetCursorPosCallback(*window, UMousePositionCallback);
-	glfwSetScrollCallback(*window, UMouseScrollCallback);
-	glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
 
-	// tell GLFW to capture our mouse
-	glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+#ifndef THECAR_NO_GLEW
 	//GLEW: initalize
 	//---------------
 	//NoteL if using GFLEW version 1.13 or earlier
@@ -891,16 +1732,233 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window) {
 		std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
 		return false;
 	}
+#endif
 
 	//Displays GPU OpenGL version
 	std::cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << std::endl;
+	std::cout << "INFO: OpenGL Renderer: " << glGetString(GL_RENDERER) << std::endl;
+
+	if (gOptions.headless) {
+		//Render into an FBO in place of the window's back buffer
+		if (!CreateOffscreenTarget(gOffscreen, gOptions.width, gOptions.height))
+			return false;
+		gViewportWidth = gOptions.width;
+		gViewportHeight = gOptions.height;
+	}
 
 	return true;
 }
 
-//Function called to render a frame
-void URender(Shader aShader, Shader bShader) {
+//Release the offscreen target and context / window
+void UShutdown() {
+
+	if (gOptions.headless)
+		DestroyOffscreenTarget(gOffscreen);
+#ifdef THECAR_HAS_EGL
+	DestroyHeadlessContext(gHeadlessContext);
+#endif
+#ifndef THECAR_NO_GLFW
+	if (gWindow != nullptr)
+		glfwTerminate();
+#endif
+}
+
+//Lets the driver compile and link on its own threads when it exposes GL_KHR_parallel_shader_compile (or the ARB twin).
+//The entry point is not part of core GL, so it is looked up through EGL or GLFW rather than linked directly.
+void UEnableParallelShaderCompile() {
+
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+	const char* entryPoint = nullptr;
+	for (GLint i = 0; i < extensionCount && entryPoint == nullptr; i++) {
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+		if (strcmp(extension, "GL_KHR_parallel_shader_compile") == 0)
+			entryPoint = "glMaxShaderCompilerThreadsKHR";
+		else if (strcmp(extension, "GL_ARB_parallel_shader_compile") == 0)
+			entryPoint = "glMaxShaderCompilerThreadsARB";
+	}
+	if (entryPoint == nullptr) {
+		std::cout << "INFO: Parallel shader compile not supported, shaders compile on first status query" << std::endl;
+		return;
+	}
+
+	PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads = nullptr;
+#ifdef THECAR_HAS_EGL
+	if (gOptions.headless)
+		maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)eglGetProcAddress(entryPoint);
+#endif
+#ifndef THECAR_NO_GLFW
+	if (maxShaderCompilerThreads == nullptr && gWindow != nullptr)
+		maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress(entryPoint);
+#endif
+	if (maxShaderCompilerThreads != nullptr)
+		maxShaderCompilerThreads(0xFFFFFFFFu); //Implementation-chosen thread count
+	Shader::parallelCompile = true; //Completion can be polled even when the thread count keeps its default
+	std::cout << "INFO: Parallel shader compile enabled" << std::endl;
+}
+
+//Polls the submitted programs and finishes each one as soon as the driver reports it complete, false if any failed to link
+bool UFinishShaders(Shader* shaders[], int count) {
+
+	PROFILE_SCOPE("UFinishShaders");
+	std::vector<Shader*> pending(shaders, shaders + count);
+	bool linked = true;
+	while (!pending.empty()) {
+		auto ready = std::find_if(pending.begin(), pending.end(), [](const Shader* shader) { return shader->isReady(); });
+		if (ready == pending.end()) {
+			std::this_thread::yield();
+			continue;
+		}
+		linked = (*ready)->finish() && linked;
+		pending.erase(ready);
+	}
+	return linked;
+}
+
+//End of frame: swap the window buffers, or wait for the offscreen frame to finish so frame times include GPU work
+void UPresentFrame() {
+
+	if (gOptions.headless) {
+		glFinish();
+		return;
+	}
+#ifndef THECAR_NO_GLFW
+	//glfw: swap buffers and poll IO events (keys pressed/release, mouse moved etc.)
+	glfwSwapBuffers(gWindow); //Flips the back buffer with the front buffer every frame.
+	glfwPollEvents();
+#endif
+}
+
+//Render loop exit condition: frame budget reached or window closed
+bool UShouldClose(int frame) {
+
+	if (!gOptions.goldenDir.empty())
+		return true; //Golden runs render their poses before the loop
+
+	if (gOptions.frames > 0 && frame >= gOptions.frames)
+		return true;
+#ifndef THECAR_NO_GLFW
+	if (!gOptions.headless)
+		return glfwWindowShouldClose(gWindow);
+#endif
+	return false;
+}
+
+//Prints frame count, mean / median / min / max frame time and the matching frame rate
+void UPrintFrameTimeSummary(const std::vector<float>& frameTimes) {
+
+	if (frameTimes.empty())
+		return;
+	std::vector<float> sorted(frameTimes);
+	std::sort(sorted.begin(), sorted.end());
+	double total = 0.0;
+	for (float t : sorted)
+		total += t;
+	double mean = total / sorted.size();
+
+	std::cout << "INFO: Frames: " << sorted.size()
+		<< " | Size: " << gViewportWidth << "x" << gViewportHeight
+		<< " | Total: " << total << " ms" << std::endl;
+	std::cout << "INFO: Frame time (ms) mean: " << mean
+		<< " median: " << sorted[sorted.size() / 2]
+		<< " min: " << sorted.front()
+		<< " max: " << sorted.back()
+		<< " | " << (mean > 0.0 ? 1000.0 / mean : 0.0) << " fps" << std::endl;
+}
+
+//Where car number car stands: rows of cars side by side, alternating right and left of the first one, the rows
+//alternating behind and in front of it. Car 0 is at the origin, where the scene's single car always stood.
+glm::vec3 UCarOffset(int car) {
+
+	const int columns = (int)std::ceil(std::sqrt((float)gOptions.cars));
+	const int column = car % columns;
+	const int row = car / columns;
+	const float x = (float)((column + 1) / 2) * (column % 2 ? CAR_GRID_COLUMN_PITCH : -CAR_GRID_COLUMN_PITCH);
+	const float z = (float)((row + 1) / 2) * (row % 2 ? -CAR_GRID_ROW_PITCH : CAR_GRID_ROW_PITCH);
+	return glm::vec3(x, 0.0f, z);
+}
+
+//Builds gScene: the ground, then every car under its own node at UCarOffset with its body and four wheels, either
+//baked (one draw per material of the body and of each wheel) or part by part. With occlusion culling car i is
+//occlusion group i + 1.
+void UBuildScene() {
+
+	gScene = SceneGraph();
+	glm::mat4 model = glm::scale(glm::mat4(1.0f), glm::vec3(100.0f, 1.0f, 100.0f));
+	gScene.addDraw(gScene.addNode(SCENE_NO_PARENT, model), gPlane, gPlane.material, false, { { GL_TRIANGLES, 0, gPlane.nIndices } }, RENDER_LAYER_OPAQUE, RENDER_CATEGORY_GROUND);
+
+	for (int i = 0; i < gOptions.cars; i++) {
+		const SceneNodeId car = gScene.addNode(SCENE_NO_PARENT, glm::translate(glm::mat4(1.0f), UCarOffset(i)), gOptions.occlusion ? i + 1 : 0);
+		if (!gOptions.bake) {
+			UAddCarParts(gScene, car, true);
+			continue;
+		}
+		//The baked meshes are in their root's space, the car and wheel nodes only translate: uniform scale
+		for (const BakedMesh& baked : gBakedCar)
+			gScene.addDraw(car, baked.mesh, baked.mesh.material, true, { { baked.mode, 0, baked.mesh.nIndices } }, baked.layer, baked.category);
+		for (int wheel = 0; wheel < 4; wheel++) {
+			const SceneNodeId node = gScene.addNode(car, glm::translate(glm::mat4(1.0f), CAR_WHEEL_LOCATIONS[wheel]));
+			for (const BakedMesh& baked : gBakedWheels[CAR_WHEEL_SIDES[wheel]])
+				gScene.addDraw(node, baked.mesh, baked.mesh.material, true, { { baked.mode, 0, baked.mesh.nIndices } }, baked.layer, baked.category);
+		}
+	}
+}
+
+//Adds the wing and body parts of a car under car, and its four wheels when wheels is set
+void UAddCarParts(SceneGraph& scene, SceneNodeId car, bool wheels) {
+
+	glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 4.05f, 0.6f));
+	model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+	model = glm::scale(model, glm::vec3(1.0f, 1.25f, 1.25f));
+	scene.addDraw(scene.addNode(car, model), gWing, gWing.material, false, { { GL_TRIANGLES, 0, gWing.nIndices } }, RENDER_LAYER_OPAQUE, RENDER_CATEGORY_WING);
+
+	for (int wheel = 0; wheels && wheel < 4; wheel++) {
+		const int side = CAR_WHEEL_SIDES[wheel];
+		UAddWheel(scene, car, gTire, gWheel, gCHub, gSpoke, CAR_WHEEL_LOCATIONS[wheel], CAR_WHEEL_SCALE, CAR_WHEEL_ROTATIONS[side], side == 1);
+	}
+	UAddCar(scene, car, gBody, gFront, gRear, gSides, gCenterTop, gTop, CAR_BODY_LOCATION, CAR_BODY_SCALE, 0.0f);
+}
 
+//Bakes the car body with its wing in car space and a left and a right wheel in wheel space, each into one mesh
+//per material added to the shared geometry. Runs between the mesh generators and UCreateSharedGeometry.
+bool UBakeAssemblies() {
+
+	PROFILE_SCOPE("UBakeAssemblies");
+	SceneGraph body;
+	UAddCarParts(body, body.addNode(SCENE_NO_PARENT, glm::mat4(1.0f)), false);
+	if (!UBakeAssembly(body, gBakedCar))
+		return false;
+	for (int side = 0; side < 2; side++) {
+		SceneGraph wheel;
+		UAddWheel(wheel, wheel.addNode(SCENE_NO_PARENT, glm::mat4(1.0f)), gTire, gWheel, gCHub, gSpoke, glm::vec3(0.0f), CAR_WHEEL_SCALE, CAR_WHEEL_ROTATIONS[side], side == 1);
+		if (!UBakeAssembly(wheel, gBakedWheels[side]))
+			return false;
+	}
+	return true;
+}
+
+//Merges the draws of parts into baked, appended to the shared geometry with UAddMesh
+bool UBakeAssembly(SceneGraph& parts, std::vector<BakedMesh>& baked) {
+
+	parts.update();
+	std::vector<AssemblyMesh> meshes;
+	if (!BakeAssembly(parts, gGeometry.vertices.data(), meshes))
+		return false;
+	baked.resize(meshes.size());
+	for (size_t i = 0; i < meshes.size(); i++) {
+		baked[i].mode = meshes[i].mode;
+		baked[i].layer = meshes[i].layer;
+		baked[i].category = meshes[i].category;
+		baked[i].mesh.material = meshes[i].material;
+		UAddMesh(baked[i].mesh, meshes[i].vertices);
+	}
+	return true;
+}
+
+//Function called to render a frame, false when its data could not be written to the frame ring
+bool URender(Shader& bShader) {
+
+	PROFILE_SCOPE("URender");
 	// Enable z-depth
 	glEnable(GL_DEPTH_TEST);
 
@@ -911,118 +1969,341 @@ void URender(Shader aShader, Shader bShader) {
 
 	//glBindVertexArray(gPlane.vao);
 
-	aShader.use();
-	aShader.setVec3("viewPos", gCamera.Position);
-	aShader.setFloat("material.shininess", 256.0f);
+	//Camera for every draw of this frame, written with the queue's data; the lights were uploaded once at startup
+	FrameBlock frame;
+	frame.projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)gViewportWidth / (GLfloat)gViewportHeight, 0.1f, 10000.0f);
+	frame.view = gCamera.GetViewMatrix();//Transforms the camera
+	frame.viewPos = gCamera.Position;
+
+	LightVariant& lit = ULightVariant(gSceneShading);
+	if (lit.features & LIGHT_SPOT) {
+		//Flashlight pointing where the camera looks
+		lit.shader.use();
+		lit.shader.set(lit.uniforms.spotPosition, gCamera.Position);
+		lit.shader.set(lit.uniforms.spotDirection, gCamera.Front);
+		lit.shader.set(lit.uniforms.spotCutOff, glm::cos(glm::radians(12.5f)));
+		lit.shader.set(lit.uniforms.spotOuterCutOff, glm::cos(glm::radians(15.0f)));
+		lit.shader.set(lit.uniforms.spotConstant, 1.0f);
+		lit.shader.set(lit.uniforms.spotLinear, 0.09f);
+		lit.shader.set(lit.uniforms.spotQuadratic, 0.032f);
+		lit.shader.set(lit.uniforms.spotAmbient, glm::vec3(0.0f));
+		lit.shader.set(lit.uniforms.spotDiffuse, glm::vec3(1.0f));
+		lit.shader.set(lit.uniforms.spotSpecular, glm::vec3(1.0f));
+	}
 
-	//Manually set position of light sources
-	//Direction Light
-	aShader.setVec3("dirLight.direction", 2.0f, -2.0f, 0.03f);
-	aShader.setVec3("dirLight.ambient", 0.5f, 0.5f, 0.5f);
-	aShader.setVec3("dirLight.diffuse", 0.4f, 0.4f, 0.4f);
-	aShader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
-	
-	aShader.setVec3("pointLights.position", 1.0f, 10.0f, 4.0f);
-	aShader.setVec3("pointLights.ambient", 1.0f, 1.0f, 1.0f);
-	aShader.setVec3("pointLights.diffuse", 1.0f, 1.0f, 1.0f);
-	aShader.setVec3("pointLights.specular", 0.3f, 0.3f, 0.3f);
-	aShader.setFloat("pointLights.constant", 1.0f);
-	aShader.setFloat("pointLights.linear", 0.09f);
-	aShader.setFloat("pointLights.quadratic", 0.032f);
-
-	glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 10000.0f);
-	glm::mat4 view = gCamera.GetViewMatrix();//Transforms the camera
-	aShader.setMat4("projection", projection);
-	aShader.setMat4("view", view);
-
-	glm::mat4 model = glm::mat4(1.0f);
-	aShader.setMat4("model", model);
-	//Bind diffuse map
-	glActiveTexture(GL_TEXTURE0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	gUVScale = glm::vec2(25.0f, 25.0f);
-	aShader.setVec2("uvScale", gUVScale);
-	glBindTexture(GL_TEXTURE_2D, texture1);
-	//bind specular map
-	glActiveTexture(GL_TEXTURE1);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glBindTexture(GL_TEXTURE_2D, texture2);
+	//Every draw of the frame goes through the queue, sorted by state and front to back before submission
+	const uint32_t program = lit.features;
+	gRenderQueue.clear(gCamera.Position, gMaterials);
 
-	glBindVertexArray(gPlane.vao);
-	model = glm::mat4(1.0f);
+	{
+		PROFILE_SCOPE("SceneGraph::update");
+		gScene.update();
+	}
+	if (gOptions.cull) {
+		PROFILE_SCOPE("SceneGraph::cull");
+		gScene.cull(ExtractFrustumPlanes(frame.projection * frame.view), gCullThreads);
+	}
+	gScene.submit(gRenderQueue, program);
+	if (gOptions.occlusion)
+		gScene.boundGroups();
 
-	model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-	model = glm::scale(model, glm::vec3(100.0f, 1.0f, 100.0f));
-	aShader.setMat4("model", model);
-	glDrawArrays(GL_TRIANGLES, 0, gPlane.nIndices); //Draws the triangles as Points, makes pretty cool output.
-	glBindVertexArray(0);//Deactivate the Vertex Array Object
+	{
+		PROFILE_SCOPE("RenderQueue::sort");
+		gRenderQueue.sort();
+	}
+	{
+		GpuProfileScope gpuScope(gGpuProfiler, "scene");
+		if (!USubmitRenderQueue(gRenderQueue, frame))
+			return false;
+	}
+	if (gOptions.occlusion) {
+		GpuProfileScope gpuScope(gGpuProfiler, "occlusion");
+		UTestOcclusion(frame);
+	}
+	return true;
+}
 
-	//----------------------------------------------------------------------------------------------------------
-	glBindVertexArray(gWing.vao);
-	aShader.use();
-	aShader.setVec3("viewPos", gCamera.Position);
-	aShader.setFloat("material.shininess", 256.0f);
-	aShader.setVec3("dirLight.direction", 2.0f, -2.0f, 0.03f);
-	aShader.setVec3("pointLights.ambient", 0.25f, 0.25f, 0.25f);
-	aShader.setVec3("pointLights.diffuse", 0.4f, 0.4f, 0.4f);
-	aShader.setVec3("pointLights.specular", 0.774597f, 0.774597f, 0.774597f);
-	aShader.setFloat("pointLights.constant", 1.0f);
-	aShader.setFloat("pointLights.linear", 0.09f);
-	aShader.setFloat("pointLights.quadratic", 0.032f);
-
-	view = gCamera.GetViewMatrix();//Transforms the camera
-	aShader.setMat4("projection", projection);
-	aShader.setMat4("view", view);
-
-	model = glm::mat4(1.0f);
-	aShader.setMat4("model", model);
-	//Bind diffuse map
-	glActiveTexture(GL_TEXTURE0);
-	gUVScale = glm::vec2(1.0f, 1.0f);
-	aShader.setVec2("uvScale", gUVScale);
-	glBindTexture(GL_TEXTURE_2D, texture3);
-	//bind specular map
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, texture4);
-
-	model = glm::translate(model, glm::vec3(0.0f, 4.05f, 0.6f));
+//Draws the sorted queue pass by pass, one glMultiDrawArraysIndirect each, binding only what differs between passes.
+//With --gpu-profile each RenderCategory's passes are timed in a GPU scope named after it.
+//The camera block, instances, draw records and commands go straight into this frame's region of the frame ring.
+//False, with nothing drawn, when the ring has no mapping or the frame does not fit its region.
+bool USubmitRenderQueue(RenderQueue& queue, const FrameBlock& frame) {
+
+	PROFILE_SCOPE("USubmitRenderQueue");
+	//Every item is one instance and at most DRAW_ITEM_MAX_RANGES commands and draw records
+	const size_t items = queue.order.size();
+	const size_t bytes = FrameRingSize(gFrameRing, sizeof(FrameBlock)) + FrameRingSize(gFrameRing, items * sizeof(RenderInstance))
+		+ FrameRingSize(gFrameRing, items * DRAW_ITEM_MAX_RANGES * sizeof(RenderDraw))
+		+ FrameRingSize(gFrameRing, items * DRAW_ITEM_MAX_RANGES * sizeof(DrawArraysIndirectCommand));
+	if (!BeginFrameRing(gFrameRing, bytes))
+		return false;
+	GLintptr frameOffset = 0, instanceOffset = 0, drawOffset = 0, commandOffset = 0;
+	void* frameData = FrameRingAlloc(gFrameRing, sizeof(FrameBlock), frameOffset);
+	void* instanceData = FrameRingAlloc(gFrameRing, items * sizeof(RenderInstance), instanceOffset);
+	if (!frameData || !instanceData) {
+		EndFrameRing(gFrameRing);
+		return false;
+	}
+	*(FrameBlock*)frameData = frame;
+	queue.buildPasses((RenderInstance*)instanceData);
+	//Draw records and commands are a few per pass, built in the queue and copied over
+	const size_t drawBytes = queue.draws.size() * sizeof(RenderDraw);
+	const size_t commandBytes = queue.commands.size() * sizeof(DrawArraysIndirectCommand);
+	void* drawData = FrameRingAlloc(gFrameRing, drawBytes, drawOffset);
+	void* commandData = FrameRingAlloc(gFrameRing, commandBytes, commandOffset);
+	if (!drawData || !commandData) {
+		EndFrameRing(gFrameRing);
+		return false;
+	}
+	memcpy(drawData, queue.draws.data(), drawBytes);
+	memcpy(commandData, queue.commands.data(), commandBytes);
+	glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, gFrameRing.buffer, frameOffset, sizeof(FrameBlock));
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, gFrameRing.buffer, instanceOffset, FrameRingSize(gFrameRing, items * sizeof(RenderInstance)));
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, gFrameRing.buffer, drawOffset, FrameRingSize(gFrameRing, drawBytes));
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gFrameRing.buffer);
+
+	LightVariant* lit = nullptr;
+	GLuint vao = 0;
+	MaterialBinding binding;
+	uint32_t group = 0;
+	GLuint condition = 0;
+	int category = -1;	//Of the open GPU scope, with --gpu-profile the queue keeps each category's passes together
+	for (const RenderPass& pass : queue.passes) {
+		const DrawItem& item = queue.items[pass.item];
+		if (gGpuProfiler.enabled && (int)item.category != category) {
+			if (category >= 0)
+				gGpuProfiler.endScope();
+			category = (int)item.category;
+			gGpuProfiler.beginScope(RENDER_CATEGORY_NAMES[category]);
+		}
+		//A car's passes are drawn only if its box passed the last frame's test, the GPU decides without waiting
+		if (item.group != group) {
+			if (condition)
+				glEndConditionalRender();
+			group = item.group;
+			condition = OcclusionCondition(gOcclusion, group);
+			if (condition)
+				glBeginConditionalRender(condition, GL_QUERY_NO_WAIT);
+		}
+		if (!lit || lit->features != item.program) {
+			lit = &ULightVariant(item.program);
+			lit->shader.use();
+		}
+		if (item.vao != vao) {
+			glBindVertexArray(item.vao);
+			vao = item.vao;
+		}
+		//Every material of the pass shares these maps and samplers, their scalars come from the material buffer.
+		//Texture arrays stay bound for the whole run.
+		if (!(item.program & TEXTURE_ARRAY))
+			UBindMaterial(binding, item.material);
+		if (gMultiDraw) {
+			lit->shader.set(lit->uniforms.drawBase, (int)pass.firstCommand);
+			glMultiDrawArraysIndirect(pass.mode, (const void*)(commandOffset + pass.firstCommand * sizeof(DrawArraysIndirectCommand)), pass.commandCount, 0);
+			continue;
+		}
+		for (uint32_t i = pass.firstCommand; i < pass.firstCommand + pass.commandCount; i++) {
+			const DrawArraysIndirectCommand& command = queue.commands[i];
+			lit->shader.set(lit->uniforms.drawBase, (int)i);
+			glDrawArraysInstancedBaseInstance(pass.mode, command.first, command.count, command.instanceCount, 0);
+		}
+	}
+	if (condition)
+		glEndConditionalRender();
+	if (category >= 0)
+		gGpuProfiler.endScope();
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindVertexArray(0);//Deactivate the Vertex Array Object
+	EndFrameRing(gFrameRing);
+	return true;
+}
 
-	model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	model = glm::scale(model, glm::vec3(1.0f, 1.25f, 1.25f));
-	aShader.setMat4("model", model);
+//Draws the box of every car with a visible draw into its occlusion query, against the depth the scene left.
+//Boxes the camera is in or next to are not tested, their car is drawn unconditionally next frame.
+void UTestOcclusion(const FrameBlock& frame) {
+
+	PROFILE_SCOPE("UTestOcclusion");
+	BeginOcclusionTests(gOcclusion);
+	gOcclusionShader->use();
+	gOcclusionShader->set(gOcclusionUniforms.viewProjection, frame.projection * frame.view);
+	//The box vertices come from gl_VertexID, any VAO will do
+	glBindVertexArray(gGeometry.vao);
+	for (uint32_t group = 1; group <= gScene.groupCount; group++) {
+		const SceneBox& box = gScene.groupBoxes[group];
+		if (box.empty() || box.contains(frame.viewPos, OCCLUSION_CAMERA_MARGIN))
+			continue;
+		gOcclusionShader->set(gOcclusionUniforms.boxMin, box.min);
+		gOcclusionShader->set(gOcclusionUniforms.boxMax, box.max);
+		BeginOcclusionTest(gOcclusion, group);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 14);
+		EndOcclusionTest();
+	}
+	glBindVertexArray(0);
+	EndOcclusionTests();
+}
 
-	//Draws the triangle
-	glDrawArrays(GL_TRIANGLES, 0, gWing.nIndices);//Draws the triangle
+//True where the light shader can read gl_DrawIDARB, core since GL 4.6
+bool UDrawParametersSupported() {
 
-	//Deactivate the Vertex Array Object
-	glBindVertexArray(0);//Deactivate the Vertex Array Object
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (major > 4 || (major == 4 && minor >= 6))
+		return true;
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (name && strcmp(name, "GL_ARB_shader_draw_parameters") == 0)
+			return true;
+	}
+	return false;
+}
 
-	glm::vec3 wheelLocation[] = {
-		glm::vec3(-2.5f, 1.0f, 1.0f),
-		glm::vec3( 2.5f, 1.0f, 1.0f),
-		glm::vec3(-2.5f, 1.0f, 9.0f),
-		glm::vec3( 2.5f, 1.0f, 9.0f),
-	};
+//Material buffer uploaded once on its fixed binding, and the frame ring the per-frame data is written to
+bool UCreateSceneBuffers() {
 
-	GLfloat wheelRotation[] = {-90.0f, 90.0f, -90.0f, 90.0f};
-	bool side[] = { false,true,false,true };
-	glm::vec3 wheelScale = glm::vec3(0.0225f, 0.0225f, 0.0225f);
+	glGenBuffers(1, &gMaterialBuffer);
+	const std::vector<MaterialRecord> records = BuildMaterialRecords(gMaterials);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gMaterialBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(MaterialRecord), records.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, gMaterialBuffer);
+	return CreateFrameRing(gFrameRing, FRAME_RING_MIN_REGION);
+}
 
-	for (int i = 0; i < 4; i++) {
-		DrawWheel(aShader, gTire, gWheel, gCHub, gSpoke, wheelLocation[i], wheelScale, wheelRotation[i], side[i]);
+//Fills gMaterials, in SceneMaterial order.
+//The wrap modes are the ones these draws always rendered with: the draws used to set them before binding
+//their texture, so each took effect on whatever map the previous draw had left bound.
+void UCreateSceneMaterials() {
+
+	//Diffuse map diffuse and the specular map that follows it, as textures or texture array layers
+	auto setMaps = [](Material& material, TextureId diffuse) {
+		if (gOptions.textureArrays) {
+			material.diffuseLayer = gTextureArrays.layers[diffuse];
+			material.specularLayer = gTextureArrays.layers[diffuse + 1];
+		}
+		else {
+			material.diffuse = gTextures[diffuse];
+			material.specular = gTextures[diffuse + 1];
+		}
+	};
+	Material materials[SCENE_MATERIAL_COUNT];
+	for (Material& material : materials)
+		material.specularWrap = SAMPLER_WRAP_REPEAT;
+	setMaps(materials[MATERIAL_GROUND], TEXTURE_PAVEMENT);
+	materials[MATERIAL_GROUND].diffuseWrap = SAMPLER_WRAP_REPEAT;
+	materials[MATERIAL_GROUND].shininess = 256.0f;
+	materials[MATERIAL_GROUND].pointLight = POINT_LIGHT_GROUND;
+	materials[MATERIAL_GROUND].uvScale = glm::vec2(25.0f, 25.0f);
+
+	setMaps(materials[MATERIAL_WING], TEXTURE_PAINT);
+	materials[MATERIAL_WING].diffuseWrap = SAMPLER_WRAP_REPEAT;
+	materials[MATERIAL_WING].shininess = 256.0f;
+	materials[MATERIAL_WING].pointLight = POINT_LIGHT_WING;
+
+	setMaps(materials[MATERIAL_TIRE], TEXTURE_TIRE);
+	materials[MATERIAL_TIRE].diffuseWrap = SAMPLER_WRAP_MIRRORED;
+	materials[MATERIAL_TIRE].shininess = 9.99f;
+	materials[MATERIAL_TIRE].pointLight = POINT_LIGHT_TIRE;
+	materials[MATERIAL_TIRE].uvScale = glm::vec2(3.0f, 3.0f);
+
+	//The car's paint, lit by the light behind it
+	Material paint;
+	paint.specularWrap = SAMPLER_WRAP_REPEAT;
+	setMaps(paint, TEXTURE_PAINT);
+	paint.diffuseWrap = SAMPLER_WRAP_MIRRORED;
+	paint.shininess = 256.0f;
+	paint.pointLight = POINT_LIGHT_BODY;
+
+	materials[MATERIAL_TRIM] = paint;
+
+	materials[MATERIAL_HUB] = paint;
+	materials[MATERIAL_HUB].diffuseWrap = SAMPLER_WRAP_CLAMP;
+
+	materials[MATERIAL_PAINT] = paint;
+	materials[MATERIAL_PAINT].uvScale = glm::vec2(3.0f, 3.0f);
+
+	materials[MATERIAL_GLASS] = paint;
+	setMaps(materials[MATERIAL_GLASS], TEXTURE_GLASS);
+	materials[MATERIAL_GLASS].uvScale = glm::vec2(3.0f, 3.0f);
+
+	materials[MATERIAL_SIDE] = paint;
+	setMaps(materials[MATERIAL_SIDE], TEXTURE_SIDE);
+	materials[MATERIAL_SIDE].diffuseWrap = SAMPLER_WRAP_REPEAT;
+
+	materials[MATERIAL_SIDE_STRETCHED] = materials[MATERIAL_SIDE];
+	materials[MATERIAL_SIDE_STRETCHED].diffuseWrap = SAMPLER_WRAP_MIRRORED;
+	materials[MATERIAL_SIDE_STRETCHED].uvScale = glm::vec2(1.0f, 6.0f);
+
+	materials[MATERIAL_FRONT] = paint;
+	setMaps(materials[MATERIAL_FRONT], TEXTURE_FRONT);
+	materials[MATERIAL_FRONT].diffuseWrap = SAMPLER_WRAP_REPEAT;
+	materials[MATERIAL_FRONT].uvScale = glm::vec2(0.3f, 1.0f);
+
+	materials[MATERIAL_BACK] = materials[MATERIAL_FRONT];
+	setMaps(materials[MATERIAL_BACK], TEXTURE_BACK);
+
+	//Texture arrays sample every layer through one repeating sampler and leave the wrap modes to the shader
+	if (!gOptions.textureArrays) {
+		for (Material& material : materials) {
+			material.diffuseSampler = SamplerIndex((SamplerWrap)material.diffuseWrap, gOptions.textureFilter);
+			material.specularSampler = SamplerIndex((SamplerWrap)material.specularWrap, gOptions.textureFilter);
+		}
 	}
-	glm::vec3 carScale = glm::vec3(0.5f, 0.5f, 1.0f);
 
-	glm::vec3 carLocation = glm::vec3(0.0f, 1.5f, -0.6f);
+	gMaterials = MaterialTable();
+	for (int i = 0; i < SCENE_MATERIAL_COUNT; i++)
+		gMaterials.add(materials[i]);
+}
 
-	DrawCar(aShader, gBody, gFront, gRear, gSides, gCenterTop, gTop, carLocation, carScale, 0.0f);
+//Gives every mesh the material it is usually drawn with, before the assemblies are baked by material
+void UAssignMeshMaterials() {
+
+	gPlane.material = MATERIAL_GROUND;
+	gWing.material = MATERIAL_WING;
+	gTire.material = MATERIAL_TIRE;
+	gWheel.material = MATERIAL_TRIM;
+	gCHub.material = MATERIAL_HUB;
+	gSpoke.material = MATERIAL_HUB;
+	gBody.material = MATERIAL_PAINT;
+	gFront.material = MATERIAL_TRIM;
+	gRear.material = MATERIAL_TRIM;
+	gSides.material = MATERIAL_SIDE;
+	gCenterTop.material = MATERIAL_SIDE;
+	gTop.material = MATERIAL_GLASS;
+}
 
-	//glfw: swap buffers and poll IO events (keys pressed/release, mouse moved etc.)
-	glfwSwapBuffers(gWindow); //Flips the back buffer with the front buffer every frame.
+//Makes id the current material: textures and samplers on units 0 and 1, its scalars are in the material buffer.
+//Only what differs from binding is sent, binding the material already in place costs nothing.
+void UBindMaterial(MaterialBinding& binding, MaterialId id) {
+
+	if (binding.material == id)
+		return;
+	const Material& material = gMaterials[id];
+	if (!binding.texturesBound || binding.diffuse != material.diffuse) {
+		//Bind diffuse map
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, material.diffuse);
+	}
+	if (!binding.texturesBound || binding.diffuseSampler != material.diffuseSampler)
+		glBindSampler(0, gSamplers.samplers[material.diffuseSampler]);
+	if (!binding.texturesBound || binding.specular != material.specular) {
+		//bind specular map
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, material.specular);
+	}
+	if (!binding.texturesBound || binding.specularSampler != material.specularSampler)
+		glBindSampler(1, gSamplers.samplers[material.specularSampler]);
+	binding.material = id;
+	binding.diffuse = material.diffuse;
+	binding.specular = material.specular;
+	binding.diffuseSampler = material.diffuseSampler;
+	binding.specularSampler = material.specularSampler;
+	binding.texturesBound = true;
 }
 
+#ifndef THECAR_NO_GLFW
 #pragma region InputControl
 //process all input: query GLFW whetehr relevant keys are pressed/released this frame and react accordingly
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
@@ -1033,31 +2314,13 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 
 	//std::cout << " Key Press Caught: key-" << key << " action type-" << action << std::endl; //Print Key Presses
 
-	float cameraOffset = cameraSpeed * gDeltaTime;
-	if (key == GLFW_KEY_W && action == GLFW_PRESS)
-		gCamera.ProcessKeyboard(Camera_Movement::FORWARD, cameraOffset);
-	if (key == GLFW_KEY_W && action == GLFW_REPEAT)
-		gCamera.ProcessKeyboard(Camera_Movement::FORWARD, cameraOffset);
-	if (key == GLFW_KEY_S && action == GLFW_PRESS)
-		gCamera.ProcessKeyboard(Camera_Movement::BACKWARD, cameraOffset);
-	if (key == GLFW_KEY_S && action == GLFW_REPEAT)
-		gCamera.ProcessKeyboard(Camera_Movement::BACKWARD, cameraOffset);
-	if (key == GLFW_KEY_A && action == GLFW_PRESS)
-		gCamera.ProcessKeyboard(Camera_Movement::LEFT, cameraOffset);
-	if (key == GLFW_KEY_A && action == GLFW_REPEAT)
-		gCamera.ProcessKeyboard(Camera_Movement::LEFT, cameraOffset);
-	if (key == GLFW_KEY_D && action == GLFW_PRESS)
-		gCamera.ProcessKeyboard(Camera_Movement::RIGHT, cameraOffset);
-	if (key == GLFW_KEY_D && action == GLFW_REPEAT)
-		gCamera.ProcessKeyboard(Camera_Movement::RIGHT, cameraOffset);
-	if (key == GLFW_KEY_Q && action == GLFW_PRESS)
-		gCamera.ProcessKeyboard(Camera_Movement::DOWN, cameraOffset);
-	if (key == GLFW_KEY_Q && action == GLFW_REPEAT)
-		gCamera.ProcessKeyboard(Camera_Movement::DOWN, cameraOffset);
-	if (key == GLFW_KEY_E && action == GLFW_PRESS)
-		gCamera.ProcessKeyboard(Camera_Movement::UP, cameraOffset);
-	if (key == GLFW_KEY_E && action == GLFW_REPEAT)
-		gCamera.ProcessKeyboard(Camera_Movement::UP, cameraOffset);
+	if (action != GLFW_PRESS && action != GLFW_REPEAT)
+		return;
+	if (key == GLFW_KEY_W || key == GLFW_KEY_S || key == GLFW_KEY_A || key == GLFW_KEY_D || key == GLFW_KEY_Q || key == GLFW_KEY_E) {
+		UMoveCamera((char)key, gDeltaTime);
+		if (!gOptions.recordPath.empty())
+			gRecordedInput.push_back({ gFrameIndex + 1, (char)key, gDeltaTime }); //polled after the frame, replayed before the next one
+	}
 }
 
 /*
@@ -1140,12 +2403,16 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 //glfw: whenever the window size changed (by OS or user resize) this callback function executes
 void UResizeWindow(GLFWwindow* window, int width, int height) {
 	glViewport(0, 0, width, height);
+	gViewportWidth = width;
+	gViewportHeight = height;
 }
 #pragma endregion 
+#endif // !THECAR_NO_GLFW
 
 #pragma region ObjectFunctions
 void Plane(GLMesh& mesh)
 {
+	PROFILE_SCOPE("Plane");
 	// Vertex Data
 	GLfloat verts[] = {
 		//Positions          //Texture Coordinates
@@ -1157,37 +2424,15 @@ void Plane(GLMesh& mesh)
 	-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,  0.0f,  1.0f, 0.0f,
 	};
 
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNorm = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nIndices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNorm + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create VBO
-	glGenBuffers(1, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNorm + floatsPerUV);
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNorm, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNorm)));
-	glEnableVertexAttribArray(2);
+	MeshVertices vertices;
+	vertices.data.assign(std::begin(verts), std::end(verts));
+	UAddMesh(mesh, vertices);
 }
 
 //Implements the UCreateMesh function
 void Wing(GLMesh& mesh) {
 
+	PROFILE_SCOPE("Wing");
 	// Position and Color data
 	GLfloat verts[] = {
 		//Right Wing Triangle
@@ -1310,263 +2555,68 @@ void Wing(GLMesh& mesh) {
 		  2.0f, 2.5f, 0.25f,    0.0f, 1.0f, 0.0f,   0.0f, 0.0f,// Bottom-Top Left Vertex 16
 	};
 
-
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	glGenVertexArrays(1, &mesh.vao); //we can also generate multiple VAOs or bufferes at the same time
-	glBindVertexArray(mesh.vao);
-
-	//Create 2 buffers: first one for the vertex datal second one for the indices
-	glGenBuffers(2, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	mesh.nIndices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-	//Strides between vertex coordinates is 6 (x, y, z, xn, yn, zn, u, v). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV); //The number of floats before each
-
-	//Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	MeshVertices vertices;
+	vertices.data.assign(std::begin(verts), std::end(verts));
+	UAddMesh(mesh, vertices);
 }
 
 void DrawTorus(GLMesh& mesh, float r, float c, int rSeg, int cSeg, int texture, int zMulti)
 {
 
+	PROFILE_SCOPE("DrawTorus");
 	//DrawTorus(100.0, 300.0, 6, 10, 0, 2, 1.0f, 0.0f, 0.0f); Reference what im passing.
-	std::vector<GLfloat> newTorusVertices;
-
-	const float TAU = 2.0f * (float)M_PI;
-
-		for (int i = 0; i < rSeg; i++) {
-		for (int j = 0; j <= cSeg; j++) {
-			for (int k = 0; k <= 1; k++) {
-				float s = (float)((i + k) % rSeg + 0.5);
-				float t = (float)(j % (cSeg + 1));
-				
-				float x = (float)(zMulti * ((c + 0.5 * r * cos(s * TAU / rSeg)) * cos(t * TAU / cSeg)));
-				float y = (float)(zMulti * ((c + 0.5 * r * cos(s * TAU / rSeg)) * sin(t * TAU / cSeg)));
-				float z = (float)(zMulti * (zMulti * r * sin(s * TAU / rSeg)));
-				
-				float u = (i + k) / (float)rSeg;
-				float v = t / (float)cSeg;
-				float mag = (float)(sqrt(pow(x,2) + pow(y,2) + pow(z,2)));
-				newTorusVertices.push_back(x);
-				newTorusVertices.push_back(y);
-				newTorusVertices.push_back(z);
-				newTorusVertices.push_back(x/mag);
-				newTorusVertices.push_back(y/mag);
-				newTorusVertices.push_back(z/mag);
-				newTorusVertices.push_back(u);
-				newTorusVertices.push_back(v);
-				//std::cout << "(" <<  x << "," << y << "," << z << "," << x/mag << "," << y/mag << "," << z/mag << "," << u << "," << v << ")" << std::endl;
-			}
-		}
-	}
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nIndices = newTorusVertices.size() / (floatsPerVertex + floatsPerNormal + floatsPerUV);
-	// Strides between vertex coordinates
-	GLint stride = sizeof(GLfloat) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create VBO
-	glGenBuffers(1, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, newTorusVertices.size() * sizeof(GLfloat), &newTorusVertices.at(0), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
-
-	newTorusVertices.clear();//Memory Management
-	
+	MeshVertices vertices;
+	BuildTorusVertices(vertices, r, c, rSeg, cSeg, zMulti);
+	UAddMesh(mesh, vertices);
 }
 
 void DrawCylinder(GLMesh& mesh, GLfloat radius, GLfloat height)
 {
-	GLfloat x = 0.0f;
-	GLfloat y = 0.0f;
-	GLfloat angle = 0.0f;
-	GLfloat angle_stepsize = 0.1f;
-	std::vector<GLfloat> cylinderVertices;
-	mesh.sideVerts = 0;
-	mesh.topVerts = 0;
-	mesh.bottomVerts = 0;
-	float mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(height, 2));
-	float mag2 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(0.0, 2));
-	///** Draw the tube */
-	angle = 0.0;
-	while (angle <= 2 * M_PI) {
-		x = radius * cos(angle);
-		y = radius * sin(angle);
-		mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(height, 2));
-		mag2 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(0.0, 2));
-		cylinderVertices.insert(cylinderVertices.end(), { x, y, height, x / mag1, y / mag1, height / mag1, angle, 1.0f } );//Top
-		cylinderVertices.insert(cylinderVertices.end(), { x, y, 0.0f, x / mag2, y / mag2, 0.0f, angle, 0.0f });//Bottom
-		angle = angle + angle_stepsize;
-		mesh.sideVerts+= 2;
-	}
-	mag1 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(height, 2));
-	mag2 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(0.0, 2));
-	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, height, radius / mag1, 0.0f, height / mag1, angle, 1.0f });
-	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, 0.0f, radius / mag2, 0.0f, 0.0f, angle, 0.0f });
-	mesh.sideVerts+= 2;
-
-	/** Draw the circle on top of cylinder */
-	angle = 0.0;
-	while (angle <= 2 * M_PI) {
-		x = radius * cos(angle);
-		y = radius * sin(angle);
-		mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(height, 2));
-		cylinderVertices.insert(cylinderVertices.end(), { x, y, height, x / mag1, y / mag1, height / mag1, angle, 1.0f });
-		//glVertex3f(x, y, height);
-		angle = angle + angle_stepsize;
-		mesh.topVerts++;
-	}
-	mesh.topVerts++;
-	mag1 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(height, 2));
-	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, height, radius / mag1, 0.0f, height / mag1, angle, 1.0f });
-	
-	angle = 0.0;
-	while (angle <= 2 * M_PI) {
-		x = radius * cos(angle);
-		y = radius * sin(angle);
-
-		mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(0.0, 2));
-		cylinderVertices.insert(cylinderVertices.end(), { x, y, 0.0, x / mag1, y / mag1, 0.0, angle, 1.0f });
-		angle = angle + angle_stepsize;
-		mesh.bottomVerts++;
-	}
-	mag1 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(height, 2));
-	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, height, radius / mag1, 0.0f, height / mag1, angle, 1.0f });
-	mesh.bottomVerts++;
-
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nIndices = cylinderVertices.size() / (floatsPerVertex + floatsPerNormal + floatsPerUV);
-	// Strides between vertex coordinates
-	GLint stride = sizeof(GLfloat) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create VBO
-	glGenBuffers(1, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, cylinderVertices.size() * sizeof(GLfloat), &cylinderVertices.at(0), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
-
-	cylinderVertices.clear();//Memory management
-
+	PROFILE_SCOPE("DrawCylinder");
+	MeshVertices vertices;
+	BuildCylinderVertices(vertices, radius, height);
+	UAddMesh(mesh, vertices);
 }
 
 void DrawRectangle(GLMesh& mesh, GLfloat radius, GLfloat height) {
-	GLfloat x = 0.0f;
-	GLfloat y = 0.0f;
-	int numSlices = 4;
-	GLfloat angle = 0.0f;
-	GLfloat angle_stepsize = 2.0f * (float)M_PI/(float)numSlices;
-	std::vector<GLfloat> cylinderVertices;
-	mesh.sideVerts = 0;
-	mesh.topVerts = 0;
-	mesh.bottomVerts = 0;
-	float mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(height, 2));
-	float mag2 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(0.0, 2));
-	///** Draw the tube */
-	angle = 0.0;
-	while (angle <= numSlices+1) {
-		x = radius * cos(angle);
-		y = radius * sin(angle);
-		mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(height, 2));
-		mag2 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(0.0, 2));
-		cylinderVertices.insert(cylinderVertices.end(), { x, y, height, x / mag1, y / mag1, height / mag1, angle, 1.0f });//Top
-		cylinderVertices.insert(cylinderVertices.end(), { x, y, 0.0f, x / mag2, y / mag2, 0.0f, angle, 0.0f });//Bottom
-		angle = angle + angle_stepsize;
-		mesh.sideVerts += 2;
-	}
-	mag1 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(height, 2));
-	mag2 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(0.0, 2));
-	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, height, radius / mag1, 0.0f, height / mag1, angle, 1.0f });
-	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, 0.0f, radius / mag2, 0.0f, 0.0f, angle, 0.0f });
-	mesh.sideVerts += 2;
-
-	/** Draw the circle on top of cylinder */
-	angle = 0.0;
-	while (angle <= numSlices+1) {
-		x = radius * cos(angle);
-		y = radius * sin(angle);
-		mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(height, 2));
-		cylinderVertices.insert(cylinderVertices.end(), { x, y, height, x / mag1, y / mag1, height / mag1, angle, 1.0f });
-		//glVertex3f(x, y, height);
-		angle = angle + angle_stepsize;
-		mesh.topVerts++;
-	}
-	mesh.topVerts++;
-	mag1 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(height, 2));
-	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, height, radius / mag1, 0.0f, height / mag1, angle, 1.0f });
-	angle = 0.0;
-	while (angle <= numSlices+1) {
-		x = radius * cos(angle);
-		y = radius * sin(angle);
-
-		mag1 = (float)sqrt(pow(x, 2) + pow(y, 2) + pow(0.0, 2));
-		cylinderVertices.insert(cylinderVertices.end(), { x, y, 0.0, x / mag1, y / mag1, 0.0, angle, 1.0f });
-		angle = angle + angle_stepsize;
-		mesh.bottomVerts++;
-	}
-	mag1 = (float)sqrt(pow(radius, 2) + pow(0.0, 2) + pow(height, 2));
-	cylinderVertices.insert(cylinderVertices.end(), { radius, 0.0, 0.0f, radius / mag1, 0.0f, 0.0f, angle, 1.0f });
-	mesh.bottomVerts++;
+	PROFILE_SCOPE("DrawRectangle");
+	MeshVertices vertices;
+	BuildRectangleVertices(vertices, radius, height);
+	UAddMesh(mesh, vertices);
+}
 
+//Appends the position / normal / uv vertices of mesh to the shared geometry, UCreateSharedGeometry uploads them.
+//Every mesh, generated or baked, gets its bounds here.
+void UAddMesh(GLMesh& mesh, const MeshVertices& vertices)
+{
+	mesh.id = gGeometry.meshCount++;
+	mesh.firstVertex = (uint32_t)(gGeometry.vertices.size() / FLOATS_PER_VERTEX);
+	mesh.nIndices = (GLuint)vertices.vertexCount();
+	mesh.sideVerts = vertices.sideVerts;
+	mesh.topVerts = vertices.topVerts;
+	mesh.bottomVerts = vertices.bottomVerts;
+	mesh.bounds = ComputeMeshBounds(vertices.data);
+	gGeometry.vertices.insert(gGeometry.vertices.end(), vertices.data.begin(), vertices.data.end());
+}
+
+//Creates the one VBO / VAO every mesh is drawn from and points meshes at it
+void UCreateSharedGeometry(GLMesh* meshes[], int count)
+{
+	PROFILE_SCOPE("UCreateSharedGeometry");
 	const GLuint floatsPerVertex = 3;
 	const GLuint floatsPerNormal = 3;
 	const GLuint floatsPerUV = 2;
 
-	mesh.nIndices = cylinderVertices.size() / (floatsPerVertex + floatsPerNormal + floatsPerUV);
 	// Strides between vertex coordinates
 	GLint stride = sizeof(GLfloat) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
 
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
+	glGenVertexArrays(1, &gGeometry.vao);
+	glBindVertexArray(gGeometry.vao);
 
 	// Create VBO
-	glGenBuffers(1, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, cylinderVertices.size() * sizeof(GLfloat), &cylinderVertices.at(0), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
+	glGenBuffers(1, &gGeometry.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, gGeometry.vbo); // Activates the buffer
+	glBufferData(GL_ARRAY_BUFFER, gGeometry.vertices.size() * sizeof(GLfloat), gGeometry.vertices.data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
 	// Create Vertex Attribute Pointers
 	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
@@ -1578,12 +2628,16 @@ void DrawRectangle(GLMesh& mesh, GLfloat radius, GLfloat height) {
 	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * (floatsPerVertex + floatsPerNormal)));
 	glEnableVertexAttribArray(2);
 
-	cylinderVertices.clear();//Memory management
-
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	std::vector<GLfloat>().swap(gGeometry.vertices);
+	for (int i = 0; i < count; i++)
+		meshes[i]->vao = gGeometry.vao;
 }
 
 void DrawPyramid(GLMesh& mesh) {
 
+	PROFILE_SCOPE("DrawPyramid");
 	// Position and Color data
 	GLfloat verts[] = {
 		//Positions          //Normals
@@ -1637,37 +2691,14 @@ void DrawPyramid(GLMesh& mesh) {
    -0.25f,  0.5f, -0.25f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f
 	};
 
-
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nIndices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-	// Strides between vertex coordinates
-	GLint stride = sizeof(GLfloat) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create VBO
-	glGenBuffers(1, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	MeshVertices vertices;
+	vertices.data.assign(std::begin(verts), std::end(verts));
+	UAddMesh(mesh, vertices);
 }
 
 void DrawCube(GLMesh& mesh) {
 
+	PROFILE_SCOPE("DrawCube");
 	// Position and Color data
 	GLfloat verts[] = {
 		//Positions          //Normals
@@ -1721,520 +2752,93 @@ void DrawCube(GLMesh& mesh) {
    -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f
 	};
 
-
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nIndices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-	// Strides between vertex coordinates
-	GLint stride = sizeof(GLfloat) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create VBO
-	glGenBuffers(1, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	MeshVertices vertices;
+	vertices.data.assign(std::begin(verts), std::end(verts));
+	UAddMesh(mesh, vertices);
 }
 
 
-void DrawWheel(Shader ourShader, GLMesh& tMesh, GLMesh& wMesh, GLMesh& cMesh, GLMesh& sMesh, glm::vec3 loc, glm::vec3 aScale, GLfloat angle, bool sides) {
-	
-	glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 10000.0f);
-	glm::mat4 view = gCamera.GetViewMatrix();//Transforms the camera
-	glm::mat4 model = glm::mat4(1.0f);
-	//Create Tire
-	glBindVertexArray(tMesh.vao);
-	//Tire Lighting
-	ourShader.use();
-	ourShader.setVec3("viewPos", gCamera.Position);
-	ourShader.setFloat("material.shininess", 9.99f);
-	ourShader.setVec3("pointLights.position", 0.0f, 6.0f, -3.0f);
-	ourShader.setVec3("pointLights.ambient", 0.02f, 0.02f, 0.02f);
-	ourShader.setVec3("pointLights.diffuse", 0.01f, 0.01f, 0.01f);
-	ourShader.setVec3("pointLights.specular", 0.4f, 0.4f, 0.4f);
-	ourShader.setFloat("pointLights.constant", 1.0f);
-	ourShader.setFloat("pointLights.linear", 0.09f);
-	ourShader.setFloat("pointLights.quadratic", 0.032f);
-
-	view = gCamera.GetViewMatrix();//Transforms the camera
-	ourShader.setMat4("projection", projection);
-	ourShader.setMat4("view", view);
-
-	model = glm::mat4(1.0f);
-	ourShader.setMat4("model", model);
-	//Bind diffuse map
-	glActiveTexture(GL_TEXTURE0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-	gUVScale = glm::vec2(3.0f, 3.0f);
-	ourShader.setVec2("uvScale", gUVScale);
-	glBindTexture(GL_TEXTURE_2D, texture5);
-	//bind specular map
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, texture6);
-
-
-	model = glm::translate(model, loc);
-	model = glm::rotate(model, glm::radians(0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	model = glm::rotate(model, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-	model = glm::scale(model, aScale);
-	ourShader.setMat4("model", model);
-
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, tMesh.nIndices);//Draws the triangle
+//Adds a wheel at loc on car: the tire and rim, the center hub on the outer side and the 8 spokes around the axle
+void UAddWheel(SceneGraph& scene, SceneNodeId car, GLMesh& tMesh, GLMesh& wMesh, GLMesh& cMesh, GLMesh& sMesh, glm::vec3 loc, glm::vec3 aScale, GLfloat angle, bool sides) {
+	//Every part is placed by rotations and aScale, uniform for the scene wheels
+	const bool uniformScale = aScale.x == aScale.y && aScale.y == aScale.z;
+	const SceneNodeId wheel = scene.addNode(car, glm::translate(glm::mat4(1.0f), loc));
 
-
-	glBindVertexArray(0);//Deactivate the Vertex Array Object
-	//Create Wheel
-	glBindVertexArray(wMesh.vao);
-	ourShader.use();
-	ourShader.setVec3("viewPos", gCamera.Position);
-	ourShader.setFloat("material.shininess", 256.0f);
-	ourShader.setVec3("pointLights.position", 0.0f, 6.0f, -3.0f);
-	ourShader.setVec3("pointLights.ambient", 0.25f, 0.25f, 0.25f);
-	ourShader.setVec3("pointLights.diffuse", 0.4f, 0.4f, 0.4f);
-	ourShader.setVec3("pointLights.specular", 0.774597f, 0.774597f, 0.774597f);
-	ourShader.setFloat("pointLights.constant", 1.0f);
-	ourShader.setFloat("pointLights.linear", 0.09f);
-	ourShader.setFloat("pointLights.quadratic", 0.032f);
-
-	view = gCamera.GetViewMatrix();//Transforms the camera
-	ourShader.setMat4("projection", projection);
-	ourShader.setMat4("view", view);
-
-	model = glm::mat4(1.0f);
-	ourShader.setMat4("model", model);
-	//Bind diffuse map
-	glActiveTexture(GL_TEXTURE0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-	gUVScale = glm::vec2(1.0f, 1.0f);
-	ourShader.setVec2("uvScale", gUVScale);
-	glBindTexture(GL_TEXTURE_2D, texture3);
-	//bind specular map
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, texture4);
-
-
-	model = glm::translate(model, loc);
-	model = glm::rotate(model, glm::radians(0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	model = glm::rotate(model, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
+	//Create Tire, and the Wheel with the same placement
+	glm::mat4 model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
 	model = glm::scale(model, aScale);
-	ourShader.setMat4("model", model);
-
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, wMesh.nIndices);//Draws the triangle
+	const SceneNodeId tire = scene.addNode(wheel, model);
+	scene.addDraw(tire, tMesh, tMesh.material, uniformScale, { { GL_TRIANGLE_STRIP, 0, tMesh.nIndices } }, RENDER_LAYER_OPAQUE, RENDER_CATEGORY_WHEELS);
+	scene.addDraw(tire, wMesh, wMesh.material, uniformScale, { { GL_TRIANGLE_STRIP, 0, wMesh.nIndices } }, RENDER_LAYER_OPAQUE, RENDER_CATEGORY_WHEELS);
 
-
-	glBindVertexArray(0);//Deactivate the Vertex Array Object
 	//Create Center Hub of Wheel
-	glBindVertexArray(cMesh.vao);
-	ourShader.use();
-	ourShader.setVec3("viewPos", gCamera.Position);
-	ourShader.setFloat("material.shininess", 256.0f);
-	ourShader.setVec3("pointLights.position", 0.0f, 6.0f, -3.0f);
-	ourShader.setVec3("pointLights.ambient", 0.25f, 0.25f, 0.25f);
-	ourShader.setVec3("pointLights.diffuse", 0.4f, 0.4f, 0.4f);
-	ourShader.setVec3("pointLights.specular", 0.774597f, 0.774597f, 0.774597f);
-	ourShader.setFloat("pointLights.constant", 1.0f);
-	ourShader.setFloat("pointLights.linear", 0.09f);
-	ourShader.setFloat("pointLights.quadratic", 0.032f);
-
-	view = gCamera.GetViewMatrix();//Transforms the camera
-	ourShader.setMat4("projection", projection);
-	ourShader.setMat4("view", view);
-
-	model = glm::mat4(1.0f);
-	ourShader.setMat4("model", model);
-	//Bind diffuse map
-	glActiveTexture(GL_TEXTURE0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	gUVScale = glm::vec2(1.0f, 1.0f);
-	ourShader.setVec2("uvScale", gUVScale);
-	glBindTexture(GL_TEXTURE_2D, texture3);
-	//bind specular map
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, texture4);
-	glm::vec3 moveHub;
-	if(sides)
-		moveHub = glm::vec3(15.0f, 0.0f, 0.0f) * aScale;
-	else
-		moveHub = glm::vec3(-15.0f, 0.0f, 0.0f) * aScale;
-
-	model = glm::translate(model, loc + moveHub);
-	model = glm::rotate(model, glm::radians(0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+	const float outside = sides ? 1.0f : -1.0f;
+	model = glm::translate(glm::mat4(1.0f), glm::vec3(15.0f * outside, 0.0f, 0.0f) * aScale);
 	model = glm::rotate(model, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
 	model = glm::scale(model, aScale);
-	ourShader.setMat4("model", model);
-
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, cMesh.sideVerts);//Draws the triangle
-	glDrawArrays(GL_TRIANGLE_FAN, cMesh.sideVerts, cMesh.topVerts);//Draws the triangle
-	glDrawArrays(GL_TRIANGLE_FAN, cMesh.sideVerts + cMesh.topVerts, cMesh.bottomVerts);//Draws the triangle
-
-	glBindVertexArray(0);//Deactivate the Vertex Array Object
-	//Spokes Loop
+	const SceneNodeId hub = scene.addNode(wheel, model);
+	scene.addDraw(hub, cMesh, cMesh.material, uniformScale, {
+		{ GL_TRIANGLE_STRIP, 0, cMesh.sideVerts },
+		{ GL_TRIANGLE_FAN, cMesh.sideVerts, cMesh.topVerts },
+		{ GL_TRIANGLE_FAN, cMesh.sideVerts + cMesh.topVerts, cMesh.bottomVerts } }, RENDER_LAYER_OPAQUE, RENDER_CATEGORY_WHEELS);
+
+	//Spokes, 45 degrees apart around the axle
+	model = glm::translate(glm::mat4(1.0f), glm::vec3(22.0f * outside, 0.0f, 0.0f) * aScale);
+	model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.0f, 0.0f));
+	model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	const SceneNodeId spokes = scene.addNode(wheel, model);
 	GLfloat step = 0.0f;
 	for (int i = 0; i < 8; i++) {
-		//Spoke
-		glBindVertexArray(sMesh.vao);
-		ourShader.use();
-		ourShader.setVec3("viewPos", gCamera.Position);
-		ourShader.setFloat("material.shininess", 256.0f);
-		ourShader.setVec3("pointLights.position", 0.0f, 6.0f, -3.0f);
-		ourShader.setVec3("pointLights.ambient", 0.25f, 0.25f, 0.25f);
-		ourShader.setVec3("pointLights.diffuse", 0.4f, 0.4f, 0.4f);
-		ourShader.setVec3("pointLights.specular", 0.774597f, 0.774597f, 0.774597f);
-		ourShader.setFloat("pointLights.constant", 1.0f);
-		ourShader.setFloat("pointLights.linear", 0.09f);
-		ourShader.setFloat("pointLights.quadratic", 0.032f);
-
-		view = gCamera.GetViewMatrix();//Transforms the camera
-		ourShader.setMat4("projection", projection);
-		ourShader.setMat4("view", view);
-
-		model = glm::mat4(1.0f);
-		ourShader.setMat4("model", model);
-		//Bind diffuse map
-		glActiveTexture(GL_TEXTURE0);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		gUVScale = glm::vec2(1.0f, 1.0f);
-		ourShader.setVec2("uvScale", gUVScale);
-		glBindTexture(GL_TEXTURE_2D, texture3);
-		//bind specular map
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, texture4);
-		if(sides)
-			moveHub = glm::vec3(22.0f, 0.0f, 0.0f) * aScale;
-		else
-			moveHub = glm::vec3(-22.0f, 0.0f, 0.0f) * aScale;
-
-		model = glm::translate(model, loc + moveHub);
-		model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.0f, 0.0f));
-		model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		model = glm::rotate(model, glm::radians(step), glm::vec3(0.0f, 1.0f, 0.0f));
+		model = glm::rotate(glm::mat4(1.0f), glm::radians(step), glm::vec3(0.0f, 1.0f, 0.0f));
 		model = glm::scale(model, aScale);
-
-		ourShader.setMat4("model", model);
-
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, sMesh.sideVerts);//Draws the triangle
-		glDrawArrays(GL_TRIANGLE_FAN, sMesh.sideVerts, sMesh.topVerts);//Draws the triangle
-		glDrawArrays(GL_TRIANGLE_FAN, sMesh.sideVerts + sMesh.topVerts, sMesh.bottomVerts);//Draws the triangle
-
-		glBindVertexArray(0);//Deactivate the Vertex Array Object
+		const SceneNodeId spoke = scene.addNode(spokes, model);
+		scene.addDraw(spoke, sMesh, sMesh.material, uniformScale, {
+			{ GL_TRIANGLE_STRIP, 0, sMesh.sideVerts },
+			{ GL_TRIANGLE_FAN, sMesh.sideVerts, sMesh.topVerts },
+			{ GL_TRIANGLE_FAN, sMesh.sideVerts + sMesh.topVerts, sMesh.bottomVerts } }, RENDER_LAYER_OPAQUE, RENDER_CATEGORY_WHEELS);
 		step += 45.0f;
 	}
 }
 
-void DrawCar(Shader ourShader, GLMesh& bMesh, GLMesh& fMesh, GLMesh& rMesh, GLMesh& sMesh, GLMesh& cTMesh, GLMesh& tMesh, glm::vec3 loc, glm::vec3 aScale, GLfloat angle) {
+//Adds the body parts of car, placed in the car's space
+void UAddCar(SceneGraph& scene, SceneNodeId car, GLMesh& bMesh, GLMesh& fMesh, GLMesh& rMesh, GLMesh& sMesh, GLMesh& cTMesh, GLMesh& tMesh, glm::vec3 loc, glm::vec3 aScale, GLfloat angle) {
 
-	glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 10000.0f);
-	glm::mat4 view = gCamera.GetViewMatrix();//Transforms the camera
-	glm::mat4 model = glm::mat4(1.0f);
 	#pragma region carBody
 	//Create Body
-	glBindVertexArray(bMesh.vao);
-	//Lighting
-	ourShader.use();
-	ourShader.setVec3("viewPos", gCamera.Position);
-	ourShader.setFloat("material.shininess", 256.0f);
-	ourShader.setVec3("dirLight.direction", 2.0f, -2.0f, 0.03f);
-	ourShader.setVec3("pointLights.ambient", 0.25f, 0.25f, 0.25f);
-	ourShader.setVec3("pointLights.diffuse", 0.4f, 0.4f, 0.4f);
-	ourShader.setVec3("pointLights.specular", 0.774597f, 0.774597f, 0.774597f);
-	ourShader.setFloat("pointLights.constant", 1.0f);
-	ourShader.setFloat("pointLights.linear", 0.09f);
-	ourShader.setFloat("pointLights.quadratic", 0.032f);
-
-	view = gCamera.GetViewMatrix();//Transforms the camera
-	ourShader.setMat4("projection", projection);
-	ourShader.setMat4("view", view);
-
-	model = glm::mat4(1.0f);
-	ourShader.setMat4("model", model);
-	//Bind diffuse map
-	glActiveTexture(GL_TEXTURE0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-	gUVScale = glm::vec2(3.0f, 3.0f);
-	ourShader.setVec2("uvScale", gUVScale);
-	glBindTexture(GL_TEXTURE_2D, texture3);
-	//bind specular map
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, texture4);
-
-
-	model = glm::translate(model, loc);
+	glm::mat4 model = glm::translate(glm::mat4(1.0f), loc);
 	model = glm::rotate(model, glm::radians(45.0f), glm::vec3(0.0f, 0.0f, 1.0f));
 	//model = glm::rotate(model, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
 	model = glm::scale(model, aScale);
-	ourShader.setMat4("model", model);
-
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, bMesh.nIndices);//Draws the triangle
-
-
-	glBindVertexArray(0);//Deactivate the Vertex Array Object
+	scene.addDraw(scene.addNode(car, model), bMesh, bMesh.material, false, { { GL_TRIANGLE_STRIP, 0, bMesh.nIndices } });
 
 	//Center Top
-	glBindVertexArray(cTMesh.vao);
-	//Lighting
-	ourShader.use();
-	ourShader.setVec3("viewPos", gCamera.Position);
-	ourShader.setFloat("material.shininess", 256.0f);
-	ourShader.setVec3("dirLight.direction", 2.0f, -2.0f, 0.03f);
-	ourShader.setVec3("pointLights.ambient", 0.25f, 0.25f, 0.25f);
-	ourShader.setVec3("pointLights.diffuse", 0.4f, 0.4f, 0.4f);
-	ourShader.setVec3("pointLights.specular", 0.774597f, 0.774597f, 0.774597f);
-	ourShader.setFloat("pointLights.constant", 1.0f);
-	ourShader.setFloat("pointLights.linear", 0.09f);
-	ourShader.setFloat("pointLights.quadratic", 0.032f);
-
-	view = gCamera.GetViewMatrix();//Transforms the camera
-	ourShader.setMat4("projection", projection);
-	ourShader.setMat4("view", view);
-
-	model = glm::mat4(1.0f);
-	ourShader.setMat4("model", model);
-	//Bind diffuse map
-	glActiveTexture(GL_TEXTURE0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-	gUVScale = glm::vec2(1.0f, 1.0f);
-	ourShader.setVec2("uvScale", gUVScale);
-	glBindTexture(GL_TEXTURE_2D, texture13);
-	//bind specular map
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, texture14);
-
-
-	model = glm::translate(model, glm::vec3(0.0f, 3.0f, 5.0f));
-	model = glm::rotate(model, glm::radians(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	//model = glm::rotate(model, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
+	model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 3.0f, 5.0f));
 	model = glm::scale(model, glm::vec3(6.0f, 0.80f, 11.5f));
-	ourShader.setMat4("model", model);
-
-	glDrawArrays(GL_TRIANGLES, 0, cTMesh.nIndices);//Draws the triangle
-
-
-	glBindVertexArray(0);//Deactivate the Vertex Array Object
+	scene.addDraw(scene.addNode(car, model), cTMesh, cTMesh.material, false, { { GL_TRIANGLES, 0, cTMesh.nIndices } });
 
-	//Top
-	glBindVertexArray(tMesh.vao);
-	//Lighting
-	ourShader.use();
-	ourShader.setVec3("viewPos", gCamera.Position);
-	ourShader.setFloat("material.shininess", 256.0f);
-	ourShader.setVec3("dirLight.direction", 2.0f, -2.0f, 0.03f);
-	ourShader.setVec3("pointLights.ambient", 0.25f, 0.25f, 0.25f);
-	ourShader.setVec3("pointLights.diffuse", 0.4f, 0.4f, 0.4f);
-	ourShader.setVec3("pointLights.specular", 0.774597f, 0.774597f, 0.774597f);
-	ourShader.setFloat("pointLights.constant", 1.0f);
-	ourShader.setFloat("pointLights.linear", 0.09f);
-	ourShader.setFloat("pointLights.quadratic", 0.032f);
-
-	view = gCamera.GetViewMatrix();//Transforms the camera
-	ourShader.setMat4("projection", projection);
-	ourShader.setMat4("view", view);
-
-	model = glm::mat4(1.0f);
-	ourShader.setMat4("model", model);
-	//Bind diffuse map
-	glActiveTexture(GL_TEXTURE0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-	gUVScale = glm::vec2(3.0f, 3.0f);
-	ourShader.setVec2("uvScale", gUVScale);
-	glBindTexture(GL_TEXTURE_2D, texture7);
-	//bind specular map
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, texture8);
-
-
-	model = glm::translate(model, glm::vec3(0.0f, 4.29f, 5.0f));
-	model = glm::rotate(model, glm::radians(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	//model = glm::rotate(model, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
+	//Top, then its edges as lines
+	model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 4.29f, 5.0f));
 	model = glm::scale(model, glm::vec3(6.0f, 1.76f, 11.5f));
-	ourShader.setMat4("model", model);
-
-	glDrawArrays(GL_TRIANGLES, 0, tMesh.nIndices);//Draws the triangle
-	glBindVertexArray(0);//Deactivate the Vertex Array Object
+	const SceneNodeId top = scene.addNode(car, model);
+	scene.addDraw(top, tMesh, tMesh.material, false, { { GL_TRIANGLES, 0, tMesh.nIndices } });
+	scene.addDraw(top, tMesh, MATERIAL_PAINT, false, { { GL_LINES, 0, tMesh.nIndices } }, RENDER_LAYER_OUTLINE);
 
-	glBindVertexArray(cTMesh.vao);
-	//Lighting
-	ourShader.use();
-	ourShader.setVec3("viewPos", gCamera.Position);
-	ourShader.setFloat("material.shininess", 256.0f);
-	ourShader.setVec3("dirLight.direction", 2.0f, -2.0f, 0.03f);
-	ourShader.setVec3("pointLights.ambient", 0.25f, 0.25f, 0.25f);
-	ourShader.setVec3("pointLights.diffuse", 0.4f, 0.4f, 0.4f);
-	ourShader.setVec3("pointLights.specular", 0.774597f, 0.774597f, 0.774597f);
-	ourShader.setFloat("pointLights.constant", 1.0f);
-	ourShader.setFloat("pointLights.linear", 0.09f);
-	ourShader.setFloat("pointLights.quadratic", 0.032f);
-
-	view = gCamera.GetViewMatrix();//Transforms the camera
-	ourShader.setMat4("projection", projection);
-	ourShader.setMat4("view", view);
-
-	model = glm::mat4(1.0f);
-	ourShader.setMat4("model", model);
-	//Bind diffuse map
-	glActiveTexture(GL_TEXTURE0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-	gUVScale = glm::vec2(3.0f, 3.0f);
-	ourShader.setVec2("uvScale", gUVScale);
-	glBindTexture(GL_TEXTURE_2D, texture3);
-	//bind specular map
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, texture4);
-
-	model = glm::translate(model, glm::vec3(0.0f, 4.29f, 5.0f));
-	model = glm::rotate(model, glm::radians(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	//model = glm::rotate(model, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
+	//Painted block inside the top
+	model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 4.29f, 5.0f));
 	model = glm::scale(model, glm::vec3(3.0f, 1.761f, 5.75f));
-	ourShader.setMat4("model", model);
-
-	glDrawArrays(GL_TRIANGLES, 0, cTMesh.nIndices);//Draws the triangle
-
-
-	glBindVertexArray(0);//Deactivate the Vertex Array Object
-
-	glBindVertexArray(tMesh.vao);
-	//Lighting
-	ourShader.use();
-	ourShader.setVec3("viewPos", gCamera.Position);
-	ourShader.setFloat("material.shininess", 256.0f);
-	ourShader.setVec3("dirLight.direction", 2.0f, -2.0f, 0.03f);
-	ourShader.setVec3("pointLights.ambient", 0.25f, 0.25f, 0.25f);
-	ourShader.setVec3("pointLights.diffuse", 0.4f, 0.4f, 0.4f);
-	ourShader.setVec3("pointLights.specular", 0.774597f, 0.774597f, 0.774597f);
-	ourShader.setFloat("pointLights.constant", 1.0f);
-	ourShader.setFloat("pointLights.linear", 0.09f);
-	ourShader.setFloat("pointLights.quadratic", 0.032f);
-
-	view = gCamera.GetViewMatrix();//Transforms the camera
-	ourShader.setMat4("projection", projection);
-	ourShader.setMat4("view", view);
-
-	model = glm::mat4(1.0f);
-	ourShader.setMat4("model", model);
-	//Bind diffuse map
-	glActiveTexture(GL_TEXTURE0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-	gUVScale = glm::vec2(3.0f, 3.0f);
-	ourShader.setVec2("uvScale", gUVScale);
-	glBindTexture(GL_TEXTURE_2D, texture3);
-	//bind specular map
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, texture4);
-
-
-	model = glm::translate(model, glm::vec3(0.0f, 4.29f, 5.0f));
-	model = glm::rotate(model, glm::radians(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	//model = glm::rotate(model, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-	model = glm::scale(model, glm::vec3(6.0f, 1.76f, 11.5f));
-	ourShader.setMat4("model", model);
+	scene.addDraw(scene.addNode(car, model), cTMesh, MATERIAL_PAINT, false, { { GL_TRIANGLES, 0, cTMesh.nIndices } });
 
-	glDrawArrays(GL_LINES, 0, tMesh.nIndices);//Draws the triangle
-
-
-	glBindVertexArray(0);//Deactivate the Vertex Array Object
-	glBindVertexArray(0);//Deactivate the Vertex Array Object
 	//Draw Wheel Front Well
-	glBindVertexArray(fMesh.vao);
-	ourShader.use();
-	ourShader.setVec3("viewPos", gCamera.Position);
-	ourShader.setFloat("material.shininess", 256.0f);
-	ourShader.setVec3("dirLight.direction", 2.0f, -2.0f, 0.03f);
-	ourShader.setVec3("pointLights.ambient", 0.25f, 0.25f, 0.25f);
-	ourShader.setVec3("pointLights.diffuse", 0.4f, 0.4f, 0.4f);
-	ourShader.setVec3("pointLights.specular", 0.774597f, 0.774597f, 0.774597f);
-	ourShader.setFloat("pointLights.constant", 1.0f);
-	ourShader.setFloat("pointLights.linear", 0.09f);
-	ourShader.setFloat("pointLights.quadratic", 0.032f);
-
-	view = gCamera.GetViewMatrix();//Transforms the camera
-	ourShader.setMat4("projection", projection);
-	ourShader.setMat4("view", view);
-
-	model = glm::mat4(1.0f);
-	ourShader.setMat4("model", model);
-	//Bind diffuse map
-	glActiveTexture(GL_TEXTURE0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-	gUVScale = glm::vec2(1.0f, 1.0f);
-	ourShader.setVec2("uvScale", gUVScale);
-	glBindTexture(GL_TEXTURE_2D, texture3);
-	//bind specular map
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, texture4);
-
-
-	model = glm::translate(model, glm::vec3(-3.0f, 1.0f, 9.0f));
-	model = glm::rotate(model, glm::radians(0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+	model = glm::translate(glm::mat4(1.0f), glm::vec3(-3.0f, 1.0f, 9.0f));
 	model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 	model = glm::scale(model, aScale/3.0f);
-	ourShader.setMat4("model", model);
+	scene.addDraw(scene.addNode(car, model), fMesh, fMesh.material, false, { { GL_TRIANGLE_STRIP, 0, fMesh.sideVerts / 2 } });
 
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, fMesh.sideVerts/2);//Draws the triangle
-
-	glBindVertexArray(0);//Deactivate the Vertex Array Object
-
-	glBindVertexArray(rMesh.vao);
-	ourShader.use();
-	ourShader.setVec3("viewPos", gCamera.Position);
-	ourShader.setFloat("material.shininess", 256.0f);
-	ourShader.setVec3("dirLight.direction", 2.0f, -2.0f, 0.03f);
-	ourShader.setVec3("pointLights.ambient", 0.25f, 0.25f, 0.25f);
-	ourShader.setVec3("pointLights.diffuse", 0.4f, 0.4f, 0.4f);
-	ourShader.setVec3("pointLights.specular", 0.774597f, 0.774597f, 0.774597f);
-	ourShader.setFloat("pointLights.constant", 1.0f);
-	ourShader.setFloat("pointLights.linear", 0.09f);
-	ourShader.setFloat("pointLights.quadratic", 0.032f);
-
-	view = gCamera.GetViewMatrix();//Transforms the camera
-	ourShader.setMat4("projection", projection);
-	ourShader.setMat4("view", view);
-
-	model = glm::mat4(1.0f);
-	ourShader.setMat4("model", model);
-	//Bind diffuse map
-	glActiveTexture(GL_TEXTURE0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-	gUVScale = glm::vec2(1.0f, 1.0f);
-	ourShader.setVec2("uvScale", gUVScale);
-	glBindTexture(GL_TEXTURE_2D, texture3);
-	//bind specular map
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, texture4);
-
-
-	model = glm::translate(model, glm::vec3(-3.0f, 1.0f, 1.0f));
-	model = glm::rotate(model, glm::radians(0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+	//Rear Well
+	model = glm::translate(glm::mat4(1.0f), glm::vec3(-3.0f, 1.0f, 1.0f));
 	model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 	model = glm::scale(model, aScale / 3.0f);
-	ourShader.setMat4("model", model);
-
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, rMesh.sideVerts / 2);//Draws the triangle
-
-	glBindVertexArray(0);//Deactivate the Vertex Array Object
+	scene.addDraw(scene.addNode(car, model), rMesh, rMesh.material, false, { { GL_TRIANGLE_STRIP, 0, rMesh.sideVerts / 2 } });
 	#pragma endregion
 
 	#pragma region carsides
@@ -2259,118 +2863,144 @@ void DrawCar(Shader ourShader, GLMesh& bMesh, GLMesh& fMesh, GLMesh& rMesh, GLMe
 	};
 	GLfloat angles[] = {-90.0f, 90.0f, 90.0f, -90.0f};
 	
-	GLuint textureMaps[][2] = {
-		{texture13,texture14},
-		{texture13,texture14},
-		{texture9,texture10},
-		{texture11,texture12},
-	};
-	glm::vec2 scaleUV[] = {
-	glm::vec2(1.0f, 6.0f),
-	glm::vec2(1.0f, 1.0f),
-	glm::vec2(0.3f, 1.0f),
-	glm::vec2(0.3f, 1.0f),
-	};
+	MaterialId sideMaterials[] = { MATERIAL_SIDE_STRETCHED, MATERIAL_SIDE, MATERIAL_FRONT, MATERIAL_BACK };
 
 	for (int i = 0; i < 4; i++) {
 		//Draw Left Side
-		glBindVertexArray(sMesh.vao);
-		ourShader.use();
-		ourShader.setVec3("viewPos", gCamera.Position);
-		ourShader.setFloat("material.shininess", 256.0f);
-		ourShader.setVec3("dirLight.direction", 2.0f, -2.0f, 0.03f);
-		ourShader.setVec3("pointLights.ambient", 0.25f, 0.25f, 0.25f);
-		ourShader.setVec3("pointLights.diffuse", 0.4f, 0.4f, 0.4f);
-		ourShader.setVec3("pointLights.specular", 0.774597f, 0.774597f, 0.774597f);
-		ourShader.setFloat("pointLights.constant", 1.0f);
-		ourShader.setFloat("pointLights.linear", 0.09f);
-		ourShader.setFloat("pointLights.quadratic", 0.032f);
-
-		view = gCamera.GetViewMatrix();//Transforms the camera
-		ourShader.setMat4("projection", projection);
-		ourShader.setMat4("view", view);
-
-		model = glm::mat4(1.0f);
-		ourShader.setMat4("model", model);
-		//Bind diffuse map
-		glActiveTexture(GL_TEXTURE0);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		gUVScale = scaleUV[i];
-		ourShader.setVec2("uvScale", gUVScale);
-		glBindTexture(GL_TEXTURE_2D, textureMaps[i][0]);
-		//bind specular map
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, textureMaps[i][1]);
-
-
-		model = glm::translate(model, sideLocations[i]);
+		model = glm::translate(glm::mat4(1.0f), sideLocations[i]);
 		model = glm::rotate(model, glm::radians(angles[i]), angleDirection[i]);
 		model = glm::scale(model, sideScale[i] / 3.0f);
-		ourShader.setMat4("model", model);
-
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, sMesh.sideVerts / 2);//Draws the triangle
-		glDrawArrays(GL_TRIANGLE_FAN, sMesh.sideVerts, sMesh.topVerts / 2);//Draws the triangle
-		glDrawArrays(GL_TRIANGLE_FAN, sMesh.sideVerts + sMesh.topVerts, sMesh.bottomVerts / 2);//Draws the triangle
-
-		glBindVertexArray(0);//Deactivate the Vertex Array Object
+		scene.addDraw(scene.addNode(car, model), sMesh, sideMaterials[i], false, {
+			{ GL_TRIANGLE_STRIP, 0, sMesh.sideVerts / 2 },
+			{ GL_TRIANGLE_FAN, sMesh.sideVerts, sMesh.topVerts / 2 },
+			{ GL_TRIANGLE_FAN, sMesh.sideVerts + sMesh.topVerts, sMesh.bottomVerts / 2 } });
 	}
 	#pragma endregion
 
 }
 
-void UDestroyMesh(GLMesh& mesh) {
+void UDestroySharedGeometry() {
 
-	glDeleteVertexArrays(1, &mesh.vao);
-	glDeleteBuffers(2, mesh.vbos);
+	glDeleteVertexArrays(1, &gGeometry.vao);
+	glDeleteBuffers(1, &gGeometry.vbo);
+	gGeometry = SharedGeometry();
 }
 
 /*Texture Creation*/
-bool CreateTexture(const char* filename, GLuint& textureId)
+//Reads and flips an image, safe to call from any thread
+bool UDecodeTexture(const char* filename, DecodedImage& image)
+{
+	PROFILE_SCOPE("UDecodeTexture", filename);
+
+	ProfileScope decodeScope("stbi_load", filename);
+	image.pixels = stbi_load(filename, &image.width, &image.height, &image.channels, 0);
+	decodeScope.end();
+	if (!image.pixels)
+		return false;
+
+	ProfileScope flipScope("flipImageVertically");
+	flipImageVertically(image.pixels, image.width, image.height, image.channels);
+	flipScope.end();
+	return true;
+}
+
+//Resizes decoded pixels to their texture array layer size (TextureArrayLayerSize), safe to call from any thread
+void UResampleToLayerSize(DecodedImage& image)
 {
-	int width, height, channels;
+	const int width = TextureArrayLayerSize(image.width);
+	const int height = TextureArrayLayerSize(image.height);
+	if (width == image.width && height == image.height)
+		return;
+	PROFILE_SCOPE("UResampleToLayerSize");
+	std::vector<unsigned char> pixels((size_t)width * height * image.channels);
+	ResampleImage(image.pixels, image.width, image.height, image.channels, pixels.data(), width, height);
+	UReleaseDecodedImage(image);
+	image.resampled.swap(pixels);
+	image.pixels = image.resampled.data();
+	image.width = width;
+	image.height = height;
+}
+
+//Frees the pixels of image, whoever allocated them
+void UReleaseDecodedImage(DecodedImage& image)
+{
+	if (image.resampled.empty())
+		stbi_image_free(image.pixels);
+	std::vector<unsigned char>().swap(image.resampled);
+	image.pixels = nullptr;
+}
 
+//Creates the GL texture from decoded pixels and frees them, false when decoding had failed
+bool UUploadTexture(DecodedImage& image, GLuint& textureId)
+{
+	PROFILE_SCOPE("UUploadTexture");
+	if (!image.pixels)
+		return false; //Error loading the image
 
-	unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-	if (image)
+	glGenTextures(1, &textureId);
+	glBindTexture(GL_TEXTURE_2D, textureId);
+
+	//Immutable storage with the full mipmap chain: the texture is never changed after this function,
+	//wrap and filter modes come from the sampler bound next to it (Samplers.h)
+	GLsizei levels = 1;
+	for (int size = std::max(image.width, image.height); size > 1; size /= 2)
+		levels++;
+	glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8, image.width, image.height);
+	//Defaults for anything sampling it without a sampler object
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	bool uploaded = true;
+	if (image.channels == 3)
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width, image.height, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels);
+	else if (image.channels == 4)
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width, image.height, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels);
+	else
 	{
-		flipImageVertically(image, width, height, channels);
-
-		glGenTextures(1, &textureId);
-		glBindTexture(GL_TEXTURE_2D, textureId);
-
-		//Set the texture wrapping parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		//Set texture filtering parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		if (channels == 3)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-		else if (channels == 4)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-		else
-		{
-			std::cout << "Not implemented to handle image with " << channels << " channels." << std::endl;
-			return false;
-		}
+		std::cout << "Not implemented to handle image with " << image.channels << " channels." << std::endl;
+		uploaded = false;
+	}
 
+	if (uploaded)
 		glGenerateMipmap(GL_TEXTURE_2D);
 
-		stbi_image_free(image);
-		//glBindTexture(GL_TEXTURE_2D, 0); //Unbind the texture
+	UReleaseDecodedImage(image);
+	//glBindTexture(GL_TEXTURE_2D, 0); //Unbind the texture
 
-		return true;
-	}
+	return uploaded;
+}
 
-	//Error loading the image
-	return false;
+//Uploads every decoded image as a texture array layer (gTextureArrays) and frees them, false when one is missing
+bool UCreateTextureArrays(DecodedImage images[], int count)
+{
+	PROFILE_SCOPE("UCreateTextureArrays");
+	std::vector<TextureArrayImage> layers(count);
+	bool decoded = true;
+	for (int i = 0; i < count; i++) {
+		if (!images[i].pixels)
+			decoded = false;
+		layers[i] = { images[i].pixels, images[i].width, images[i].height, images[i].channels };
+	}
+	const bool created = decoded && CreateTextureArrays(gTextureArrays, layers);
+	for (int i = 0; i < count; i++)
+		UReleaseDecodedImage(images[i]);
+	if (created)
+		std::cout << "INFO: " << count << " textures in " << gTextureArrays.arrays.size() << " texture arrays" << std::endl;
+	return created;
 }
 
+bool CreateTexture(const char* filename, GLuint& textureId)
+{
+	PROFILE_SCOPE("CreateTexture", filename);
+	DecodedImage image;
+	UDecodeTexture(filename, image);
+	return UUploadTexture(image, textureId);
+}
 
 void DestroyTexture(GLuint textureId)
 {
-	glGenTextures(1, &textureId);
+	glDeleteTextures(1, &textureId);
 }
 #pragma endregion
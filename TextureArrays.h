@@ -0,0 +1,121 @@
+#ifndef TEXTUREARRAYS_H
+#define TEXTUREARRAYS_H
+
+/*
+* Texture arrays, the --texture-arrays storage of the scene's maps.
+* Textures are layers of GL_TEXTURE_2D_ARRAY objects instead of one GL_TEXTURE_2D each, grouped by size and
+* channel count. Each side of a texture is first resampled to the nearest power of two up to
+* TEXTURE_ARRAY_MAX_SIZE (TextureArrayLayerSize), so textures of similar size share an array.
+* Every array stays bound to its own unit from TEXTURE_ARRAY_FIRST_UNIT on for the whole run, and materials
+* name their maps by TextureLayerIndex in the material buffer: switching materials binds nothing.
+* One sampler serves all layers of an array, so the light shader emulates each material's wrap mode
+* (WrapCoordinate), exactly at the base level and within a texel on smaller mipmaps.
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+const int TEXTURE_ARRAY_MAX_SIZE = 2048;
+//Arrays the light shader can sample, the length of its textureArrays[] on units 2 to 9
+const int TEXTURE_ARRAY_MAX_COUNT = 8;
+const int TEXTURE_ARRAY_FIRST_UNIT = 2;
+
+//Side of the layer a texture side of size is resampled to
+inline int TextureArrayLayerSize(int size)
+{
+	int layer = 1;
+	while (layer < TEXTURE_ARRAY_MAX_SIZE && layer * 2 <= size)
+		layer *= 2;
+	if (layer < TEXTURE_ARRAY_MAX_SIZE && size - layer > layer * 2 - size)
+		layer *= 2;
+	return layer;
+}
+
+//Array in the high 16 bits, layer in the low 16, what materials store
+inline uint32_t TextureLayerIndex(uint32_t array, uint32_t layer)
+{
+	return (array << 16) | (layer & 0xffff);
+}
+
+//Pixels of one texture, already at its layer size
+struct TextureArrayImage {
+	const unsigned char* pixels = nullptr;
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+};
+
+struct TextureArraySet {
+	std::vector<GLuint> arrays;
+	std::vector<uint32_t> layers;	//TextureLayerIndex of every image, in the order they were given
+};
+
+//Uploads images as layers of one array per size and channel count, with full mipmap chains.
+//False when the images need more arrays than the shader samples or one has an unsupported channel count.
+inline bool CreateTextureArrays(TextureArraySet& set, const std::vector<TextureArrayImage>& images)
+{
+	struct Group {
+		int width, height, channels;
+		std::vector<size_t> images;
+	};
+	std::vector<Group> groups;
+	set.layers.assign(images.size(), 0);
+	for (size_t i = 0; i < images.size(); i++) {
+		const TextureArrayImage& image = images[i];
+		if (image.channels != 3 && image.channels != 4) {
+			std::cout << "ERROR::TEXTURE_ARRAYS::CHANNELS " << image.channels << " channels are not supported" << std::endl;
+			return false;
+		}
+		auto group = std::find_if(groups.begin(), groups.end(), [&](const Group& g) {
+			return g.width == image.width && g.height == image.height && g.channels == image.channels; });
+		if (group == groups.end())
+			group = groups.insert(groups.end(), Group{ image.width, image.height, image.channels, {} });
+		set.layers[i] = TextureLayerIndex((uint32_t)(group - groups.begin()), (uint32_t)group->images.size());
+		group->images.push_back(i);
+	}
+	if ((int)groups.size() > TEXTURE_ARRAY_MAX_COUNT) {
+		std::cout << "ERROR::TEXTURE_ARRAYS::TOO_MANY_SIZES " << groups.size() << " arrays, the shader samples " << TEXTURE_ARRAY_MAX_COUNT << std::endl;
+		return false;
+	}
+
+	set.arrays.resize(groups.size());
+	glGenTextures((GLsizei)set.arrays.size(), set.arrays.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t g = 0; g < groups.size(); g++) {
+		const Group& group = groups[g];
+		GLsizei levels = 1;
+		for (int size = std::max(group.width, group.height); size > 1; size /= 2)
+			levels++;
+		glBindTexture(GL_TEXTURE_2D_ARRAY, set.arrays[g]);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, group.width, group.height, (GLsizei)group.images.size());
+		const GLenum format = group.channels == 4 ? GL_RGBA : GL_RGB;
+		for (size_t layer = 0; layer < group.images.size(); layer++)
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)layer, group.width, group.height, 1, format, GL_UNSIGNED_BYTE, images[group.images[layer]].pixels);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return true;
+}
+
+//Binds every array to its unit with sampler, once: nothing else uses those units
+inline void BindTextureArrays(const TextureArraySet& set, GLuint sampler)
+{
+	for (size_t i = 0; i < set.arrays.size(); i++) {
+		glActiveTexture(GL_TEXTURE0 + TEXTURE_ARRAY_FIRST_UNIT + (GLenum)i);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, set.arrays[i]);
+		glBindSampler(TEXTURE_ARRAY_FIRST_UNIT + (GLuint)i, sampler);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+inline void DestroyTextureArrays(TextureArraySet& set)
+{
+	if (!set.arrays.empty())
+		glDeleteTextures((GLsizei)set.arrays.size(), set.arrays.data());
+	set = TextureArraySet();
+}
+
+#endif
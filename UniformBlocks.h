@@ -0,0 +1,157 @@
+#ifndef UNIFORMBLOCKS_H
+#define UNIFORMBLOCKS_H
+
+/*
+* std140 uniform blocks shared by every draw of the light shader.
+* FrameBlock holds the camera and is written once per frame into the frame ring (FrameRing.h); LightBlock holds the directional light and the
+* point light presets the objects choose from with the pointLightIndex uniform, it never changes after startup.
+* The structs mirror the GLSL blocks in lightVertexShaderSource / lightFragmentShaderSource member for member,
+* padding included, and the static_asserts below pin every offset to the std140 rules.
+*/
+
+#include <cstddef>
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+//Binding points, also written as layout(binding = N) in the shaders
+const GLuint FRAME_BLOCK_BINDING = 0;
+const GLuint LIGHT_BLOCK_BINDING = 1;
+
+//Point light settings used by the scene, indexed by pointLightIndex
+enum PointLightPreset {
+	POINT_LIGHT_GROUND,	//Bright light over the pavement
+	POINT_LIGHT_WING,	//Same position, dimmer paint lighting
+	POINT_LIGHT_TIRE,	//Behind the car, nearly no diffuse for the rubber
+	POINT_LIGHT_BODY,	//Behind the car, paint lighting for rims, spokes and body
+	POINT_LIGHT_PRESET_COUNT
+};
+
+//layout(std140, binding = 0) uniform FrameBlock
+struct FrameBlock {
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec3 viewPos;
+	float pad0;
+};
+static_assert(offsetof(FrameBlock, projection) == 0, "std140: FrameBlock.projection");
+static_assert(offsetof(FrameBlock, view) == 64, "std140: FrameBlock.view");
+static_assert(offsetof(FrameBlock, viewPos) == 128, "std140: FrameBlock.viewPos");
+static_assert(sizeof(FrameBlock) == 144, "std140: FrameBlock size");
+
+//GLSL struct DirLight, every vec3 starts on a 16 byte boundary
+struct DirLightStd140 {
+	glm::vec3 direction;
+	float pad0;
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float pad3;
+};
+static_assert(offsetof(DirLightStd140, direction) == 0, "std140: DirLight.direction");
+static_assert(offsetof(DirLightStd140, ambient) == 16, "std140: DirLight.ambient");
+static_assert(offsetof(DirLightStd140, diffuse) == 32, "std140: DirLight.diffuse");
+static_assert(offsetof(DirLightStd140, specular) == 48, "std140: DirLight.specular");
+static_assert(sizeof(DirLightStd140) == 64, "std140: DirLight size");
+
+//GLSL struct PointLight, constant packs into the tail of position, the struct is rounded up to 16 bytes
+struct PointLightStd140 {
+	glm::vec3 position;
+	float constant;
+	float linear;
+	float quadratic;
+	float pad0[2];
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float pad3;
+};
+static_assert(offsetof(PointLightStd140, position) == 0, "std140: PointLight.position");
+static_assert(offsetof(PointLightStd140, constant) == 12, "std140: PointLight.constant");
+static_assert(offsetof(PointLightStd140, linear) == 16, "std140: PointLight.linear");
+static_assert(offsetof(PointLightStd140, quadratic) == 20, "std140: PointLight.quadratic");
+static_assert(offsetof(PointLightStd140, ambient) == 32, "std140: PointLight.ambient");
+static_assert(offsetof(PointLightStd140, diffuse) == 48, "std140: PointLight.diffuse");
+static_assert(offsetof(PointLightStd140, specular) == 64, "std140: PointLight.specular");
+static_assert(sizeof(PointLightStd140) == 80, "std140: PointLight size");
+
+//layout(std140, binding = 1) uniform LightBlock
+struct LightBlock {
+	DirLightStd140 dirLight;
+	PointLightStd140 pointLights[POINT_LIGHT_PRESET_COUNT];
+};
+static_assert(offsetof(LightBlock, dirLight) == 0, "std140: LightBlock.dirLight");
+static_assert(offsetof(LightBlock, pointLights) == 64, "std140: LightBlock.pointLights");
+static_assert(sizeof(LightBlock) == 64 + 80 * POINT_LIGHT_PRESET_COUNT, "std140: LightBlock size");
+
+inline PointLightStd140 MakePointLight(glm::vec3 position, float ambient, float diffuse, float specular)
+{
+	PointLightStd140 light = {};
+	light.position = position;
+	light.constant = 1.0f;
+	light.linear = 0.09f;
+	light.quadratic = 0.032f;
+	light.ambient = glm::vec3(ambient);
+	light.diffuse = glm::vec3(diffuse);
+	light.specular = glm::vec3(specular);
+	return light;
+}
+
+//The scene lighting, previously re-set as loose uniforms before every draw
+inline LightBlock SceneLights()
+{
+	LightBlock lights = {};
+	lights.dirLight.direction = glm::vec3(2.0f, -2.0f, 0.03f);
+	lights.dirLight.ambient = glm::vec3(0.5f);
+	lights.dirLight.diffuse = glm::vec3(0.4f);
+	lights.dirLight.specular = glm::vec3(0.5f);
+	lights.pointLights[POINT_LIGHT_GROUND] = MakePointLight(glm::vec3(1.0f, 10.0f, 4.0f), 1.0f, 1.0f, 0.3f);
+	lights.pointLights[POINT_LIGHT_WING] = MakePointLight(glm::vec3(1.0f, 10.0f, 4.0f), 0.25f, 0.4f, 0.774597f);
+	lights.pointLights[POINT_LIGHT_TIRE] = MakePointLight(glm::vec3(0.0f, 6.0f, -3.0f), 0.02f, 0.01f, 0.4f);
+	lights.pointLights[POINT_LIGHT_BODY] = MakePointLight(glm::vec3(0.0f, 6.0f, -3.0f), 0.25f, 0.4f, 0.774597f);
+	return lights;
+}
+
+//GPU buffer backing the light block, bound to its binding point for the lifetime of the context.
+//The frame block has no buffer of its own, each frame binds its range of the frame ring.
+struct UniformBlockBuffers {
+	GLuint lights = 0;
+};
+
+inline void CreateUniformBlockBuffers(UniformBlockBuffers& buffers, const LightBlock& lights)
+{
+	glGenBuffers(1, &buffers.lights);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffers.lights);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), &lights, GL_STATIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, buffers.lights);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+inline void DestroyUniformBlockBuffers(UniformBlockBuffers& buffers)
+{
+	glDeleteBuffers(1, &buffers.lights);
+	buffers = UniformBlockBuffers();
+}
+
+//Runtime counterpart of the static_asserts: the linked block must be exactly as large as its C++ struct
+inline bool CheckUniformBlockSize(GLuint program, const char* blockName, size_t expectedSize)
+{
+	GLuint index = glGetUniformBlockIndex(program, blockName);
+	if (index == GL_INVALID_INDEX) {
+		std::cout << "ERROR::UNIFORM_BLOCK::NOT_ACTIVE " << blockName << std::endl;
+		return false;
+	}
+	GLint size = 0;
+	glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+	if ((size_t)size != expectedSize) {
+		std::cout << "ERROR::UNIFORM_BLOCK::SIZE_MISMATCH " << blockName << " is " << size << " bytes, C++ struct " << expectedSize << std::endl;
+		return false;
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef UNIFORMS_H
+#define UNIFORMS_H
+
+/*
+* Typed uniform handles.
+* Shader reflects its active uniforms with glGetActiveUniform after linking and keys them by the FNV-1a hash
+* of their name. Callers resolve a Uniform<T> once through UNIFORM("name"), which hashes at compile time,
+* after that setting a value is a single glUniform call: no string, no glGetUniformLocation.
+* Each program also keeps a shadow copy of the values it was given, so setting the value already in
+* place skips the GL call entirely.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include <glm/glm.hpp>
+
+//32 bit FNV-1a, usable in constant expressions
+constexpr uint32_t UniformHash(const char* name, uint32_t hash = 2166136261u)
+{
+	return *name ? UniformHash(name + 1, (hash ^ (uint32_t)(unsigned char)*name) * 16777619u) : hash;
+}
+
+//Hashed name plus the text, which is only read to report errors
+struct UniformName {
+	uint32_t hash;
+	const char* text;
+};
+
+//Forces the hash to be computed by the compiler
+#define UNIFORM(name) UniformName{ std::integral_constant<uint32_t, UniformHash(name)>::value, name }
+
+//Location of an active uniform, typed by the C++ value it accepts. -1 when the uniform is not active,
+//glUniform ignores that location just like it did for glGetUniformLocation misses.
+template<typename T>
+struct Uniform {
+	GLint location = -1;
+	int slot = -1;	//Index of the shadow value in the owning Shader
+};
+
+//Last value written to a uniform, large enough for a mat4
+struct UniformShadow {
+	float data[16];
+	bool valid = false;
+
+	//True when value differs from the shadow (or nothing was written yet), the shadow then holds value
+	template<typename T>
+	bool update(const T& value)
+	{
+		static_assert(sizeof(T) <= sizeof(data), "uniform value larger than its shadow");
+		if (valid && memcmp(data, &value, sizeof(T)) == 0)
+			return false;
+		memcpy(data, &value, sizeof(T));
+		valid = true;
+		return true;
+	}
+};
+
+//Reflected uniform of a linked program
+struct UniformInfo {
+	uint32_t hash;
+	GLint location;
+	GLenum type;
+	GLint size;	//Array length, 1 for plain uniforms
+};
+
+//GL types a Uniform<T> may be bound to
+template<typename T> inline bool UniformTypeMatches(GLenum type);
+template<> inline bool UniformTypeMatches<float>(GLenum type) { return type == GL_FLOAT; }
+template<> inline bool UniformTypeMatches<glm::vec2>(GLenum type) { return type == GL_FLOAT_VEC2; }
+template<> inline bool UniformTypeMatches<glm::vec3>(GLenum type) { return type == GL_FLOAT_VEC3; }
+template<> inline bool UniformTypeMatches<glm::vec4>(GLenum type) { return type == GL_FLOAT_VEC4; }
+template<> inline bool UniformTypeMatches<glm::mat2>(GLenum type) { return type == GL_FLOAT_MAT2; }
+template<> inline bool UniformTypeMatches<glm::mat3>(GLenum type) { return type == GL_FLOAT_MAT3; }
+template<> inline bool UniformTypeMatches<glm::mat4>(GLenum type) { return type == GL_FLOAT_MAT4; }
+template<> inline bool UniformTypeMatches<bool>(GLenum type) { return type == GL_BOOL; }
+template<> inline bool UniformTypeMatches<int>(GLenum type)
+{
+	//Samplers are set through their texture unit index
+	return type == GL_INT || type == GL_BOOL || type == GL_SAMPLER_2D || type == GL_SAMPLER_2D_ARRAY || type == GL_SAMPLER_CUBE;
+}
+
+#endif
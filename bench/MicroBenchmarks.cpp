@@ -0,0 +1,353 @@
+/*
+* CPU microbenchmarks for the startup and per-frame hot spots that need no GL context:
+* procedural mesh generation, image flip, PNG decode, camera math, normal matrices and the render queue sort.
+* Build target TheCarBench (google benchmark), e.g.
+*   ./TheCarBench --benchmark_filter=Torus --benchmark_counters_tabular=true
+*/
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#define STBI_NO_SIMD
+#include <stb_image.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Camera.h"
+#include "Culling.h"
+#include "Image.h"
+#include "MeshGen.h"
+#include "NormalMatrix.h"
+#include "RenderQueue.h"
+#include "SceneGraph.h"
+
+#ifndef THECAR_SOURCE_DIR
+#define THECAR_SOURCE_DIR "."
+#endif
+
+namespace {
+	//Decode inputs from the smallest to the largest texture CreateTexture loads (FrontNose_1.png, ~3 MB).
+	//FrontNose.png is a JPEG despite its name, STBI_ONLY_PNG builds cannot decode it.
+	const char* const DECODE_FILES[] = {
+		"Resources/Textures/tire_tread.png",
+		"Resources/Textures/TruePaintColor.png",
+		"Resources/Textures/pavement.png",
+		"Resources/Textures/BackSide.png",
+		"Resources/Textures/FrontNose_1.png",
+	};
+
+	std::vector<unsigned char> ReadFile(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		return std::vector<unsigned char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+}
+
+//Torus of the wheels (30 rings) with the segment count around the ring swept from 36 to 4096
+static void BM_BuildTorusVertices(benchmark::State& state)
+{
+	const int cSeg = (int)state.range(0);
+	MeshVertices vertices;
+	for (auto _ : state) {
+		BuildTorusVertices(vertices, 10.0f, 30.0f, 30, cSeg, 2);
+		benchmark::DoNotOptimize(vertices.data.data());
+	}
+	state.SetItemsProcessed(state.iterations() * vertices.vertexCount());
+	state.SetBytesProcessed(state.iterations() * vertices.data.size() * sizeof(float));
+}
+BENCHMARK(BM_BuildTorusVertices)->Arg(36)->Arg(64)->Arg(128)->Arg(256)->Arg(512)->Arg(1024)->Arg(2048)->Arg(4096);
+
+static void BM_BuildCylinderVertices(benchmark::State& state)
+{
+	MeshVertices vertices;
+	for (auto _ : state) {
+		BuildCylinderVertices(vertices, 10.0f, 11.0f);
+		benchmark::DoNotOptimize(vertices.data.data());
+	}
+	state.SetItemsProcessed(state.iterations() * vertices.vertexCount());
+	state.SetBytesProcessed(state.iterations() * vertices.data.size() * sizeof(float));
+}
+BENCHMARK(BM_BuildCylinderVertices);
+
+static void BM_BuildRectangleVertices(benchmark::State& state)
+{
+	MeshVertices vertices;
+	for (auto _ : state) {
+		BuildRectangleVertices(vertices, 4.0f, 50.0f);
+		benchmark::DoNotOptimize(vertices.data.data());
+	}
+	state.SetItemsProcessed(state.iterations() * vertices.vertexCount());
+	state.SetBytesProcessed(state.iterations() * vertices.data.size() * sizeof(float));
+}
+BENCHMARK(BM_BuildRectangleVertices);
+
+//Square RGBA images from 256 to 4096 pixels wide
+static void BM_FlipImageVertically(benchmark::State& state)
+{
+	const int size = (int)state.range(0);
+	const int channels = 4;
+	std::vector<unsigned char> image((size_t)size * size * channels, 0x7f);
+	for (auto _ : state) {
+		flipImageVertically(image.data(), size, size, channels);
+		benchmark::ClobberMemory();
+	}
+	state.SetBytesProcessed(state.iterations() * image.size());
+}
+BENCHMARK(BM_FlipImageVertically)->RangeMultiplier(2)->Range(256, 4096);
+
+//stbi decode from memory, file IO excluded; bytes/s is measured on the compressed PNG size
+static void BM_DecodePng(benchmark::State& state)
+{
+	const std::string path = std::string(THECAR_SOURCE_DIR) + "/" + DECODE_FILES[state.range(0)];
+	const std::vector<unsigned char> png = ReadFile(path);
+	if (png.empty()) {
+		state.SkipWithError(("cannot read " + path).c_str());
+		return;
+	}
+	int width = 0, height = 0, channels = 0;
+	for (auto _ : state) {
+		unsigned char* image = stbi_load_from_memory(png.data(), (int)png.size(), &width, &height, &channels, 0);
+		if (!image) {
+			state.SkipWithError(stbi_failure_reason());
+			return;
+		}
+		benchmark::DoNotOptimize(image);
+		stbi_image_free(image);
+	}
+	state.SetBytesProcessed(state.iterations() * png.size());
+	state.counters["pixels/s"] = benchmark::Counter((double)state.iterations() * width * height, benchmark::Counter::kIsRate);
+	state.SetLabel(std::string(DECODE_FILES[state.range(0)]).substr(19) + " " + std::to_string(width) + "x" + std::to_string(height) + "x" + std::to_string(channels));
+}
+BENCHMARK(BM_DecodePng)->DenseRange(0, (int)(sizeof(DECODE_FILES) / sizeof(DECODE_FILES[0])) - 1)->Unit(benchmark::kMillisecond);
+
+//Mouse look: Euler angles to Front / Right / Up, as done for every mouse event
+static void BM_CameraMouseMovement(benchmark::State& state)
+{
+	Camera camera(glm::vec3(0.0f, 5.0f, 30.0f));
+	float direction = 1.0f;
+	for (auto _ : state) {
+		camera.ProcessMouseMovement(3.0f * direction, 1.0f * direction);
+		direction = -direction;
+		benchmark::DoNotOptimize(camera.Front);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CameraMouseMovement);
+
+//Per-frame camera work: pose update plus view matrix
+static void BM_CameraViewMatrix(benchmark::State& state)
+{
+	Camera camera(glm::vec3(0.0f, 5.0f, 30.0f));
+	float yaw = -90.0f;
+	for (auto _ : state) {
+		camera.SetPose(glm::vec3(0.0f, 5.0f, 30.0f), yaw, 10.0f);
+		glm::mat4 view = camera.GetViewMatrix();
+		benchmark::DoNotOptimize(view);
+		yaw += 0.5f;
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CameraViewMatrix);
+
+//Wheel-like transform (rotation times uniform scale) and ground-like one (non-uniform scale)
+static glm::mat4 BenchModelMatrix(bool uniformScale)
+{
+	glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(-2.5f, 1.0f, 9.0f));
+	model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	model = glm::rotate(model, glm::radians(37.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	return glm::scale(model, uniformScale ? glm::vec3(0.0225f) : glm::vec3(100.0f, 1.0f, 100.0f));
+}
+
+//What the vertex shader used to do per vertex
+static void BM_NormalMatrixInverse(benchmark::State& state)
+{
+	glm::mat4 model = BenchModelMatrix(false);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(model);
+		glm::mat3 normal = glm::mat3(glm::transpose(glm::inverse(model)));
+		benchmark::DoNotOptimize(normal);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_NormalMatrixInverse);
+
+static void BM_NormalMatrixCofactor(benchmark::State& state)
+{
+	glm::mat4 model = BenchModelMatrix(false);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(model);
+		glm::mat3 normal = NormalMatrixCofactor(model);
+		benchmark::DoNotOptimize(normal);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_NormalMatrixCofactor);
+
+#ifdef THECAR_NORMAL_MATRIX_SSE
+static void BM_NormalMatrixCofactorSse(benchmark::State& state)
+{
+	glm::mat4 model = BenchModelMatrix(false);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(model);
+		glm::mat3 normal = NormalMatrixCofactorSse(model);
+		benchmark::DoNotOptimize(normal);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_NormalMatrixCofactorSse);
+#endif
+
+static void BM_NormalMatrixUniformScale(benchmark::State& state)
+{
+	glm::mat4 model = BenchModelMatrix(true);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(model);
+		glm::mat3 normal = NormalMatrixUniformScale(model);
+		benchmark::DoNotOptimize(normal);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_NormalMatrixUniformScale);
+
+//Keys shaped like a frame of the scene: one program, a few texture sets and VAOs, spread out depths.
+//137 is the draw count of the car scene, the larger sizes are scenes with many cars.
+static std::vector<RenderSortEntry> BenchSortEntries(int count)
+{
+	std::mt19937 random(7);
+	std::uniform_int_distribution<uint32_t> textureSet(0, 11), vao(1, 15);
+	std::uniform_real_distribution<float> depth(1.0f, 200.0f);
+	std::vector<RenderSortEntry> entries(count);
+	for (int i = 0; i < count; i++)
+		entries[i] = { RenderSortKey(RENDER_LAYER_OPAQUE, 11, textureSet(random), vao(random), depth(random)), (uint32_t)i };
+	return entries;
+}
+
+//Radix sort, std::stable_sort below RADIX_SORT_MIN_ENTRIES
+static void BM_RenderQueueRadixSort(benchmark::State& state)
+{
+	const std::vector<RenderSortEntry> input = BenchSortEntries((int)state.range(0));
+	std::vector<RenderSortEntry> entries, scratch;
+	for (auto _ : state) {
+		entries = input;
+		RadixSortEntries(entries, scratch);
+		benchmark::DoNotOptimize(entries.data());
+	}
+	state.SetItemsProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_RenderQueueRadixSort)->Arg(137)->Arg(512)->Arg(4096)->Arg(65536);
+
+//Comparison sort on the same keys, the baseline the radix sort has to beat
+static void BM_RenderQueueStdSort(benchmark::State& state)
+{
+	const std::vector<RenderSortEntry> input = BenchSortEntries((int)state.range(0));
+	std::vector<RenderSortEntry> entries;
+	for (auto _ : state) {
+		entries = input;
+		std::stable_sort(entries.begin(), entries.end(), [](const RenderSortEntry& a, const RenderSortEntry& b) { return a.key < b.key; });
+		benchmark::DoNotOptimize(entries.data());
+	}
+	state.SetItemsProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_RenderQueueStdSort)->Arg(137)->Arg(512)->Arg(4096)->Arg(65536);
+
+//Car-shaped hierarchy: per car a root, 12 body parts and 4 wheels of tire, hub and a spoke node with 8 spokes,
+//every part with a draw whose sphere update() moves
+static SceneGraph BenchSceneGraph(int cars, std::vector<SceneNodeId>& carNodes)
+{
+	SceneGraph scene;
+	const glm::mat4 part = BenchModelMatrix(true);
+	MeshRef mesh;
+	mesh.bounds.radius = 1.0f;
+	auto addPart = [&](SceneNodeId parent) {
+		const SceneNodeId node = scene.addNode(parent, part);
+		scene.addDraw(node, mesh, 0, true, { { 4, 0, 3 } });
+		return node;
+	};
+	for (int car = 0; car < cars; car++) {
+		const SceneNodeId root = scene.addNode(SCENE_NO_PARENT, glm::translate(glm::mat4(1.0f), glm::vec3(8.0f * car, 0.0f, 0.0f)));
+		carNodes.push_back(root);
+		for (int i = 0; i < 12; i++)
+			addPart(root);
+		for (int wheel = 0; wheel < 4; wheel++) {
+			const SceneNodeId node = scene.addNode(root, part);
+			addPart(node);
+			addPart(node);
+			const SceneNodeId spokes = scene.addNode(node, part);
+			for (int i = 0; i < 8; i++)
+				addPart(spokes);
+		}
+	}
+	scene.update();
+	return scene;
+}
+
+//World matrix and sphere update of 100 cars: arg 0 nothing moved, 1 the first car moved, 2 every car moved
+//(what rebuilding every transform each frame costs)
+static void BM_SceneGraphUpdate(benchmark::State& state)
+{
+	std::vector<SceneNodeId> cars;
+	SceneGraph scene = BenchSceneGraph(100, cars);
+	const int moved = state.range(0) == 0 ? 0 : state.range(0) == 1 ? 1 : (int)cars.size();
+	float x = 0.0f;
+	for (auto _ : state) {
+		for (int i = 0; i < moved; i++)
+			scene.setLocal(cars[i], glm::translate(glm::mat4(1.0f), glm::vec3(x, 0.0f, 0.0f)));
+		scene.update();
+		benchmark::DoNotOptimize(scene.nodes.data());
+		x += 0.01f;
+	}
+	state.counters["updated"] = (double)scene.updatedNodes;
+	state.SetItemsProcessed(state.iterations() * scene.nodes.size());
+}
+BENCHMARK(BM_SceneGraphUpdate)->Arg(0)->Arg(1)->Arg(2);
+
+//Spheres spread over the ground around the scene's camera, about a fifth of them in view
+static CullingSpheres BenchCullingSpheres(int count, FrustumPlanes& frustum)
+{
+	std::mt19937 random(11);
+	std::uniform_real_distribution<float> position(-200.0f, 200.0f), radius(0.5f, 5.0f);
+	CullingSpheres spheres;
+	spheres.resize(count);
+	for (int i = 0; i < count; i++)
+		spheres.set(i, glm::vec3(position(random), 0.0f, position(random)), radius(random));
+	const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 8.0f, 25.0f), glm::vec3(0.0f, 8.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	frustum = ExtractFrustumPlanes(glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 10000.0f) * view);
+	return spheres;
+}
+
+//Kernel 0 scalar, 1 CullSpheres (AVX where the CPU has it, SSE otherwise), 2 threaded on every core, 3 SSE.
+//2101 is the draw count of --cars 100.
+static void BM_CullSpheres(benchmark::State& state)
+{
+	FrustumPlanes frustum;
+	const CullingSpheres spheres = BenchCullingSpheres((int)state.range(1), frustum);
+	std::vector<uint8_t> visible(spheres.groups());
+	const unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	CullWorkers workers;
+	for (auto _ : state) {
+		if (state.range(0) == 0)
+			CullSpheresScalar(frustum, spheres, 0, spheres.groups(), visible.data());
+		else if (state.range(0) == 1)
+			CullSpheres(frustum, spheres, 0, spheres.groups(), visible.data());
+		else if (state.range(0) == 2)
+			CullSpheresThreaded(frustum, spheres, visible.data(), threads, workers);
+#ifdef THECAR_CULL_SSE
+		else
+			CullSpheresSse(frustum, spheres, 0, spheres.groups(), visible.data());
+#endif
+		benchmark::DoNotOptimize(visible.data());
+	}
+	state.SetItemsProcessed(state.iterations() * spheres.count);
+}
+BENCHMARK(BM_CullSpheres)->ArgsProduct({ { 0, 1, 3 }, { 2101, 65536 } })->Args({ 2, 1 << 20 })->Args({ 1, 1 << 20 });
+
+BENCHMARK_MAIN();
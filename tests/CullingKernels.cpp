@@ -0,0 +1,119 @@
+/*
+* Frustum culling kernel agreement test, no GL context needed.
+* CullSpheresScalar is the reference: the SSE kernel, the AVX kernel where the CPU has AVX, CullSpheres and
+* CullSpheresThreaded must set exactly the same visibility bits for the same spheres, sphere for sphere.
+* Spheres are spread around and across every plane of a perspective frustum, many of them touching one, and the
+* threaded runs are forced into several chunks whatever the core count, on one pool of workers. Built twice by CMake: with the default
+* flags, where CullSpheres picks the AVX kernel at run time, and, where the compiler takes it, with -mavx; the
+* AVX build exits with SKIP_EXIT_CODE on a CPU without AVX.
+* Exit code 0 when every kernel matches.
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Culling.h"
+
+namespace {
+	const int SKIP_EXIT_CODE = 77;
+	//Not a multiple of 8, so the padded last group is covered, and enough for 4 threads of full chunks
+	const size_t SPHERE_COUNT = CULL_MIN_SPHERES_PER_THREAD * 4 + 5;
+	//Thread counts of consecutive threaded culls on one pool: the second leaves workers idle, the third reuses them
+	const unsigned THREAD_RUNS[] = { 4, 2, 4 };
+
+	//Spheres around the scene camera's frustum: a quarter placed on a plane, at a distance of about their radius
+	CullingSpheres MakeSpheres(const FrustumPlanes& frustum)
+	{
+		std::mt19937 random(7);
+		std::uniform_real_distribution<float> position(-300.0f, 300.0f), radius(0.0f, 8.0f), jitter(-0.01f, 0.01f);
+		std::uniform_int_distribution<int> plane(0, 5);
+		CullingSpheres spheres;
+		spheres.resize(SPHERE_COUNT);
+		for (size_t i = 0; i < SPHERE_COUNT; i++) {
+			glm::vec3 center(position(random), position(random) * 0.2f, position(random));
+			const float r = radius(random);
+			if (i % 4 == 0) {
+				const glm::vec4& p = frustum.planes[plane(random)];
+				const float distance = glm::dot(glm::vec3(p), center) + p.w;
+				center -= glm::vec3(p) * (distance + r * (1.0f + jitter(random)));
+			}
+			spheres.set(i, center, r);
+		}
+		return spheres;
+	}
+
+	//Spheres whose bit differs between reference and tested
+	size_t CountMismatches(const std::vector<uint8_t>& reference, const std::vector<uint8_t>& tested, size_t count)
+	{
+		size_t mismatches = 0;
+		for (size_t i = 0; i < count; i++)
+			if (((reference[i >> 3] ^ tested[i >> 3]) >> (i & 7)) & 1)
+				mismatches++;
+		return mismatches;
+	}
+
+	//Runs kernel over every sphere and reports whether it matches reference
+	bool CheckKernel(const char* name, const std::vector<uint8_t>& reference, const FrustumPlanes& frustum, const CullingSpheres& spheres,
+		void (*kernel)(const FrustumPlanes&, const CullingSpheres&, size_t, size_t, uint8_t*))
+	{
+		std::vector<uint8_t> visible(spheres.groups());
+		kernel(frustum, spheres, 0, spheres.groups(), visible.data());
+		const size_t mismatches = CountMismatches(reference, visible, spheres.count);
+		std::cout << (mismatches ? "FAIL " : "PASS ") << name << ": " << mismatches << " spheres differ from scalar" << std::endl;
+		return mismatches == 0;
+	}
+}
+
+int main()
+{
+#if defined(__AVX__) && (defined(__GNUC__) || defined(__clang__))
+	if (!__builtin_cpu_supports("avx")) {
+		std::cout << "SKIP: built with AVX, the CPU has none" << std::endl;
+		return SKIP_EXIT_CODE;
+	}
+#endif
+
+	const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 8.0f, 25.0f), glm::vec3(0.0f, 8.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	const FrustumPlanes frustum = ExtractFrustumPlanes(glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 10000.0f) * view);
+	const CullingSpheres spheres = MakeSpheres(frustum);
+
+	std::vector<uint8_t> reference(spheres.groups()), threaded(spheres.groups());
+	CullSpheresScalar(frustum, spheres, 0, spheres.groups(), reference.data());
+
+	size_t visible = 0;
+	for (size_t i = 0; i < spheres.count; i++)
+		visible += (reference[i >> 3] >> (i & 7)) & 1;
+	std::cout << "INFO: " << visible << " of " << spheres.count << " spheres visible to the scalar kernel" << std::endl;
+
+	bool passed = true;
+#if defined(THECAR_CULL_SSE)
+	passed = CheckKernel("SSE kernel", reference, frustum, spheres, CullSpheresSse) && passed;
+#endif
+#if defined(THECAR_CULL_AVX)
+	if (CullUsesAvx())
+		passed = CheckKernel("AVX kernel", reference, frustum, spheres, CullSpheresAvx) && passed;
+	else
+		std::cout << "SKIP AVX kernel: the CPU has no AVX" << std::endl;
+#endif
+	const std::string picked = std::string("CullSpheres (") + CullKernelName() + ")";
+	passed = CheckKernel(picked.c_str(), reference, frustum, spheres, CullSpheres) && passed;
+
+	CullWorkers workers;
+	for (unsigned threads : THREAD_RUNS) {
+		std::fill(threaded.begin(), threaded.end(), 0);
+		CullSpheresThreaded(frustum, spheres, threaded.data(), threads, workers);
+		const size_t threadedMismatches = CountMismatches(reference, threaded, spheres.count);
+		std::cout << (threadedMismatches ? "FAIL " : "PASS ") << "CullSpheresThreaded on " << threads << " threads: "
+			<< threadedMismatches << " spheres differ from scalar" << std::endl;
+		passed = passed && threadedMismatches == 0;
+	}
+	return passed ? 0 : 1;
+}